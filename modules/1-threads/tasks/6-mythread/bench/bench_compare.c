@@ -0,0 +1,432 @@
+#include "mythread.h"
+#include "uthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Сравнение трёх реализаций потоков: pthread, mythread (clone) и
+ * uthread (ucontext, 7-uthread)
+ *
+ * Запуск: bench_compare [предел потоков]
+ *
+ * Результат - CSV в stdout: impl,metric,value,unit,note
+ *   create_join_p50/p99 - создание + ожидание потока с пустой функцией
+ *   rss_per_thread      - прирост RSS на один запущенный и ждущий поток
+ *   ctx_switch          - одно переключение: пинг-понг через pipe
+ *                         (ядерные потоки) или через yield (uthread)
+ *   max_threads         - сколько потоков живёт одновременно до первой
+ *                         ошибки (в note - errno или "cap", если упёрлись
+ *                         в предел из аргумента)
+ */
+
+#define LATENCY_SAMPLES     2000
+#define RSS_THREADS         1000
+#define SWITCH_ROUNDS       20000
+#define DEFAULT_MAX_THREADS 10000
+
+/* Время в наносекундах по монотонным часам */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Резидентная память процесса в байтах */
+static long rss_bytes(void) {
+    long size, resident = -1;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &size, &resident) != 2) {
+            resident = -1;
+        }
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void csv(const char *impl, const char *metric, double value, const char *unit, const char *note) {
+    printf("%s,%s,%.0f,%s,%s\n", impl, metric, value, unit, note);
+    fflush(stdout);
+}
+
+/* Печатает p50/p99 по массиву замеров (массив сортируется) */
+static void csv_latency(const char *impl, double *samples, int n) {
+    qsort(samples, n, sizeof(double), cmp_double);
+    csv(impl, "create_join_p50", samples[n / 2], "ns", "");
+    csv(impl, "create_join_p99", samples[n * 99 / 100], "ns", "");
+}
+
+/* --- Ядерные потоки: pthread и mythread за одним интерфейсом --- */
+
+typedef union {
+    pthread_t  pt;
+    mythread_t my;
+} kthread_t;
+
+typedef struct {
+    const char *name;
+    int         flags;   /* Флаги mythread_create_flags */
+    int       (*spawn)(kthread_t *t, int flags, void *(*fn)(void *), void *arg);
+    int       (*join)(kthread_t *t);
+} kthread_impl_t;
+
+static int pt_spawn(kthread_t *t, int flags, void *(*fn)(void *), void *arg) {
+    (void)flags;
+    int ret = pthread_create(&t->pt, NULL, fn, arg);
+    if (ret != 0) {
+        errno = ret;
+        return -1;
+    }
+    return 0;
+}
+
+static int pt_join(kthread_t *t) {
+    return pthread_join(t->pt, NULL) == 0 ? 0 : -1;
+}
+
+static int my_spawn(kthread_t *t, int flags, void *(*fn)(void *), void *arg) {
+    return mythread_create_flags(&t->my, fn, arg, flags);
+}
+
+static int my_join(kthread_t *t) {
+    return mythread_join(&t->my, NULL);
+}
+
+static const kthread_impl_t kthreads[] = {
+    { "pthread",        0,                   pt_spawn, pt_join },
+    { "mythread",       0,                   my_spawn, my_join },
+    { "mythread_futex", MYTHREAD_JOIN_FUTEX, my_spawn, my_join },
+};
+
+#define NUM_KTHREADS (int)(sizeof(kthreads) / sizeof(kthreads[0]))
+
+/* Потоки, ждущие отмашки: для RSS и максимума */
+static volatile int release_flag;
+static volatile int started_count;
+
+static void *noop_fn(void *arg) {
+    return arg;
+}
+
+static void *parked_fn(void *arg) {
+    (void)arg;
+    __atomic_add_fetch(&started_count, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&release_flag, __ATOMIC_ACQUIRE)) {
+        syscall(SYS_futex, &release_flag, FUTEX_WAIT, 0, NULL, NULL, 0);
+    }
+    return NULL;
+}
+
+static void release_parked(void) {
+    __atomic_store_n(&release_flag, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &release_flag, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+}
+
+/* Запускает до n ждущих потоков, возвращает сколько удалось */
+static int park_threads(const kthread_impl_t *impl, kthread_t *threads, int n, int *err) {
+    release_flag = 0;
+    started_count = 0;
+    *err = 0;
+
+    int count = 0;
+    while (count < n) {
+        if (impl->spawn(&threads[count], impl->flags, parked_fn, NULL) != 0) {
+            *err = errno;
+            break;
+        }
+        count++;
+    }
+
+    /* Все запущенные должны дойти до ожидания (и коснуться своего стека) */
+    while (__atomic_load_n(&started_count, __ATOMIC_ACQUIRE) < count) {
+        sched_yield();
+    }
+    return count;
+}
+
+static void unpark_threads(const kthread_impl_t *impl, kthread_t *threads, int count) {
+    release_parked();
+    for (int i = 0; i < count; i++) {
+        impl->join(&threads[i]);
+    }
+}
+
+static int kthread_rss(const kthread_impl_t *impl) {
+    kthread_t *threads = malloc(RSS_THREADS * sizeof(kthread_t));
+    if (!threads) {
+        return -1;
+    }
+
+    /* Закэшированные стеки уже резидентны - мерим на свежих */
+    mythread_stack_cache_trim(0);
+
+    int err;
+    long before = rss_bytes();
+    int count = park_threads(impl, threads, RSS_THREADS, &err);
+    long after = rss_bytes();
+    unpark_threads(impl, threads, count);
+    free(threads);
+
+    if (count < RSS_THREADS) {
+        errno = err;
+        return -1;
+    }
+    csv(impl->name, "rss_per_thread", (double)(after - before) / count, "bytes", "");
+    return 0;
+}
+
+static int kthread_latency(const kthread_impl_t *impl) {
+    double *samples = malloc(LATENCY_SAMPLES * sizeof(double));
+    if (!samples) {
+        return -1;
+    }
+
+    for (int i = 0; i < LATENCY_SAMPLES; i++) {
+        kthread_t t;
+        double start = now_ns();
+        if (impl->spawn(&t, impl->flags, noop_fn, NULL) != 0 || impl->join(&t) != 0) {
+            free(samples);
+            return -1;
+        }
+        samples[i] = now_ns() - start;
+    }
+
+    csv_latency(impl->name, samples, LATENCY_SAMPLES);
+    free(samples);
+    return 0;
+}
+
+/* Пинг-понг байтом через два pipe */
+typedef struct {
+    int in;
+    int out;
+} pingpong_t;
+
+static void *pong_fn(void *arg) {
+    pingpong_t *p = (pingpong_t *)arg;
+    char c;
+
+    for (int i = 0; i < SWITCH_ROUNDS; i++) {
+        if (read(p->in, &c, 1) != 1 || write(p->out, &c, 1) != 1) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static int kthread_switch(const kthread_impl_t *impl) {
+    int ping[2], pong[2];
+    if (pipe(ping) == -1 || pipe(pong) == -1) {
+        return -1;
+    }
+
+    pingpong_t p = { ping[0], pong[1] };
+    kthread_t t;
+    if (impl->spawn(&t, impl->flags, pong_fn, &p) != 0) {
+        return -1;
+    }
+
+    char c = 'x';
+    double start = now_ns();
+    for (int i = 0; i < SWITCH_ROUNDS; i++) {
+        if (write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1) {
+            break;
+        }
+    }
+    double elapsed = now_ns() - start;
+    impl->join(&t);
+
+    close(ping[0]);
+    close(ping[1]);
+    close(pong[0]);
+    close(pong[1]);
+
+    /* Два переключения на круг */
+    csv(impl->name, "ctx_switch", elapsed / (2.0 * SWITCH_ROUNDS), "ns", "pipe");
+    return 0;
+}
+
+static int kthread_max(const kthread_impl_t *impl, int cap) {
+    kthread_t *threads = malloc((size_t)cap * sizeof(kthread_t));
+    if (!threads) {
+        return -1;
+    }
+
+    int err;
+    int count = park_threads(impl, threads, cap, &err);
+    unpark_threads(impl, threads, count);
+    free(threads);
+    mythread_stack_cache_trim(0);
+
+    csv(impl->name, "max_threads", count, "threads", count == cap ? "cap" : strerror(err));
+    return 0;
+}
+
+/* --- uthread: потоки выполняются, пока main ждёт в join или yield --- */
+
+static volatile long uthread_rss_after;
+static int uthread_started;
+static int uthread_expected;
+
+static void *uthread_noop_fn(void *arg) {
+    return arg;
+}
+
+static void *uthread_parked_fn(void *arg) {
+    (void)arg;
+
+    /* Последний запущенный видит все стеки уже тронутыми */
+    if (++uthread_started == uthread_expected) {
+        uthread_rss_after = rss_bytes();
+    }
+    uthread_yield();
+    return NULL;
+}
+
+static int uthread_rss(void) {
+    uthread_t *threads = malloc(RSS_THREADS * sizeof(uthread_t));
+    if (!threads) {
+        return -1;
+    }
+
+    uthread_started = 0;
+    uthread_expected = RSS_THREADS;
+    long before = rss_bytes();
+    for (int i = 0; i < RSS_THREADS; i++) {
+        if (uthread_create(&threads[i], uthread_parked_fn, NULL) != 0) {
+            free(threads);
+            return -1;
+        }
+    }
+    for (int i = 0; i < RSS_THREADS; i++) {
+        uthread_join(&threads[i], NULL);
+    }
+    free(threads);
+
+    csv("uthread", "rss_per_thread", (double)(uthread_rss_after - before) / RSS_THREADS, "bytes", "");
+    return 0;
+}
+
+static int uthread_latency(void) {
+    double *samples = malloc(LATENCY_SAMPLES * sizeof(double));
+    if (!samples) {
+        return -1;
+    }
+
+    for (int i = 0; i < LATENCY_SAMPLES; i++) {
+        uthread_t t;
+        double start = now_ns();
+        if (uthread_create(&t, uthread_noop_fn, NULL) != 0 || uthread_join(&t, NULL) != 0) {
+            free(samples);
+            return -1;
+        }
+        samples[i] = now_ns() - start;
+    }
+
+    csv_latency("uthread", samples, LATENCY_SAMPLES);
+    free(samples);
+    return 0;
+}
+
+static void *uthread_yield_fn(void *arg) {
+    (void)arg;
+    for (int i = 0; i < SWITCH_ROUNDS; i++) {
+        uthread_yield();
+    }
+    return NULL;
+}
+
+static int uthread_switch(void) {
+    uthread_t a, b;
+
+    if (uthread_create(&a, uthread_yield_fn, NULL) != 0 ||
+        uthread_create(&b, uthread_yield_fn, NULL) != 0) {
+        return -1;
+    }
+    double start = now_ns();
+    uthread_join(&a, NULL);
+    uthread_join(&b, NULL);
+    double elapsed = now_ns() - start;
+
+    /* Каждый yield из двух потоков - одно переключение */
+    csv("uthread", "ctx_switch", elapsed / (2.0 * SWITCH_ROUNDS), "ns", "yield");
+    return 0;
+}
+
+static int uthread_max(int cap) {
+    uthread_t *threads = malloc((size_t)cap * sizeof(uthread_t));
+    if (!threads) {
+        return -1;
+    }
+
+    int count = 0;
+    int err = 0;
+    while (count < cap) {
+        if (uthread_create(&threads[count], uthread_noop_fn, NULL) != 0) {
+            err = errno;
+            break;
+        }
+        count++;
+    }
+    for (int i = 0; i < count; i++) {
+        uthread_join(&threads[i], NULL);
+    }
+    free(threads);
+
+    csv("uthread", "max_threads", count, "threads", count == cap ? "cap" : strerror(err));
+    return 0;
+}
+
+/* --- Главная функция --- */
+
+int main(int argc, char **argv) {
+    int cap = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_THREADS;
+    if (cap <= 0) {
+        fprintf(stderr, "usage: %s [max_threads_cap]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int failed = 0;
+    printf("impl,metric,value,unit,note\n");
+
+    /* RSS первым: стеки, закэшированные glibc и libmythread, исказят прирост */
+    for (int i = 0; i < NUM_KTHREADS; i++) {
+        if (kthread_rss(&kthreads[i]) != 0) {
+            fprintf(stderr, "%s: rss failed: %s\n", kthreads[i].name, strerror(errno));
+            failed = 1;
+        }
+    }
+    failed |= uthread_rss() != 0;
+
+    for (int i = 0; i < NUM_KTHREADS; i++) {
+        if (kthread_latency(&kthreads[i]) != 0 || kthread_switch(&kthreads[i]) != 0) {
+            fprintf(stderr, "%s: latency/switch failed: %s\n", kthreads[i].name, strerror(errno));
+            failed = 1;
+        }
+    }
+    failed |= uthread_latency() != 0 || uthread_switch() != 0;
+
+    /* Максимум последним: он выбирает лимиты процесса */
+    for (int i = 0; i < NUM_KTHREADS; i++) {
+        if (kthread_max(&kthreads[i], cap) != 0) {
+            failed = 1;
+        }
+    }
+    failed |= uthread_max(cap) != 0;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,544 @@
+#include "mythread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Микробенчмарки libmythread
+ *
+ * Запуск: bench_mythread [имя ...]
+ * Без аргументов выполняются все бенчмарки.
+ */
+
+#define JOIN_LATENCY_ITERATIONS 1000
+#define STACK_BENCH_THREADS     10000
+#define SYNC_TOTAL_OPS          1000000  /* lock/unlock на все потоки вместе */
+#define SYNC_BARRIER_ROUNDS     200
+#define SYNC_PINGPONG_ROUNDS    10000
+#define POOL_SPAWN_BATCH        64       /* Одновременно живых потоков в spawn-per-task */
+#define BATCH_THREADS           256
+#define BATCH_ROUNDS            20
+
+/* Время в наносекундах по монотонным часам */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Печатает p50/p99/среднее по массиву замеров (массив сортируется) */
+static void print_latency(const char *name, const char *mode, double *samples, int n) {
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    qsort(samples, n, sizeof(double), cmp_double);
+
+    printf("%-16s %-10s p50=%8.0f ns  p99=%8.0f ns  avg=%8.0f ns\n",
+           name, mode, samples[n / 2], samples[n * 99 / 100], sum / n);
+}
+
+/* --- Задержка join: от выхода потока до возврата из mythread_join --- */
+
+static void *join_latency_fn(void *arg) {
+    /* Даём создателю дойти до join и заснуть в нём */
+    usleep(200);
+    *(volatile double *)arg = now_ns();
+    return NULL;
+}
+
+static int bench_join_latency_mode(const char *mode, int flags) {
+    double *samples = malloc(JOIN_LATENCY_ITERATIONS * sizeof(double));
+    if (!samples) {
+        perror("malloc");
+        return -1;
+    }
+
+    for (int i = 0; i < JOIN_LATENCY_ITERATIONS; i++) {
+        mythread_t thread;
+        volatile double exit_ns = 0;
+
+        if (mythread_create_flags(&thread, join_latency_fn, (void *)&exit_ns, flags) != 0 ||
+            mythread_join(&thread, NULL) != 0) {
+            perror("create/join");
+            free(samples);
+            return -1;
+        }
+        samples[i] = now_ns() - exit_ns;
+    }
+
+    print_latency("join latency", mode, samples, JOIN_LATENCY_ITERATIONS);
+    free(samples);
+    return 0;
+}
+
+static int bench_join_latency(void) {
+    if (bench_join_latency_mode("waitpid", 0) != 0) {
+        return -1;
+    }
+    return bench_join_latency_mode("futex", MYTHREAD_JOIN_FUTEX);
+}
+
+/* --- RSS и время создания 10k потоков при разных размерах стека --- */
+
+static volatile int stack_bench_gate;  /* 0 - потоки ждут, 1 - отпущены */
+
+static void *stack_bench_fn(void *arg) {
+    while (__atomic_load_n(&stack_bench_gate, __ATOMIC_ACQUIRE) == 0) {
+        syscall(SYS_futex, &stack_bench_gate, FUTEX_WAIT, 0, NULL, NULL, 0);
+    }
+    return arg;
+}
+
+/* Текущий RSS процесса в килобайтах */
+static long rss_kb(void) {
+    long pages_total, pages_resident;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return -1;
+    }
+    if (fscanf(f, "%ld %ld", &pages_total, &pages_resident) != 2) {
+        pages_resident = -1;
+    }
+    fclose(f);
+    return pages_resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int bench_stack_size_one(const char *name, size_t stack_size, int flags) {
+    mythread_t *threads = malloc(STACK_BENCH_THREADS * sizeof(mythread_t));
+    if (!threads) {
+        perror("malloc");
+        return -1;
+    }
+
+    mythread_attr_t attr;
+    mythread_attr_init(&attr);
+    attr.stack_size = stack_size;
+    attr.flags = MYTHREAD_JOIN_FUTEX | flags;
+
+    stack_bench_gate = 0;
+    long rss_before = rss_kb();
+    double start = now_ns();
+
+    int created = 0;
+    while (created < STACK_BENCH_THREADS &&
+           mythread_create_attr(&threads[created], &attr, stack_bench_fn, NULL) == 0) {
+        created++;
+    }
+
+    double elapsed = now_ns() - start;
+    long rss_after = rss_kb();
+
+    __atomic_store_n(&stack_bench_gate, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &stack_bench_gate, FUTEX_WAKE, __INT_MAX__, NULL, NULL, 0);
+    for (int i = 0; i < created; i++) {
+        mythread_join(&threads[i], NULL);
+    }
+    free(threads);
+
+    if (created == 0) {
+        perror("mythread_create_attr");
+        return -1;
+    }
+    printf("%-16s %-10s threads=%5d  create=%7.0f ns/thread  rss=%6.1f KB/thread (%ld MB total)\n",
+           "stack size", name, created, elapsed / created,
+           (double)(rss_after - rss_before) / created, (rss_after - rss_before) / 1024);
+    return 0;
+}
+
+static int bench_stack_size(void) {
+    static const struct {
+        const char *name;
+        size_t      size;
+        int         flags;
+    } configs[] = {
+        { "16K",        16 * 1024,   0 },
+        { "64K",        64 * 1024,   0 },
+        { "256K",       256 * 1024,  0 },
+        { "1M",         1024 * 1024, 0 },
+        { "1M-noresv",  1024 * 1024, MYTHREAD_STACK_NORESERVE },
+    };
+
+    /* Меряем создание свежих стеков, а не кэш */
+    size_t old_limit = mythread_stack_cache_set_limit(0);
+    int ret = 0;
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]) && ret == 0; i++) {
+        ret = bench_stack_size_one(configs[i].name, configs[i].size, configs[i].flags);
+    }
+    mythread_stack_cache_set_limit(old_limit);
+    return ret;
+}
+
+/* --- Примитивы синхронизации: mythread против pthread --- */
+
+static const int sync_thread_counts[] = { 2, 4, 8, 16, 32, 64 };
+#define NUM_SYNC_COUNTS (int)(sizeof(sync_thread_counts) / sizeof(sync_thread_counts[0]))
+
+/*
+ * Общий интерфейс, чтобы гонять один и тот же код на обеих реализациях.
+ * Каждая реализация работает в "своих" потоках: примитивы glibc опираются
+ * на собственный TCB потока, которого у mythread без MYTHREAD_PRIVATE_TLS нет.
+ */
+typedef union {
+    mythread_t my;
+    pthread_t  pt;
+} sync_thread_t;
+
+typedef struct {
+    const char *name;
+    int  (*spawn)(sync_thread_t *, void *(*)(void *), void *);
+    void (*wait)(sync_thread_t *);
+    int  (*lock)(void *);
+    int  (*unlock)(void *);
+    int  (*barrier_wait)(void *);
+    int  (*cond_wait)(void *, void *);
+    int  (*cond_signal)(void *);
+    void *mutex;
+    void *barrier;
+    void *cond;
+} sync_ops_t;
+
+static mythread_mutex_t   my_mutex = MYTHREAD_MUTEX_INITIALIZER;
+static mythread_barrier_t my_barrier;
+static mythread_cond_t    my_cond = MYTHREAD_COND_INITIALIZER;
+static pthread_mutex_t    pt_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t  pt_barrier;
+static pthread_cond_t     pt_cond = PTHREAD_COND_INITIALIZER;
+
+static int my_spawn(sync_thread_t *t, void *(*fn)(void *), void *arg) {
+    return mythread_create_flags(&t->my, fn, arg, MYTHREAD_JOIN_FUTEX);
+}
+
+static void my_wait(sync_thread_t *t) {
+    mythread_join(&t->my, NULL);
+}
+
+static int pt_spawn(sync_thread_t *t, void *(*fn)(void *), void *arg) {
+    int err = pthread_create(&t->pt, NULL, fn, arg);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static void pt_wait(sync_thread_t *t) {
+    pthread_join(t->pt, NULL);
+}
+
+static const sync_ops_t sync_impls[] = {
+    { "mythread", my_spawn, my_wait,
+      (int (*)(void *))mythread_mutex_lock, (int (*)(void *))mythread_mutex_unlock,
+      (int (*)(void *))mythread_barrier_wait,
+      (int (*)(void *, void *))mythread_cond_wait, (int (*)(void *))mythread_cond_signal,
+      &my_mutex, &my_barrier, &my_cond },
+    { "pthread", pt_spawn, pt_wait,
+      (int (*)(void *))pthread_mutex_lock, (int (*)(void *))pthread_mutex_unlock,
+      (int (*)(void *))pthread_barrier_wait,
+      (int (*)(void *, void *))pthread_cond_wait, (int (*)(void *))pthread_cond_signal,
+      &pt_mutex, &pt_barrier, &pt_cond },
+};
+
+typedef struct {
+    const sync_ops_t *ops;
+    int               iterations;
+} sync_arg_t;
+
+static long sync_counter;
+
+static void *mutex_bench_fn(void *arg) {
+    sync_arg_t *a = (sync_arg_t *)arg;
+    for (int i = 0; i < a->iterations; i++) {
+        a->ops->lock(a->ops->mutex);
+        sync_counter++;
+        a->ops->unlock(a->ops->mutex);
+    }
+    return NULL;
+}
+
+static void *barrier_bench_fn(void *arg) {
+    sync_arg_t *a = (sync_arg_t *)arg;
+    for (int i = 0; i < a->iterations; i++) {
+        a->ops->barrier_wait(a->ops->barrier);
+    }
+    return NULL;
+}
+
+/* Запускает nthreads потоков с fn, возвращает время в нс или -1 */
+static double run_sync_threads(int nthreads, void *(*fn)(void *), sync_arg_t *arg) {
+    sync_thread_t threads[64];
+    double start = now_ns();
+
+    int created = 0;
+    for (; created < nthreads; created++) {
+        if (arg->ops->spawn(&threads[created], fn, arg) != 0) {
+            perror(arg->ops->name);
+            break;
+        }
+    }
+    for (int i = 0; i < created; i++) {
+        arg->ops->wait(&threads[i]);
+    }
+    return created == nthreads ? now_ns() - start : -1;
+}
+
+/* Пинг-понг двух потоков через мьютекс + условную переменную */
+static volatile int pingpong_turn;
+
+static void *pingpong_fn(void *arg) {
+    sync_arg_t *a = (sync_arg_t *)arg;
+    int me = (a->iterations < 0);  /* Знак числа раундов задаёт сторону */
+    int rounds = me ? -a->iterations : a->iterations;
+
+    a->ops->lock(a->ops->mutex);
+    for (int i = 0; i < rounds; i++) {
+        while (pingpong_turn != me) {
+            a->ops->cond_wait(a->ops->cond, a->ops->mutex);
+        }
+        pingpong_turn = !me;
+        a->ops->cond_signal(a->ops->cond);
+    }
+    a->ops->unlock(a->ops->mutex);
+    return NULL;
+}
+
+static int bench_sync(void) {
+    for (size_t impl = 0; impl < sizeof(sync_impls) / sizeof(sync_impls[0]); impl++) {
+        const sync_ops_t *ops = &sync_impls[impl];
+
+        for (int c = 0; c < NUM_SYNC_COUNTS; c++) {
+            int n = sync_thread_counts[c];
+            sync_arg_t arg = { ops, SYNC_TOTAL_OPS / n };
+
+            sync_counter = 0;
+            double mutex_ns = run_sync_threads(n, mutex_bench_fn, &arg);
+            if (mutex_ns < 0 || sync_counter != (long)arg.iterations * n) {
+                fprintf(stderr, "%s mutex: lost updates\n", ops->name);
+                return -1;
+            }
+
+            mythread_barrier_init(&my_barrier, n);
+            pthread_barrier_init(&pt_barrier, NULL, n);
+            arg.iterations = SYNC_BARRIER_ROUNDS;
+            double barrier_ns = run_sync_threads(n, barrier_bench_fn, &arg);
+            pthread_barrier_destroy(&pt_barrier);
+            if (barrier_ns < 0) {
+                return -1;
+            }
+
+            printf("%-16s %-10s threads=%2d  mutex=%7.1f ns/op  barrier=%9.0f ns/round\n",
+                   "sync", ops->name, n, mutex_ns / SYNC_TOTAL_OPS, barrier_ns / SYNC_BARRIER_ROUNDS);
+        }
+
+        /* Пинг-понг: одна сторона с положительным числом раундов, другая - с отрицательным */
+        sync_thread_t a, b;
+        sync_arg_t ping = { ops, SYNC_PINGPONG_ROUNDS };
+        sync_arg_t pong = { ops, -SYNC_PINGPONG_ROUNDS };
+        pingpong_turn = 0;
+        double start = now_ns();
+        if (ops->spawn(&a, pingpong_fn, &ping) != 0 || ops->spawn(&b, pingpong_fn, &pong) != 0) {
+            perror(ops->name);
+            return -1;
+        }
+        ops->wait(&a);
+        ops->wait(&b);
+        printf("%-16s %-10s cond ping-pong=%7.0f ns/round trip\n",
+               "sync", ops->name, (now_ns() - start) / SYNC_PINGPONG_ROUNDS);
+    }
+    return 0;
+}
+
+/* --- Пул потоков против потока на задачу --- */
+
+typedef struct {
+    const char *name;
+    int         tasks;
+    long        work;   /* Итераций цикла внутри задачи */
+} pool_kind_t;
+
+static const pool_kind_t pool_kinds[] = {
+    { "tiny",   20000, 0 },
+    { "medium", 2000,  20000 },
+};
+
+static void *pool_task_fn(void *arg) {
+    long work = (long)arg;
+    volatile long sum = 0;
+    for (long i = 0; i < work; i++) {
+        sum += i;
+    }
+    return (void *)sum;
+}
+
+/* Задачи в пуле: отправка из main, ожидание всех через mythread_pool_wait */
+static double run_pool_tasks(mythread_pool_t *pool, mythread_future_t *futures, const pool_kind_t *kind) {
+    double start = now_ns();
+    for (int i = 0; i < kind->tasks; i++) {
+        if (mythread_pool_submit(pool, &futures[i], pool_task_fn, (void *)kind->work) != 0) {
+            perror("mythread_pool_submit");
+            return -1;
+        }
+    }
+    if (mythread_pool_wait(pool) != 0) {
+        perror("mythread_pool_wait");
+        return -1;
+    }
+    return now_ns() - start;
+}
+
+/* Каждая задача - свой поток, не больше POOL_SPAWN_BATCH живых одновременно */
+static double run_spawn_tasks(const pool_kind_t *kind) {
+    mythread_t threads[POOL_SPAWN_BATCH];
+    double start = now_ns();
+
+    for (int done = 0; done < kind->tasks; ) {
+        int batch = kind->tasks - done < POOL_SPAWN_BATCH ? kind->tasks - done : POOL_SPAWN_BATCH;
+        for (int i = 0; i < batch; i++) {
+            if (mythread_create_flags(&threads[i], pool_task_fn, (void *)kind->work, MYTHREAD_JOIN_FUTEX) != 0) {
+                perror("mythread_create_flags");
+                return -1;
+            }
+        }
+        for (int i = 0; i < batch; i++) {
+            mythread_join(&threads[i], NULL);
+        }
+        done += batch;
+    }
+    return now_ns() - start;
+}
+
+static int bench_pool(void) {
+    mythread_pool_t *pool = mythread_pool_create(0);
+    if (!pool) {
+        perror("mythread_pool_create");
+        return -1;
+    }
+
+    int ret = 0;
+    for (size_t k = 0; k < sizeof(pool_kinds) / sizeof(pool_kinds[0]) && ret == 0; k++) {
+        const pool_kind_t *kind = &pool_kinds[k];
+        mythread_future_t *futures = malloc(sizeof(mythread_future_t) * kind->tasks);
+        if (!futures) {
+            ret = -1;
+            break;
+        }
+
+        double pool_ns = run_pool_tasks(pool, futures, kind);
+        double spawn_ns = run_spawn_tasks(kind);
+        free(futures);
+        if (pool_ns < 0 || spawn_ns < 0) {
+            ret = -1;
+            break;
+        }
+
+        printf("%-16s %-10s tasks=%5d  pool=%9.0f tasks/s  spawn=%9.0f tasks/s  speedup=x%.1f\n",
+               "pool", kind->name, kind->tasks,
+               kind->tasks / (pool_ns / 1e9), kind->tasks / (spawn_ns / 1e9), spawn_ns / pool_ns);
+    }
+
+    mythread_pool_destroy(pool);
+    return ret;
+}
+
+/* --- Пакетное создание: цикл create/join против create_n/join_all --- */
+
+static void *batch_fn(void *arg) {
+    return arg;
+}
+
+static int bench_batch(void) {
+    static mythread_t threads[BATCH_THREADS];
+    static void *(*routines[BATCH_THREADS])(void *);
+    mythread_attr_t attr;
+
+    mythread_attr_init(&attr);
+    attr.stack_size = 64 * 1024;
+    attr.flags = MYTHREAD_JOIN_FUTEX;
+    for (int i = 0; i < BATCH_THREADS; i++) {
+        routines[i] = batch_fn;
+    }
+
+    /* Без кэша: обе стороны честно выделяют стеки */
+    size_t old_limit = mythread_stack_cache_set_limit(0);
+    double loop_ns = 0, batch_ns = 0;
+    int ret = 0;
+
+    for (int round = 0; round < BATCH_ROUNDS && ret == 0; round++) {
+        double start = now_ns();
+        for (int i = 0; i < BATCH_THREADS; i++) {
+            if (mythread_create_attr(&threads[i], &attr, batch_fn, NULL) != 0) {
+                perror("mythread_create_attr");
+                ret = -1;
+                break;
+            }
+        }
+        for (int i = 0; i < BATCH_THREADS && ret == 0; i++) {
+            mythread_join(&threads[i], NULL);
+        }
+        loop_ns += now_ns() - start;
+
+        start = now_ns();
+        if (mythread_create_n(threads, BATCH_THREADS, &attr, routines, NULL) != 0) {
+            perror("mythread_create_n");
+            ret = -1;
+        }
+        mythread_join_all(threads, BATCH_THREADS, NULL);
+        batch_ns += now_ns() - start;
+    }
+    mythread_stack_cache_set_limit(old_limit);
+
+    if (ret == 0) {
+        printf("%-16s %-10s threads=%d  create+join loop=%7.0f ns/thread  create_n+join_all=%7.0f ns/thread\n",
+               "batch", "futex", BATCH_THREADS,
+               loop_ns / (BATCH_ROUNDS * BATCH_THREADS), batch_ns / (BATCH_ROUNDS * BATCH_THREADS));
+    }
+    return ret;
+}
+
+/* --- Главная функция --- */
+
+typedef struct {
+    const char *name;
+    int (*fn)(void);
+} bench_t;
+
+static const bench_t benches[] = {
+    { "join_latency", bench_join_latency },
+    { "stack_size",   bench_stack_size },
+    { "sync",         bench_sync },
+    { "pool",         bench_pool },
+    { "batch",        bench_batch },
+};
+
+#define NUM_BENCHES (int)(sizeof(benches) / sizeof(benches[0]))
+
+int main(int argc, char **argv) {
+    int failed = 0;
+
+    for (int i = 0; i < NUM_BENCHES; i++) {
+        int selected = (argc < 2);
+        for (int j = 1; j < argc; j++) {
+            if (strcmp(argv[j], benches[i].name) == 0) {
+                selected = 1;
+            }
+        }
+        if (selected && benches[i].fn() != 0) {
+            fprintf(stderr, "benchmark %s failed\n", benches[i].name);
+            failed = 1;
+        }
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
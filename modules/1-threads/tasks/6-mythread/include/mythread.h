@@ -2,15 +2,62 @@
 #define MYTHREAD_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /* Непрозрачная структура стека - детали скрыты от пользователя */
 typedef struct mystack_t mystack_t;
 
+/* Флаги создания потока (mythread_create_flags) */
+#define MYTHREAD_JOIN_FUTEX  0x1  /* join через futex на tid вместо waitpid */
+#define MYTHREAD_PRIVATE_TLS 0x2  /* свой TLS (errno, __thread), включает JOIN_FUTEX */
+
+/* Настоящий поток группы со своим TLS - как поток pthread */
+#define MYTHREAD_THREAD_GROUP (MYTHREAD_JOIN_FUTEX | MYTHREAD_PRIVATE_TLS)
+
+/* Флаги отображения стека (mythread_attr_t.flags) */
+#define MYTHREAD_STACK_NORESERVE 0x10  /* MAP_NORESERVE - без резервирования swap */
+#define MYTHREAD_STACK_GROWSDOWN 0x20  /* MAP_GROWSDOWN - ядро держит зазор под стеком */
+#define MYTHREAD_STACK_HUGETLB   0x40  /* MAP_HUGETLB (если нет huge pages - THP) */
+
+/* Профиль стека: заполнить шаблоном при создании, глубину - в stack_used при join */
+#define MYTHREAD_STACK_PROFILE   0x80
+
+/* Учёт ресурсов: при выходе поток сохраняет свои счётчики (mythread_stats) */
+#define MYTHREAD_STATS           0x100
+
+#define MYTHREAD_STACK_MIN (16 * 1024)  /* Минимальный размер стека */
+
+/* Атрибуты создания потока, заполняются mythread_attr_init */
+typedef struct mythread_attr_t {
+    size_t       stack_size;   /* Размер стека (по умолчанию 1 МБ) */
+    size_t       guard_size;   /* Сторожевая область под стеком (по умолчанию 1 страница, 0 - нет) */
+    int          flags;        /* MYTHREAD_JOIN_FUTEX, MYTHREAD_PRIVATE_TLS, MYTHREAD_STACK_* */
+    int          numa_node;    /* Узел NUMA для страниц стека (-1 - политика процесса) */
+    size_t       cpuset_size;  /* Размер маски в байтах, как в sched_setaffinity (0 - не менять) */
+    const void * cpuset;       /* Маска cpu_set_t, копируется при создании */
+} mythread_attr_t;
+
+/* Ресурсы, потреблённые потоком (mythread_stats) */
+typedef struct mythread_stats_t {
+    uint64_t cpu_ns;                /* Время CPU (user + sys) */
+    uint64_t user_ns;               /* В режиме пользователя (точность - тик или мкс) */
+    uint64_t sys_ns;                /* В ядре */
+    long     voluntary_switches;    /* Поток сам отдал процессор (сон, futex, I/O) */
+    long     involuntary_switches;  /* Планировщик вытеснил поток */
+    long     minor_faults;          /* Страничные отказы без чтения с диска */
+    long     major_faults;          /* С чтением с диска */
+    uint64_t lifetime_ns;           /* От clone до выхода (или до вызова, если поток работает) */
+} mythread_stats_t;
+
 /* Структура потока - доступна пользователю */
 typedef struct mythread_t {
-    int         pid;      /* PID клонированного процесса */
-    mystack_t * stack;    /* Указатель на стек */
-    void *      retv;     /* Возвращаемое значение потока */
+    int          pid;     /* PID клонированного процесса (TID в режиме futex) */
+    mystack_t *  stack;   /* Указатель на стек */
+    void *       retv;    /* Возвращаемое значение потока */
+    volatile int tid;     /* TID, обнуляется ядром при выходе (режим futex) */
+    int          flags;   /* Флаги создания */
+    size_t       stack_used; /* Максимальная глубина стека в байтах (MYTHREAD_STACK_PROFILE) */
+    mythread_stats_t stats;  /* Счётчики на момент выхода (MYTHREAD_STATS, после join) */
 } mythread_t;
 
 /* 
@@ -29,6 +76,73 @@ int mythread_create(mythread_t *thread,
                     void *(*start_routine)(void *), 
                     void *arg);
 
+/* 
+ * Заполняет атрибуты значениями по умолчанию:
+ * стек 1 МБ, одна сторожевая страница, флагов нет, без привязки к узлу и процессорам
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (errno будет установлен)
+ */
+int mythread_attr_init(mythread_attr_t *attr);
+
+/* 
+ * Создаёт новый поток с атрибутами
+ * 
+ * Параметры:
+ *   thread        - указатель на структуру mythread_t (будет заполнена)
+ *   attr          - атрибуты (NULL - по умолчанию)
+ *   start_routine - функция, которую выполнит поток
+ *   arg           - аргумент для функции потока
+ * 
+ * Размеры стека и guard округляются вверх до страницы (2 МБ для
+ * MYTHREAD_STACK_HUGETLB). Стек меньше MYTHREAD_STACK_MIN - ошибка EINVAL.
+ * 
+ * numa_node >= 0: стек размещается на этом узле (mbind с MPOL_PREFERRED
+ * до первого касания), в том числе TLS потока. cpuset: поток привязывается
+ * к маске до вызова start_routine. Маска без доступных вызывающему
+ * процессоров или больше cpu_set_t - ошибка EINVAL.
+ * 
+ * MYTHREAD_STACK_PROFILE: свободная часть стека заполняется шаблоном
+ * (все страницы стека сразу выделяются), join записывает в stack_used
+ * максимальную глубину стека и добавляет поток в mythread_stack_report.
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (errno будет установлен)
+ */
+int mythread_create_attr(mythread_t *thread, 
+                         const mythread_attr_t *attr, 
+                         void *(*start_routine)(void *), 
+                         void *arg);
+
+/* 
+ * Создаёт новый поток с флагами (атрибуты по умолчанию + flags)
+ * 
+ * Параметры:
+ *   thread, start_routine, arg - как у mythread_create
+ *   flags - 0 или комбинация MYTHREAD_JOIN_FUTEX, MYTHREAD_PRIVATE_TLS
+ * 
+ * MYTHREAD_JOIN_FUTEX: поток создаётся в группе потоков вызывающего
+ * (CLONE_THREAD) без SIGCHLD. Ядро обнуляет tid при выходе потока
+ * (CLONE_CHILD_CLEARTID), а mythread_join ждёт этого через FUTEX_WAIT.
+ * Такой поток может ожидать любой поток процесса, а не только создатель.
+ * 
+ * MYTHREAD_PRIVATE_TLS: поток получает свой блок TLS (CLONE_SETTLS),
+ * размещённый в верхней части его стека. У потока свои errno и
+ * переменные __thread, malloc берёт для него отдельный кэш и арену.
+ * Только x86-64 (иначе ENOTSUP). Без этого флага поток делит TLS
+ * с создателем.
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (errno будет установлен)
+ */
+int mythread_create_flags(mythread_t *thread, 
+                          void *(*start_routine)(void *), 
+                          void *arg, 
+                          int flags);
+
 /* 
  * Ожидает завершения потока
  * 
@@ -42,4 +156,364 @@ int mythread_create(mythread_t *thread,
  */
 int mythread_join(mythread_t *thread, void **retv);
 
+/* 
+ * Отсоединяет поток: его стек после завершения вернёт в кэш фоновый
+ * поток-сборщик, join больше не нужен (и невозможен)
+ * 
+ * Параметры:
+ *   thread - поток, созданный с MYTHREAD_JOIN_FUTEX и ещё не присоединённый
+ * 
+ * Сборщик запускается при первом вызове. О завершении потоков он узнаёт
+ * через futex (CLONE_CHILD_CLEARTID) и собирает стеки пачками. Результат
+ * отсоединённого потока теряется; сама структура mythread_t после вызова
+ * не используется и может быть освобождена. Если поток уже завершался,
+ * вызов дождётся его, как join.
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (errno = EINVAL, если поток не в режиме futex или уже
+ *   присоединён; ошибка запуска сборщика)
+ */
+int mythread_detach(mythread_t *thread);
+
+/* 
+ * Возвращает количество отсоединённых потоков, чьи стеки ещё не собраны
+ * (потоки ещё работают или ждут сборщика)
+ */
+size_t mythread_detached_pending(void);
+
+/* 
+ * Возвращает ресурсы, потреблённые потоком
+ * 
+ * Параметры:
+ *   thread - поток
+ *   out    - куда записать счётчики
+ * 
+ * Работающий поток читается на лету: время CPU - по часам CPU потока,
+ * переключения и страничные отказы - из /proc/<pid>/task. Поток с
+ * MYTHREAD_STATS при выходе сам снимает счётчики (getrusage(RUSAGE_THREAD)
+ * и CLOCK_THREAD_CPUTIME_ID) - они доступны и после завершения, и после
+ * join (копия в thread->stats).
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (errno = ENODATA - поток завершился без MYTHREAD_STATS,
+ *   EINVAL - поток не запускался или отсоединён)
+ */
+int mythread_stats(const mythread_t *thread, mythread_stats_t *out);
+
+/* 
+ * Создаёт n потоков с общими атрибутами
+ * 
+ * Параметры:
+ *   threads        - массив из n структур mythread_t (будут заполнены)
+ *   n              - количество потоков
+ *   attr           - атрибуты (NULL - по умолчанию)
+ *   start_routines - массив из n функций
+ *   args           - массив из n аргументов (NULL - все аргументы NULL)
+ * 
+ * Стеки всех потоков выделяются одним mmap (и одним mbind), дальше
+ * каждый стек живёт отдельно: после join уходит в кэш или освобождается.
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (errno будет установлен). Часть потоков могла успеть
+ *   запуститься: у незапущенных pid == -1, запущенные нужно дождаться
+ *   (mythread_join_all пропускает незапущенные)
+ */
+int mythread_create_n(mythread_t *threads, 
+                      int n, 
+                      const mythread_attr_t *attr, 
+                      void *(*const *start_routines)(void *), 
+                      void *const *args);
+
+/* 
+ * Ожидает завершения всех потоков массива
+ * 
+ * Параметры:
+ *   threads - массив потоков (незапущенные и уже присоединённые пропускаются)
+ *   n       - размер массива
+ *   retvs   - массив из n мест под результаты (может быть NULL)
+ * 
+ * Потоки режима MYTHREAD_JOIN_FUTEX ожидаются одним futex_waitv на
+ * каждые 128 потоков (окно сдвигается по массиву по мере выхода),
+ * остальные присоединяются в порядке выхода циклом waitid(P_ALL, __WCLONE) -
+ * потомков fork он не трогает.
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (errno будет установлен)
+ */
+int mythread_join_all(mythread_t *threads, int n, void **retvs);
+
+/* 
+ * Ожидает завершения любого из потоков массива и присоединяет его
+ * 
+ * Параметры:
+ *   threads - массив потоков (незапущенные и уже присоединённые пропускаются)
+ *   n       - размер массива
+ *   retv    - место под результат (может быть NULL)
+ * 
+ * Потоки режима MYTHREAD_JOIN_FUTEX ожидаются через futex_waitv, остальные -
+ * через pidfd и один poll. pidfd открывается при первом ожидании потока и
+ * закрывается при его join, повторные вызовы его не открывают заново.
+ * Смешивать режимы в одном вызове нельзя.
+ * 
+ * Возвращает:
+ *   индекс присоединённого потока
+ *   -1 при ошибке (EINVAL - разные режимы, ECHILD - ждать некого)
+ */
+int mythread_join_any(mythread_t *threads, int n, void **retv);
+
+/* 
+ * Устанавливает лимит кэша стеков (в байтах)
+ * 
+ * Стеки завершившихся потоков не освобождаются, а кэшируются для
+ * повторного использования. Лимит 0 выключает кэш. Лишние стеки
+ * освобождаются сразу.
+ * 
+ * Возвращает:
+ *   предыдущее значение лимита
+ */
+size_t mythread_stack_cache_set_limit(size_t max_bytes);
+
+/* 
+ * Освобождает закэшированные стеки, пока в кэше не останется
+ * не больше keep_bytes байт (0 - очистить кэш полностью)
+ * 
+ * Возвращает:
+ *   количество освобождённых байт
+ */
+size_t mythread_stack_cache_trim(size_t keep_bytes);
+
+/* 
+ * Пишет сводку профиля стеков по start_routine: число потоков,
+ * максимальную и среднюю глубину стека и доступный размер стека
+ * 
+ * Параметры:
+ *   fd - файловый дескриптор для вывода
+ * 
+ * В сводку попадают потоки с MYTHREAD_STACK_PROFILE после join (или после
+ * сборки отсоединённого потока). С переменной окружения
+ * MYTHREAD_STACK_PROFILE=1 профиль включается для всех потоков, а сводка
+ * пишется в stderr при выходе из программы. Имена функций исполняемого
+ * файла видны только при сборке с -rdynamic, иначе выводится адрес.
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (errno будет установлен)
+ */
+int mythread_stack_report(int fd);
+
+/* 
+ * Сбрасывает трассу (создание, старт, завершение и join потоков)
+ * в файл формата Chrome trace JSON (chrome://tracing, Perfetto)
+ * 
+ * Трассировка есть только в сборке с -DMYTHREAD_TRACE (make trace).
+ * С переменной окружения MYTHREAD_TRACE_FILE трасса сбрасывается
+ * в этот файл автоматически при выходе из программы.
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (ENOTSUP - библиотека собрана без трассировки)
+ */
+int mythread_trace_dump(const char *path);
+
+/* --- Данные потока (аналог pthread_key_*) --- */
+
+#define MYTHREAD_KEYS_MAX 128  /* Ключей за время жизни процесса */
+
+typedef unsigned int mythread_key_t;
+
+/* 
+ * Создаёт ключ данных потока. Во всех потоках значение ключа - NULL
+ * 
+ * Параметры:
+ *   key        - куда записать ключ
+ *   destructor - вызывается при выходе потока для ненулевого значения
+ *                (может быть NULL)
+ * 
+ * Значения лежат в массиве в mystack_t каждого потока, на массив указывает
+ * %gs потока, так что mythread_getspecific - одна загрузка без блокировок.
+ * Main и потоки, созданные не через mythread, делят один общий массив;
+ * деструкторы для них не вызываются. Только x86-64 и только если при
+ * загрузке библиотеки база %gs была свободна.
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (EAGAIN - ключи кончились, ENOTSUP - не x86-64 или %gs
+ *      уже занят другим компонентом)
+ */
+int mythread_key_create(mythread_key_t *key, void (*destructor)(void *));
+
+/* 
+ * Удаляет ключ: деструктор больше не вызывается. Номер ключа повторно
+ * не выдаётся
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (EINVAL - ключ не создан)
+ */
+int mythread_key_delete(mythread_key_t key);
+
+/* 
+ * Задаёт значение ключа для вызывающего потока
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (EINVAL - ключ не создан, ENOTSUP - ключи недоступны)
+ */
+int mythread_setspecific(mythread_key_t key, const void *value);
+
+/* 
+ * Возвращает значение ключа для вызывающего потока (NULL, если не задано)
+ */
+void *mythread_getspecific(mythread_key_t key);
+
+/* --- Примитивы синхронизации (futex) --- */
+
+/* Мьютекс: без конкуренции - одна атомарная операция, иначе спин и FUTEX_WAIT */
+typedef struct mythread_mutex_t {
+    volatile int state;     /* 0 - свободен, 1 - захвачен, 2 - есть ожидающие */
+} mythread_mutex_t;
+
+/* Условная переменная */
+typedef struct mythread_cond_t {
+    volatile int seq;       /* Счётчик сигналов */
+} mythread_cond_t;
+
+/* Барьер на count потоков */
+typedef struct mythread_barrier_t {
+    unsigned          count;
+    volatile unsigned arrived;
+    volatile int      generation;
+} mythread_barrier_t;
+
+#define MYTHREAD_MUTEX_INITIALIZER { 0 }
+#define MYTHREAD_COND_INITIALIZER  { 0 }
+
+/* Возвращается из mythread_barrier_wait ровно одному потоку */
+#define MYTHREAD_BARRIER_SERIAL_THREAD 1
+
+/* 
+ * Функции мьютекса
+ * 
+ * Возвращают:
+ *   0 при успехе
+ *   -1 при ошибке (errno: EINVAL; EBUSY для trylock, если мьютекс занят)
+ */
+int mythread_mutex_init(mythread_mutex_t *mutex);
+int mythread_mutex_lock(mythread_mutex_t *mutex);
+int mythread_mutex_trylock(mythread_mutex_t *mutex);
+int mythread_mutex_unlock(mythread_mutex_t *mutex);
+
+/* 
+ * Функции условной переменной
+ * 
+ * mythread_cond_wait вызывается с захваченным мьютексом, атомарно
+ * отпускает его и засыпает; возвращается с захваченным мьютексом.
+ * Возможны ложные пробуждения - условие проверяется в цикле.
+ * 
+ * Возвращают:
+ *   0 при успехе
+ */
+int mythread_cond_init(mythread_cond_t *cond);
+int mythread_cond_wait(mythread_cond_t *cond, mythread_mutex_t *mutex);
+int mythread_cond_signal(mythread_cond_t *cond);
+int mythread_cond_broadcast(mythread_cond_t *cond);
+
+/* 
+ * Функции барьера
+ * 
+ * mythread_barrier_wait ждёт, пока до барьера дойдут count потоков.
+ * 
+ * Возвращают:
+ *   MYTHREAD_BARRIER_SERIAL_THREAD одному из потоков, 0 остальным
+ *   -1 при ошибке (errno будет установлен)
+ */
+int mythread_barrier_init(mythread_barrier_t *barrier, unsigned count);
+int mythread_barrier_wait(mythread_barrier_t *barrier);
+
+/* --- Пул потоков с перехватом задач (work stealing) --- */
+
+/* Непрозрачная структура пула */
+typedef struct mythread_pool_t mythread_pool_t;
+
+/* 
+ * Будущий результат задачи. Память принадлежит вызывающему и должна
+ * жить до возврата из mythread_future_wait (или mythread_pool_wait):
+ * пул хранит задачу прямо в ней и не вызывает malloc на задачу.
+ */
+typedef struct mythread_future_t {
+    void *(*fn)(void *);              /* Функция задачи */
+    void *                    arg;    /* Её аргумент */
+    void *                    result; /* Возвращённое значение */
+    struct mythread_future_t *next;   /* Связь в общей очереди пула */
+    volatile int              state;  /* Выполнена ли задача */
+} mythread_future_t;
+
+/* 
+ * Создаёт пул из nworkers потоков (0 - по числу процессоров)
+ * 
+ * Потоки создаются один раз в режиме MYTHREAD_THREAD_GROUP (на не-x86-64 -
+ * MYTHREAD_JOIN_FUTEX). У каждого своя дека Chase-Lev: задачи, отправленные
+ * из задачи пула, кладутся в деку текущего потока и выполняются им же
+ * (LIFO), свободные потоки крадут задачи с другого конца чужих дек.
+ * Задачи извне пула попадают в общую очередь.
+ * 
+ * Возвращает:
+ *   указатель на пул при успехе
+ *   NULL при ошибке (errno будет установлен)
+ */
+mythread_pool_t *mythread_pool_create(int nworkers);
+
+/* 
+ * Отправляет задачу fn(arg) в пул
+ * 
+ * Параметры:
+ *   pool   - пул
+ *   future - место под задачу и её результат (заполняется)
+ *   fn     - функция задачи
+ *   arg    - аргумент
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (errno будет установлен)
+ */
+int mythread_pool_submit(mythread_pool_t *pool, 
+                         mythread_future_t *future, 
+                         void *(*fn)(void *), 
+                         void *arg);
+
+/* 
+ * Ожидает выполнения задачи и возвращает её результат (retv может быть NULL)
+ * 
+ * Если вызван из задачи пула, поток не засыпает, а выполняет другие
+ * задачи, пока эта не завершится - так рекурсивное разбиение задач
+ * не блокирует потоки пула.
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (errno будет установлен)
+ */
+int mythread_future_wait(mythread_future_t *future, void **retv);
+
+/* 
+ * Ожидает выполнения всех отправленных в пул задач
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (EDEADLK - вызов из задачи этого же пула)
+ */
+int mythread_pool_wait(mythread_pool_t *pool);
+
+/* 
+ * Дожидается оставшихся задач, завершает потоки и освобождает пул
+ * 
+ * Возвращает:
+ *   0 при успехе
+ *   -1 при ошибке (errno будет установлен)
+ */
+int mythread_pool_destroy(mythread_pool_t *pool);
+
 #endif /* MYTHREAD_H */
\ No newline at end of file
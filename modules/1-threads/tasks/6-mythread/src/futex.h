@@ -0,0 +1,58 @@
+#ifndef MYTHREAD_FUTEX_H
+#define MYTHREAD_FUTEX_H
+
+/* Внутренние обёртки над futex - не входят в публичный API */
+
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Спит, пока *addr == val. Возвращает 0 после пробуждения, -1 с errno
+ * (EAGAIN - значение уже другое, EINTR - прерван сигналом).
+ *
+ * Без FUTEX_PRIVATE_FLAG: ядро будит по tid (CLONE_CHILD_CLEARTID)
+ * разделяемым FUTEX_WAKE. Для приватной анонимной памяти ключ всё равно
+ * строится по (mm, адрес), так что это не дороже.
+ */
+static inline int futex_wait(volatile int *addr, int val) {
+    return (int)syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+/* Будит до count ожидающих на addr, возвращает число разбуженных */
+static inline int futex_wake(volatile int *addr, int count) {
+    return (int)syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+/* Как futex_wait, но не дольше timeout (относительное время), ETIMEDOUT по истечении */
+static inline int futex_wait_timeout(volatile int *addr, int val, const struct timespec *timeout) {
+    return (int)syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+#if defined(SYS_futex_waitv) && defined(FUTEX_WAITV_MAX)
+#define HAVE_FUTEX_WAITV 1
+
+/*
+ * Ждёт изменения любого из nr futex (nr <= FUTEX_WAITV_MAX, Linux 5.16+).
+ * timeout - абсолютное время по CLOCK_MONOTONIC или NULL.
+ * Возвращает индекс сработавшего futex, -1 с errno (EAGAIN - одно из
+ * значений уже другое, ETIMEDOUT, ENOSYS - ядро старее 5.16).
+ */
+static inline int futex_waitv(struct futex_waitv *waiters, unsigned nr,
+                              const struct timespec *timeout) {
+    return (int)syscall(SYS_futex_waitv, waiters, nr, 0, timeout, CLOCK_MONOTONIC);
+}
+#endif
+
+/* Подсказка процессору внутри цикла ожидания */
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile ("yield");
+#endif
+}
+
+#endif /* MYTHREAD_FUTEX_H */
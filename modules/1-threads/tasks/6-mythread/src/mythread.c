@@ -1,50 +1,255 @@
 #define _GNU_SOURCE
 
 #include "mythread.h"
+#include "futex.h"
+#include "trace.h"
+#include "stackprof.h"
+#include "stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <dlfcn.h>
+#include <link.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <sys/wait.h>
+#include <poll.h>
 #include <sched.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#if __has_include(<sys/single_threaded.h>)
+    #include <sys/single_threaded.h>
+#endif
+
+#define STACK_SIZE     (1024 * 1024)       /* 1 МБ на стек по умолчанию */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)   /* Размер страницы для MYTHREAD_STACK_HUGETLB */
+
+/* Флаги attr, влияющие на отображение стека */
+#define STACK_MAP_FLAGS (MYTHREAD_STACK_NORESERVE | MYTHREAD_STACK_GROWSDOWN | \
+                         MYTHREAD_STACK_HUGETLB)
+
+/* Параметры кэша стеков */
+#define STACK_CACHE_BUCKETS     4                   /* Сколько разных размеров стеков храним */
+#define STACK_CACHE_DEFAULT_MAX (64 * STACK_SIZE)   /* Лимит кэша по умолчанию - 64 МБ */
 
-#define STACK_SIZE (1024 * 1024)  /* 1 МБ на стек */
+#define NUMA_MAX_NODES 1024  /* Размер маски узлов для mbind */
 
-/* Система логирования */
-#define INFO_PRINT(fmt, ...) printf("[INFO]: " fmt, ##__VA_ARGS__)
+#define FUTEX_WAIT_WINDOW 128  /* Сколько потоков mythread_join_any ждёт одним futex_waitv */
 
+/* 
+ * Система логирования. printf идёт через блокировку stdout, поэтому
+ * на пути создания/завершения потока логи есть только в debug-сборке;
+ * для замеров - трассировка (trace.h, make trace).
+ */
 #ifdef DEBUG
+    #define INFO_PRINT(fmt, ...)  printf("[INFO]: " fmt, ##__VA_ARGS__)
     #define DEBUG_PRINT(fmt, ...) printf("[DEBUG]: " fmt, ##__VA_ARGS__)
 #else
+    #define INFO_PRINT(fmt, ...)
     #define DEBUG_PRINT(fmt, ...)
 #endif
 
-/* Внутренняя структура стека */
-struct mystack_t {
-    size_t  size;
-    void *  arr_ptr;
-};
-
 /* Обёртка для передачи данных в новый поток */
 typedef struct {
     void *(*user_fn)(void *);
     void *  user_arg;
     void ** fn_retv;
+    size_t  cpuset_size;  /* 0 - affinity не меняется */
+    cpu_set_t cpuset;     /* Маска, к которой поток привязывается до user_fn */
 } thread_wrapper_t;
 
+/* 
+ * Значения mythread_key_* потока. На блок указывает база сегмента %gs
+ * (у каждой задачи ядра своя), поэтому mythread_getspecific - одна
+ * загрузка %gs:(,key,8) без поиска потока.
+ */
+typedef struct {
+    void *       slots[MYTHREAD_KEYS_MAX];
+    volatile int used;   /* Был setspecific - при выходе есть что разрушать */
+} specific_t;
+
+/* 
+ * Внутренняя структура стека. Лежит в самом верху отображения стека,
+ * поэтому создание и завершение потока не обращаются к malloc:
+ * 
+ *   arr_ptr                                           arr_ptr + size
+ *   | guard | стек (растёт вниз) ... [TLS, TCB] | mystack_t |
+ */
+struct mystack_t {
+    size_t           size;     /* Размер всего отображения, включая guard */
+    size_t           guard;    /* Сторожевая область PROT_NONE в начале отображения */
+    int              map_flags;/* MYTHREAD_STACK_* флаги, с которыми создан стек */
+    int              numa_node;/* Узел NUMA, на котором размещаются страницы (-1 - любой) */
+    void *           arr_ptr;
+    mystack_t *      next;     /* Связь в списке свободных стеков кэша */
+    void *           tls;      /* TCB в верхней части стека (MYTHREAD_PRIVATE_TLS) */
+    volatile int     detach;   /* DETACH_*: кто отвечает за стек после выхода потока */
+    volatile int     exit_tid; /* Обнуляется ядром при выходе отсоединённого потока */
+    int              pidfd;    /* pidfd для mythread_join_any (-1 - не открыт) */
+    char *           profile_top; /* Верх заполненной шаблоном области (NULL - без профиля) */
+    uint64_t         start_ns; /* Время clone, для lifetime_ns */
+    volatile int     stats_ready; /* Поток с MYTHREAD_STATS снял счётчики при выходе */
+    mythread_stats_t stats;
+    specific_t       specific; /* Значения mythread_key_* */
+    thread_wrapper_t wrapper;  /* Данные для thread_wrapper_fn */
+};
+
+/* 
+ * Состояния mystack_t.detach. Поток и mythread_detach меняют их CAS-ом:
+ * кто первым ушёл из RUNNING, тот и решает, кто освобождает стек.
+ */
+#define DETACH_RUNNING  0  /* Поток работает, стек освободит join */
+#define DETACH_DETACHED 1  /* Отсоединён: стек освободит сборщик */
+#define DETACH_EXITING  2  /* Поток уже завершается и пишет результат - нужен join */
+
+/* Место под mystack_t в верху отображения (выравнено под строку кэша) */
+#define MYSTACK_HEADER_SIZE ((sizeof(mystack_t) + 63) & ~(size_t)63)
+
+/* Корзина кэша: список свободных стеков одной геометрии */
+typedef struct {
+    size_t      size;     /* Размер стеков в корзине (0 - корзина не занята) */
+    size_t      guard;
+    int         map_flags;
+    int         numa_node;
+    size_t      count;
+    mystack_t * head;
+} stack_bucket_t;
+
+/* 
+ * Кэш стеков. Стеки завершившихся потоков не отдаются через munmap,
+ * а складываются сюда и переиспользуются следующими mythread_create.
+ * В установившемся режиме создание/join потока не делает системных
+ * вызовов для стека.
+ */
+static struct {
+    mythread_mutex_t lock;
+    size_t          max_bytes;      /* Лимит суммарного размера кэша */
+    size_t          cached_bytes;   /* Текущий суммарный размер кэша */
+    stack_bucket_t  buckets[STACK_CACHE_BUCKETS];
+} stack_cache = { .lock = MYTHREAD_MUTEX_INITIALIZER, .max_bytes = STACK_CACHE_DEFAULT_MAX };
+
+/* 
+ * Флаги clone для обычного режима: отдельный процесс с общей памятью.
+ * Сигнал выхода 0 вместо SIGCHLD: такого потомка ждут только с __WCLONE,
+ * поэтому waitid(P_ALL) в mythread_join_all не трогает потомков fork, а
+ * wait() программы - наши потоки. tid, как и в режиме futex, обнуляется
+ * при выходе: по нему видно, что зомби уже забрал кто-то другой.
+ */
+#define CLONE_FLAGS_PROCESS (CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | \
+                             CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID)
+
+/* 
+ * Флаги clone для MYTHREAD_JOIN_FUTEX: поток в группе вызывающего.
+ * Ядро пишет tid в mythread_t при создании и обнуляет его с FUTEX_WAKE
+ * при выходе. CLONE_THREAD нужен, чтобы ядро само убирало завершившийся
+ * поток: без него остаётся зомби, которого может подобрать только родитель.
+ */
+#define CLONE_FLAGS_THREAD  (CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | \
+                             CLONE_THREAD | CLONE_SYSVSEM | \
+                             CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID)
+
+/* 
+ * Собственный TLS потока (MYTHREAD_PRIVATE_TLS), только x86-64.
+ * 
+ * Раскладка (TLS variant II): блоки static TLS модулей лежат ниже
+ * указателя потока (%fs), TCB glibc (struct pthread) - выше. Всё это
+ * вырезается из верхней части стека потока:
+ * 
+ *   arr_ptr                                              arr_ptr + size
+ *   | стек (растёт вниз) ... | static TLS модулей | TCB (TCB_RESERVE) |
+ *                                                ^ tp
+ * 
+ * DTV и начальные образы TLS заполняет сам загрузчик glibc
+ * (_dl_allocate_tls) - так же, как при pthread_create.
+ */
+#if defined(__x86_64__)
+    #define MYTHREAD_HAVE_TLS 1
+#endif
+
+#define TCB_RESERVE     4096   /* Место под struct pthread (её размер не экспортируется) */
+#define TLS_MIN_STACK   16384  /* Сколько стека должно остаться под TLS */
+#define TCB_TID_OFFSET  0x2d0  /* pid_t tid в struct pthread (glibc 2.26+, x86-64) */
+
+/* Начало tcbhead_t glibc (x86-64) - поля, которые заполняем сами */
+typedef struct {
+    void *      tcb;                /* %fs:0x00 - указатель на себя */
+    void *      dtv;                /* %fs:0x08 */
+    void *      self;               /* %fs:0x10 */
+    int         multiple_threads;   /* %fs:0x18 */
+    int         gscope_flag;        /* %fs:0x1c */
+    uintptr_t   sysinfo;            /* %fs:0x20 */
+    uintptr_t   stack_guard;        /* %fs:0x28 - канарейка -fstack-protector */
+    uintptr_t   pointer_guard;      /* %fs:0x30 - ключ PTR_MANGLE (setjmp, atexit) */
+} tcb_head_t;
+
+/* Параметры static TLS и функции загрузчика, находятся один раз */
+static struct {
+    volatile int  state;            /* 0 - не искали, 1 - готово, -1 - недоступно */
+    size_t        static_size;
+    size_t        static_align;
+    void *      (*allocate_tls)(void *tcb);
+    void        (*deallocate_tls)(void *tcb, bool dealloc_tcb);
+    size_t        libc_offset;      /* Блок TLS libc: tp - libc_offset */
+    size_t        libc_size;        /* 0 - блок не найден */
+} tls_info;
+
+/* 
+ * Начало tcache_perthread_struct glibc 2.30+ - кэша malloc потока.
+ * Указатель на него лежит в TLS libc
+ */
+#define TCACHE_BINS 64
+typedef struct {
+    uint16_t    counts[TCACHE_BINS];
+    void *      entries[TCACHE_BINS];   /* Последний освобождённый кусок корзины */
+} tcache_head_t;
+
 /* --- Функции работы со стеком --- */
 
-static mystack_t *mystack_create(size_t size) {
-    void *stack = mmap(
-        NULL,
-        size,
-        PROT_READ | PROT_WRITE,
-        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,  /* MAP_STACK - подсказка ядру */
-        -1,
-        0
-    );
+/* 
+ * Страницы стека выделяются на узле node (MPOL_PREFERRED: если там нет
+ * памяти - на другом). Вызывается до первого касания отображения.
+ */
+static int mystack_bind_node(void *stack, size_t size, int node) {
+    unsigned long nodemask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+
+    nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    if (syscall(SYS_mbind, stack, size, MPOL_PREFERRED, nodemask, NUMA_MAX_NODES + 1, 0) == -1) {
+        DEBUG_PRINT("mbind to node %d failed\n", node);
+        return -1;
+    }
+    return 0;
+}
+
+/* Отображение под один или несколько стеков, NULL при ошибке */
+static void *mystack_map(size_t total, int map_flags, int numa_node) {
+    int mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK;  /* MAP_STACK - подсказка ядру */
+    void *stack = MAP_FAILED;
+
+    /* Без резервирования swap: страницы всё равно выделяются при первом касании */
+    if (map_flags & MYTHREAD_STACK_NORESERVE) {
+        mmap_flags |= MAP_NORESERVE;
+    }
+    if (map_flags & MYTHREAD_STACK_GROWSDOWN) {
+        mmap_flags |= MAP_GROWSDOWN;
+    }
+
+    if (map_flags & MYTHREAD_STACK_HUGETLB) {
+        stack = mmap(NULL, total, PROT_READ | PROT_WRITE, mmap_flags | MAP_HUGETLB, -1, 0);
+        if (stack == MAP_FAILED) {
+            /* Нет зарезервированных huge pages - просим прозрачные (THP) */
+            DEBUG_PRINT("MAP_HUGETLB failed, falling back to THP\n");
+            stack = mmap(NULL, total, PROT_READ | PROT_WRITE, mmap_flags, -1, 0);
+            if (stack != MAP_FAILED) {
+                madvise(stack, total, MADV_HUGEPAGE);
+            }
+        }
+    } else {
+        stack = mmap(NULL, total, PROT_READ | PROT_WRITE, mmap_flags, -1, 0);
+    }
 
     if (stack == MAP_FAILED) {
         DEBUG_PRINT("mmap failed for stack\n");
@@ -52,50 +257,691 @@ static mystack_t *mystack_create(size_t size) {
     }
     DEBUG_PRINT("mmap succeeded, stack allocated at %p\n", stack);
 
-    mystack_t *s = (mystack_t *)malloc(sizeof(mystack_t));
-    if (!s) {
-        perror("malloc for mystack_t");
-        munmap(stack, size);  /* Откатываем изменения при ошибке */
+    if (numa_node >= 0 && mystack_bind_node(stack, total, numa_node) == -1) {
+        int saved_errno = errno;
+        munmap(stack, total);
+        errno = saved_errno;
+        return NULL;
+    }
+    return stack;
+}
+
+/* 
+ * Размечает стек в [stack, stack + size): guard внизу, mystack_t наверху.
+ * Каждый стек - самостоятельный диапазон, munmap его не трогает соседей.
+ */
+static mystack_t *mystack_init(void *stack, size_t size, size_t guard, int map_flags, int numa_node) {
+    /* Сторожевая область: переполнение стека даст SIGSEGV, а не порчу соседей */
+    if (guard && mprotect(stack, guard, PROT_NONE) == -1) {
+        perror("mprotect for guard");
         return NULL;
     }
 
+    /* Служебная структура - в самом верху отображения */
+    mystack_t *s = (mystack_t *)((char *)stack + size - MYSTACK_HEADER_SIZE);
     s->size = size;
+    s->guard = guard;
+    s->map_flags = map_flags;
+    s->numa_node = numa_node;
     s->arr_ptr = stack;
+    s->next = NULL;
+    s->tls = NULL;
     DEBUG_PRINT("stack structure created, size=%zu\n", size);
 
     return s;
 }
 
+static mystack_t *mystack_create(size_t size, size_t guard, int map_flags, int numa_node) {
+    void *stack = mystack_map(size, map_flags, numa_node);
+    if (!stack) {
+        return NULL;
+    }
+
+    mystack_t *s = mystack_init(stack, size, guard, map_flags, numa_node);
+    if (!s) {
+        int saved_errno = errno;
+        munmap(stack, size);
+        errno = saved_errno;
+    }
+    return s;
+}
+
 static int mystack_delete(mystack_t *stack) {
     if (!stack) {
         return 0;  /* NULL - не ошибка */
     }
 
-    DEBUG_PRINT("deleting stack at %p\n", stack->arr_ptr);
+    /* mystack_t лежит внутри отображения - читаем поля до munmap */
+    void *arr_ptr = stack->arr_ptr;
+    size_t size = stack->size;
+
+    DEBUG_PRINT("deleting stack at %p\n", arr_ptr);
     int ret = 0;
-    if (munmap(stack->arr_ptr, stack->size) == -1) {
+    if (munmap(arr_ptr, size) == -1) {
         perror("munmap failed");
         ret = -1;
     }
-    free(stack);
     DEBUG_PRINT("stack deleted\n");
     return ret;
 }
 
+/* --- Кэш стеков --- */
+
+static void stack_cache_lock(void) {
+    mythread_mutex_lock(&stack_cache.lock);
+}
+
+static void stack_cache_unlock(void) {
+    mythread_mutex_unlock(&stack_cache.lock);
+}
+
+static int bucket_matches(const stack_bucket_t *b, size_t size, size_t guard, int map_flags, int numa_node) {
+    return b->size == size && b->guard == guard && b->map_flags == map_flags &&
+           b->numa_node == numa_node;
+}
+
+/* Достаёт из кэша стек нужной геометрии, NULL если такого нет */
+static mystack_t *stack_cache_get(size_t size, size_t guard, int map_flags, int numa_node) {
+    mystack_t *s = NULL;
+
+    stack_cache_lock();
+    for (int i = 0; i < STACK_CACHE_BUCKETS; i++) {
+        stack_bucket_t *b = &stack_cache.buckets[i];
+        if (!bucket_matches(b, size, guard, map_flags, numa_node) || !b->head) {
+            continue;
+        }
+
+        s = b->head;
+        b->head = s->next;
+        if (--b->count == 0) {
+            b->size = 0;  /* Освобождаем корзину под другой размер */
+        }
+        stack_cache.cached_bytes -= size;
+        break;
+    }
+    stack_cache_unlock();
+
+    if (s) {
+        s->next = NULL;
+        DEBUG_PRINT("stack %p taken from cache\n", s->arr_ptr);
+    }
+    return s;
+}
+
+/* Кладёт стек в кэш. Возвращает -1, если кэш полон */
+static int stack_cache_put(mystack_t *s) {
+    int ret = -1;
+
+    stack_cache_lock();
+    if (stack_cache.cached_bytes + s->size <= stack_cache.max_bytes) {
+        stack_bucket_t *free_bucket = NULL;
+        stack_bucket_t *bucket = NULL;
+
+        for (int i = 0; i < STACK_CACHE_BUCKETS; i++) {
+            stack_bucket_t *b = &stack_cache.buckets[i];
+            if (bucket_matches(b, s->size, s->guard, s->map_flags, s->numa_node)) {
+                bucket = b;
+                break;
+            }
+            if (b->size == 0 && !free_bucket) {
+                free_bucket = b;
+            }
+        }
+        if (!bucket && free_bucket) {
+            bucket = free_bucket;
+            bucket->size = s->size;
+            bucket->guard = s->guard;
+            bucket->map_flags = s->map_flags;
+            bucket->numa_node = s->numa_node;
+        }
+
+        if (bucket) {
+            s->next = bucket->head;
+            bucket->head = s;
+            bucket->count++;
+            stack_cache.cached_bytes += s->size;
+            ret = 0;
+        }
+    }
+    stack_cache_unlock();
+
+    if (ret == 0) {
+        DEBUG_PRINT("stack %p returned to cache\n", s->arr_ptr);
+    }
+    return ret;
+}
+
+/* Стек для нового потока: сначала из кэша, иначе через mmap */
+static mystack_t *mystack_acquire(size_t size, size_t guard, int map_flags, int numa_node) {
+    mystack_t *s = stack_cache_get(size, guard, map_flags, numa_node);
+    if (s) {
+        return s;
+    }
+    return mystack_create(size, guard, map_flags, numa_node);
+}
+
+/* Возвращает стек завершившегося потока в кэш или удаляет его */
+static int mystack_release(mystack_t *stack) {
+    if (!stack) {
+        return 0;
+    }
+    if (stack_cache_put(stack) == 0) {
+        return 0;
+    }
+    return mystack_delete(stack);
+}
+
+/* --- Собственный TLS --- */
+
+#ifdef MYTHREAD_HAVE_TLS
+
+static tcb_head_t *current_tcb(void) {
+    tcb_head_t *tcb;
+    __asm__ ("mov %%fs:0, %0" : "=r"(tcb));
+    return tcb;
+}
+
+/* 
+ * Рекурсивные мьютексы glibc (_dl_load_lock, FILE и т.п.) узнают владельца
+ * по tid из struct pthread. Смещение не экспортируется: проверяем его на
+ * TCB текущего потока - там должен лежать tid живого потока процесса.
+ */
+static int tcb_tid_valid(void) {
+    pid_t tid = *(pid_t *)((char *)current_tcb() + TCB_TID_OFFSET);
+    return tid > 0 && syscall(SYS_tgkill, getpid(), tid, 0) == 0;
+}
+
+/* Запоминает, где блок TLS libc лежит относительно указателя потока */
+static int find_libc_tls(struct dl_phdr_info *info, size_t size, void *data) {
+    (void)size;
+    (void)data;
+    if (!info->dlpi_tls_data || !strstr(info->dlpi_name, "/libc.so")) {
+        return 0;
+    }
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        if (info->dlpi_phdr[i].p_type == PT_TLS) {
+            tls_info.libc_offset = (uintptr_t)current_tcb() - (uintptr_t)info->dlpi_tls_data;
+            tls_info.libc_size = info->dlpi_phdr[i].p_memsz;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Ищет функции загрузчика. Гонка безвредна: все вычислят одно и то же */
+static int tls_info_init(void) {
+    int state = __atomic_load_n(&tls_info.state, __ATOMIC_ACQUIRE);
+    if (state != 0) {
+        return state;
+    }
+
+    void (*get_static_info)(size_t *, size_t *) =
+        (void (*)(size_t *, size_t *))dlsym(RTLD_DEFAULT, "_dl_get_tls_static_info");
+    tls_info.allocate_tls = (void *(*)(void *))dlsym(RTLD_DEFAULT, "_dl_allocate_tls");
+    tls_info.deallocate_tls = (void (*)(void *, bool))dlsym(RTLD_DEFAULT, "_dl_deallocate_tls");
+
+    state = -1;
+    if (get_static_info && tls_info.allocate_tls && tls_info.deallocate_tls &&
+        tcb_tid_valid()) {
+        get_static_info(&tls_info.static_size, &tls_info.static_align);
+        if (tls_info.static_align < 64) {
+            tls_info.static_align = 64;
+        }
+        dl_iterate_phdr(find_libc_tls, NULL);
+        state = 1;
+    }
+    DEBUG_PRINT("static TLS: size=%zu, align=%zu, libc block=%zu, state=%d\n",
+                tls_info.static_size, tls_info.static_align, tls_info.libc_size, state);
+
+    __atomic_store_n(&tls_info.state, state, __ATOMIC_RELEASE);
+    return state;
+}
+
+/* 
+ * Размещает TLS и TCB в верхней части стека.
+ * Возвращает указатель потока для CLONE_SETTLS, в *stack_top - вершину стека.
+ */
+static void *tls_setup(mystack_t *s, char **stack_top) {
+    if (tls_info_init() != 1) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    uintptr_t base = (uintptr_t)s->arr_ptr + s->guard;
+    uintptr_t top = (uintptr_t)s;  /* Над TCB лежит только mystack_t */
+    uintptr_t tp = (top - TCB_RESERVE) & ~(uintptr_t)(tls_info.static_align - 1);
+    if (tp - base < tls_info.static_size + TLS_MIN_STACK) {
+        errno = EINVAL;  /* Стек слишком мал */
+        return NULL;
+    }
+
+    /* TCB должен быть нулевым (стек мог прийти из кэша) */
+    tcb_head_t *tcb = (tcb_head_t *)tp;
+    tcb_head_t *parent = current_tcb();
+    memset(tcb, 0, TCB_RESERVE);
+    tcb->stack_guard = parent->stack_guard;
+    tcb->pointer_guard = parent->pointer_guard;
+    tcb->multiple_threads = 1;
+
+    /* DTV + копии .tdata/.tbss всех модулей */
+    if (!tls_info.allocate_tls(tcb)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    tcb->tcb = tcb;
+    tcb->self = tcb;
+
+    /* С этого момента libc должна брать блокировки (как после pthread_create) */
+    parent->multiple_threads = 1;
+#if __has_include(<sys/single_threaded.h>)
+    __libc_single_threaded = 0;
+#endif
+
+    s->tls = tcb;
+    *stack_top = (char *)((tp - tls_info.static_size) & ~(uintptr_t)15);
+    DEBUG_PRINT("private TLS at tp=%p\n", (void *)tp);
+    return tcb;
+}
+
+/* Вызывается потоком первым делом: tid в TCB ставит pthread_create, не clone */
+static void tls_thread_start(mystack_t *s) {
+    if (s->tls) {
+        *(pid_t *)((char *)s->tls + TCB_TID_OFFSET) = (pid_t)syscall(SYS_gettid);
+    }
+}
+
+/* Читает память, не падая на чужом адресе */
+static int peek(const void *addr, void *out, size_t len) {
+    struct iovec local = { out, len };
+    struct iovec remote = { (void *)addr, len };
+    return syscall(SYS_process_vm_readv, getpid(), &local, 1, &remote, 1, 0) == (ssize_t)len ? 0 : -1;
+}
+
+/* 
+ * Освобождает кэш malloc выходящего потока. pthread делает это сам
+ * (tcache_thread_shutdown), а для потока clone функция не экспортируется -
+ * иначе куски из кэша и сам кэш утекают с каждым потоком.
+ * Указатель на кэш ищем в блоке TLS libc: только что освобождённый кусок
+ * лежит в entries[0]. Корзины опустошаются malloc (он берёт из кэша), потом
+ * куски и сам кэш отдаются free мимо кэша. Если
+ * раскладка не совпала - ничего не трогаем. Вызывается последним: после
+ * неё поток не должен звать malloc.
+ */
+static void tls_thread_exit(mystack_t *s) {
+    if (!s->tls || !tls_info.libc_size) {
+        return;
+    }
+    void *probe = malloc(1);   /* Корзина 0 */
+    if (!probe) {
+        return;
+    }
+    free(probe);
+
+    char *block = (char *)s->tls - tls_info.libc_offset;
+    void **slot = NULL;
+    for (size_t off = 0; off + sizeof(void *) <= tls_info.libc_size; off += sizeof(void *)) {
+        void **word = (void **)(block + off);
+        tcache_head_t head;
+        if (*word && peek(*word, &head, sizeof(head)) == 0 &&
+            head.counts[0] != 0 && head.entries[0] == probe) {
+            slot = word;
+            break;
+        }
+    }
+    if (!slot) {
+        return;
+    }
+
+    tcache_head_t *tc = *slot;
+    void *chunks = NULL;
+    for (int i = 0; i < TCACHE_BINS; i++) {
+        /* Запрос 24 + 16*i байт попадает в корзину i */
+        for (unsigned n = tc->counts[i]; n > 0; n--) {
+            void *chunk = malloc(24 + 16 * (size_t)i);
+            *(void **)chunk = chunks;
+            chunks = chunk;
+        }
+    }
+
+    /* Полные корзины: free отдаёт куски в арену. Обнулённый указатель не
+     * годится - free создал бы кэш заново */
+    for (int i = 0; i < TCACHE_BINS; i++) {
+        tc->counts[i] = UINT16_MAX;
+    }
+    while (chunks) {
+        void *next = *(void **)chunks;
+        free(chunks);
+        chunks = next;
+    }
+    free(tc);
+    *slot = NULL;
+}
+
+/* Освобождает DTV и динамический TLS завершившегося потока */
+static void tls_release(mystack_t *s) {
+    if (s && s->tls) {
+        tls_info.deallocate_tls(s->tls, false);
+        s->tls = NULL;
+    }
+}
+
+#else
+
+static void *tls_setup(mystack_t *s, char **stack_top) {
+    (void)s;
+    (void)stack_top;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+static void tls_thread_start(mystack_t *s) {
+    (void)s;
+}
+
+static void tls_thread_exit(mystack_t *s) {
+    (void)s;
+}
+
+static void tls_release(mystack_t *s) {
+    (void)s;
+}
+
+#endif /* MYTHREAD_HAVE_TLS */
+
+/* --- Данные потока (mythread_key_*) --- */
+
+/* 
+ * Ключ - индекс в specific_t.slots. Удалённые ключи не переиспользуются:
+ * у живых потоков в слоте могут остаться старые значения, а обнулить их
+ * без списка всех потоков нельзя.
+ */
+static struct {
+    mythread_mutex_t lock;
+    volatile unsigned count;                           /* Выданных ключей */
+    void (* volatile destructors[MYTHREAD_KEYS_MAX])(void *);
+} keys = { .lock = MYTHREAD_MUTEX_INITIALIZER };
+
+#define KEY_DESTRUCTOR_ITERATIONS 4   /* Как PTHREAD_DESTRUCTOR_ITERATIONS */
+
+#if defined(__x86_64__)
+
+#include <asm/prctl.h>
+#include <sys/auxv.h>
+
+#ifndef HWCAP2_FSGSBASE
+    #define HWCAP2_FSGSBASE (1 << 1)
+#endif
+
+/* Блок main и потоков, созданных не через mythread (наследуют %gs при clone) */
+static specific_t process_specific;
+static int have_wrgsbase;  /* Ядро разрешило wrgsbase (Linux 5.9+) */
+static int gs_owned;       /* %gs при загрузке был свободен - им распоряжаемся мы */
+
+static void specific_set_base(specific_t *sp) {
+    if (!gs_owned) {
+        return;  /* База чужая - не трогаем её и в новых потоках */
+    }
+    if (have_wrgsbase) {
+        __asm__ volatile("wrgsbase %0" : : "r"(sp) : "memory");
+    } else {
+        syscall(SYS_arch_prctl, ARCH_SET_GS, (unsigned long)sp);
+    }
+}
+
+__attribute__((constructor))
+static void specific_init(void) {
+    have_wrgsbase = (getauxval(AT_HWCAP2) & HWCAP2_FSGSBASE) != 0;
+
+    /*
+     * %gs никто не занял - отдаём его блоку процесса. Если база уже задана
+     * (санитайзер, другая библиотека), она не наша: ключи отключаются, иначе
+     * getspecific читал бы, а setspecific портил чужую память
+     */
+    unsigned long base = 0;
+    if (syscall(SYS_arch_prctl, ARCH_GET_GS, &base) == 0 && base == 0) {
+        gs_owned = 1;
+        specific_set_base(&process_specific);
+    }
+}
+
+static int specific_supported(void) {
+    return gs_owned;
+}
+
+void *mythread_getspecific(mythread_key_t key) {
+    if (key >= MYTHREAD_KEYS_MAX || !gs_owned) {
+        return NULL;
+    }
+    void *value;
+    __asm__ volatile("movq %%gs:(,%1,8), %0" : "=r"(value) : "r"((unsigned long)key));
+    return value;
+}
+
+int mythread_setspecific(mythread_key_t key, const void *value) {
+    if (!gs_owned) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (key >= __atomic_load_n(&keys.count, __ATOMIC_ACQUIRE)) {
+        errno = EINVAL;
+        return -1;
+    }
+    __asm__ volatile("movq %0, %%gs:(,%1,8)\n\t"
+                     "movl $1, %%gs:%c2"
+                     : : "r"(value), "r"((unsigned long)key), "i"(offsetof(specific_t, used))
+                     : "memory");
+    return 0;
+}
+
+#else
+
+static void specific_set_base(specific_t *sp) {
+    (void)sp;
+}
+
+static int specific_supported(void) {
+    return 0;
+}
+
+void *mythread_getspecific(mythread_key_t key) {
+    (void)key;
+    return NULL;
+}
+
+int mythread_setspecific(mythread_key_t key, const void *value) {
+    (void)key;
+    (void)value;
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif /* __x86_64__ */
+
+int mythread_key_create(mythread_key_t *key, void (*destructor)(void *)) {
+    if (!key) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!specific_supported()) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    mythread_mutex_lock(&keys.lock);
+    unsigned index = keys.count;
+    if (index >= MYTHREAD_KEYS_MAX) {
+        mythread_mutex_unlock(&keys.lock);
+        errno = EAGAIN;
+        return -1;
+    }
+    keys.destructors[index] = destructor;
+    __atomic_store_n(&keys.count, index + 1, __ATOMIC_RELEASE);
+    mythread_mutex_unlock(&keys.lock);
+
+    *key = index;
+    return 0;
+}
+
+int mythread_key_delete(mythread_key_t key) {
+    if (key >= __atomic_load_n(&keys.count, __ATOMIC_ACQUIRE)) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* Значения остаются у потоков, но деструктор больше не вызывается */
+    __atomic_store_n(&keys.destructors[key], NULL, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Вызывает деструкторы значений потока перед выходом */
+static void specific_run_destructors(specific_t *sp) {
+    for (int round = 0; round < KEY_DESTRUCTOR_ITERATIONS && sp->used; round++) {
+        sp->used = 0;
+        unsigned count = __atomic_load_n(&keys.count, __ATOMIC_ACQUIRE);
+        for (unsigned k = 0; k < count; k++) {
+            void *value = sp->slots[k];
+            if (!value) {
+                continue;
+            }
+            sp->slots[k] = NULL;
+            void (*destructor)(void *) = __atomic_load_n(&keys.destructors[k], __ATOMIC_ACQUIRE);
+            if (destructor) {
+                destructor(value);  /* Может снова вызвать setspecific - тогда ещё раунд */
+            }
+        }
+    }
+}
+
+/* --- Профиль стека --- */
+
+/* Глубина стека завершившегося потока (0 - без профиля), попадает в сводку */
+static size_t stack_profile_collect(mystack_t *s) {
+    if (!s->profile_top) {
+        return 0;
+    }
+    char *base = (char *)s->arr_ptr + s->guard;
+    size_t peak = stackprof_peak(base, s->profile_top);
+    stackprof_record(s->wrapper.user_fn, peak, (size_t)(s->profile_top - base));
+    return peak;
+}
+
+/* --- Сборщик стеков отсоединённых потоков --- */
+
+/* 
+ * Отсоединённый поток перед выходом кладёт свой mystack_t в стек Трайбера
+ * exited и будит сборщик, если тот спит. Сборщик - отдельный поток,
+ * создаётся при первом mythread_detach. Он забирает весь список разом,
+ * ждёт, пока ядро обнулит exit_tid каждого (поток больше не на стеке),
+ * и возвращает стеки в кэш.
+ */
+static struct {
+    mythread_mutex_t  lock;       /* Только для запуска потока сборщика */
+    volatile int      started;
+    mythread_t        thread;
+    mystack_t * volatile exited;  /* Завершившиеся, ещё не собранные */
+    volatile int      seq;        /* futex, на котором спит сборщик */
+    volatile int      sleeping;
+    volatile size_t   pending;    /* Отсоединённые потоки, чьи стеки ещё не собраны */
+} reaper = { .lock = MYTHREAD_MUTEX_INITIALIZER };
+
+#define REAPER_STACK_SIZE (64 * 1024)
+
+/* Вызывается отсоединённым потоком перед выходом */
+static void reaper_push(mystack_t *s) {
+    mystack_t *head = __atomic_load_n(&reaper.exited, __ATOMIC_RELAXED);
+    do {
+        s->next = head;
+    } while (!__atomic_compare_exchange_n(&reaper.exited, &head, s, 1,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    /* Пара к seq_cst-записи sleeping в reaper_fn: кто-то из двоих увидит другого */
+    if (__atomic_load_n(&reaper.sleeping, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&reaper.seq, 1, __ATOMIC_RELEASE);
+        futex_wake(&reaper.seq, 1);
+    }
+}
+
+static void *reaper_fn(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        mystack_t *batch = __atomic_exchange_n(&reaper.exited, NULL, __ATOMIC_ACQUIRE);
+        if (!batch) {
+            __atomic_store_n(&reaper.sleeping, 1, __ATOMIC_SEQ_CST);
+            int seq = __atomic_load_n(&reaper.seq, __ATOMIC_ACQUIRE);
+            if (!__atomic_load_n(&reaper.exited, __ATOMIC_SEQ_CST)) {
+                futex_wait(&reaper.seq, seq);
+            }
+            __atomic_store_n(&reaper.sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        /* Вся пачка обрабатывается за одно пробуждение */
+        size_t count = 0;
+        while (batch) {
+            mystack_t *s = batch;
+            batch = s->next;
+
+            /* Поток мог положить себя в список, но ещё не выйти */
+            int tid;
+            while ((tid = __atomic_load_n(&s->exit_tid, __ATOMIC_ACQUIRE)) != 0) {
+                futex_wait(&s->exit_tid, tid);
+            }
+            stack_profile_collect(s);
+            tls_release(s);
+            mystack_release(s);
+            count++;
+        }
+        DEBUG_PRINT("reaper collected %zu stacks\n", count);
+
+        __atomic_sub_fetch(&reaper.pending, count, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/* Запускает сборщик при первом вызове */
+static int reaper_start(void) {
+    if (__atomic_load_n(&reaper.started, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    int ret = 0;
+    mythread_mutex_lock(&reaper.lock);
+    if (!reaper.started) {
+        mythread_attr_t attr;
+        mythread_attr_init(&attr);
+        attr.stack_size = REAPER_STACK_SIZE;
+
+        /* Свой TLS: tls_release вызывает free, а TLS создателя - не наш */
+        attr.flags = MYTHREAD_THREAD_GROUP;
+        ret = mythread_create_attr(&reaper.thread, &attr, reaper_fn, NULL);
+        if (ret != 0 && errno == ENOTSUP) {
+            attr.flags = MYTHREAD_JOIN_FUTEX;
+            ret = mythread_create_attr(&reaper.thread, &attr, reaper_fn, NULL);
+        }
+        if (ret == 0) {
+            __atomic_store_n(&reaper.started, 1, __ATOMIC_RELEASE);
+        }
+    }
+    mythread_mutex_unlock(&reaper.lock);
+    return ret;
+}
+
 /* --- Обёртка потока --- */
 
+/* Обёртка живёт в mystack_t потока - отдельной памяти не нужно */
 static thread_wrapper_t *create_thread_wrapper(mythread_t *thread, 
+                                               const mythread_attr_t *attr, 
                                                void *(*user_fn)(void *), 
                                                void *user_arg) {
-    thread_wrapper_t *tw = (thread_wrapper_t *)malloc(sizeof(thread_wrapper_t));
-    if (!tw) {
-        DEBUG_PRINT("malloc failed for thread_wrapper\n");
-        return NULL;
-    }
+    thread_wrapper_t *tw = &thread->stack->wrapper;
 
     tw->user_fn = user_fn;
     tw->user_arg = user_arg;
     tw->fn_retv = &thread->retv;
+    tw->cpuset_size = attr->cpuset_size;
+    if (attr->cpuset_size) {
+        memcpy(&tw->cpuset, attr->cpuset, attr->cpuset_size);
+    }
 
     DEBUG_PRINT("thread_wrapper created at %p\n", tw);
     return tw;
@@ -104,91 +950,344 @@ static thread_wrapper_t *create_thread_wrapper(mythread_t *thread,
 /* Функция-обёртка, выполняющаяся в новом потоке */
 static int thread_wrapper_fn(void *arg) {
     thread_wrapper_t *tw = (thread_wrapper_t *)arg;
+    mystack_t *s = (mystack_t *)((char *)tw - offsetof(mystack_t, wrapper));
+    tls_thread_start(s);
     DEBUG_PRINT("thread_wrapper_fn have got thread_wrapper\n");
+
+    /* %gs унаследован от создателя - переключаем на свой блок ключей */
+    specific_set_base(&s->specific);
     
+    /* Привязка к процессорам - до первой инструкции пользовательского кода */
+    if (tw->cpuset_size) {
+        sched_setaffinity(0, tw->cpuset_size, &tw->cpuset);
+    }
+
     /* Выполняем пользовательскую функцию */
+    TRACE_SELF(self);
+    TRACE_EVENT(TRACE_START, self);
     INFO_PRINT("user_fn have started\n");
     void *result = tw->user_fn(tw->user_arg);
     DEBUG_PRINT("user_fn returned: %p\n", result);
     
-    /* Сохраняем результат */
-    *(tw->fn_retv) = result;
-    DEBUG_PRINT("stored result at address: %p, value: %p\n", tw->fn_retv, *(tw->fn_retv));
+    specific_run_destructors(&s->specific);
+
+    /* Счётчики снимаются до передачи стека join или сборщику */
+    if (s->stats_ready == -1) {
+        stats_capture(&s->stats);
+        s->stats.lifetime_ns = stats_now() - s->start_ns;
+        __atomic_store_n(&s->stats_ready, 1, __ATOMIC_RELEASE);
+    }
+    TRACE_EVENT(TRACE_FINISH, self);
     INFO_PRINT("user_fn have finished\n");
-    
-    /* Освобождаем память обёртки */
-    free(tw);
-    DEBUG_PRINT("thread_wrapper have been deleted\n");
-    
+    tls_thread_exit(s);
+
+    int state = DETACH_RUNNING;
+    if (__atomic_compare_exchange_n(&s->detach, &state, DETACH_EXITING, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* Не отсоединён: mythread_t ещё жив, результат заберёт join */
+        *(tw->fn_retv) = result;
+        DEBUG_PRINT("stored result at address: %p, value: %p\n", tw->fn_retv, *(tw->fn_retv));
+    } else {
+        /* 
+         * Отсоединён: mythread_t мог уже исчезнуть. Ядро при выходе
+         * обнулит exit_tid в нашем mystack_t вместо tid в mythread_t,
+         * а стек заберёт сборщик. join в трассе - сразу за finish.
+         */
+        TRACE_EVENT(TRACE_JOIN, self);
+        s->exit_tid = 1;
+        syscall(SYS_set_tid_address, &s->exit_tid);
+        reaper_push(s);
+    }
+
+    /* Кольцо трассы своего TLS - следующему потоку; общее TLS - кольцо создателя */
+    if (s->tls) {
+        TRACE_RELEASE();
+    }
+
+    /* Обёртка лежит в mystack_t и освобождается вместе со стеком */
+    return 0;
+}
+
+/* --- Ожидание завершения --- */
+
+/* Ждёт, пока ядро обнулит tid (CLONE_CHILD_CLEARTID) */
+static int join_futex(mythread_t *thread) {
+    int tid;
+
+    while ((tid = __atomic_load_n(&thread->tid, __ATOMIC_ACQUIRE)) != 0) {
+        if (futex_wait(&thread->tid, tid) == -1 &&
+            errno != EAGAIN && errno != EINTR) {
+            perror("futex wait failed");
+            return -1;
+        }
+    }
     return 0;
 }
 
 /* --- Публичные функции --- */
 
+static size_t round_up(size_t value, size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+int mythread_attr_init(mythread_attr_t *attr) {
+    if (!attr) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    attr->stack_size = STACK_SIZE;
+    attr->guard_size = (size_t)sysconf(_SC_PAGESIZE);
+    attr->flags = 0;
+    attr->numa_node = -1;
+    attr->cpuset_size = 0;
+    attr->cpuset = NULL;
+    return 0;
+}
+
+/* 
+ * Маска affinity должна помещаться в cpu_set_t и содержать хотя бы
+ * один процессор, доступный вызывающему, - тогда sched_setaffinity
+ * в новом потоке не может завершиться ошибкой.
+ */
+static int check_affinity(const mythread_attr_t *attr) {
+    if (attr->cpuset_size == 0) {
+        return 0;
+    }
+    if (!attr->cpuset || attr->cpuset_size > sizeof(cpu_set_t)) {
+        return -1;
+    }
+
+    cpu_set_t allowed, wanted;
+    CPU_ZERO(&wanted);
+    memcpy(&wanted, attr->cpuset, attr->cpuset_size);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        return -1;
+    }
+    CPU_AND(&wanted, &wanted, &allowed);
+    return CPU_COUNT(&wanted) > 0 ? 0 : -1;
+}
+
 int mythread_create(mythread_t *thread, 
                     void *(*start_routine)(void *), 
                     void *arg) {
-    if (!thread || !start_routine) {
+    return mythread_create_attr(thread, NULL, start_routine, arg);
+}
+
+int mythread_create_flags(mythread_t *thread, 
+                          void *(*start_routine)(void *), 
+                          void *arg, 
+                          int flags) {
+    mythread_attr_t attr;
+
+    mythread_attr_init(&attr);
+    attr.flags = flags;
+    return mythread_create_attr(thread, &attr, start_routine, arg);
+}
+
+/* Проверяет атрибуты и вычисляет итоговые флаги и геометрию стека */
+static int attr_prepare(const mythread_attr_t *attr, int *flags, size_t *size, size_t *guard) {
+    *flags = attr->flags;
+    if ((*flags & ~(MYTHREAD_THREAD_GROUP | STACK_MAP_FLAGS | MYTHREAD_STACK_PROFILE | MYTHREAD_STATS)) ||
+        attr->stack_size < MYTHREAD_STACK_MIN ||
+        attr->numa_node < -1 || attr->numa_node >= NUMA_MAX_NODES || check_affinity(attr) == -1) {
         errno = EINVAL;
         return -1;
     }
 
+    if (stackprof_forced) {
+        *flags |= MYTHREAD_STACK_PROFILE;
+    }
+
+    /* Свой TLS имеет смысл только у потока группы */
+    if (*flags & MYTHREAD_PRIVATE_TLS) {
+        *flags |= MYTHREAD_JOIN_FUTEX;
+    }
+
+    /* Размеры округляем до страницы отображения */
+    size_t page = (*flags & MYTHREAD_STACK_HUGETLB) ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    *guard = round_up(attr->guard_size, page);
+    *size = round_up(attr->stack_size, page) + *guard;
+    return 0;
+}
+
+/* Запускает поток на готовом стеке. При ошибке стек возвращается в кэш */
+static int start_thread(mythread_t *thread, 
+                        const mythread_attr_t *attr, 
+                        int flags, 
+                        mystack_t *stack, 
+                        void *(*start_routine)(void *), 
+                        void *arg) {
     /* Инициализируем поля */
     thread->pid = -1;
-    thread->stack = NULL;
+    thread->stack = stack;
     thread->retv = NULL;
+    thread->tid = 0;
+    thread->flags = flags;
+    thread->stack_used = 0;
+    memset(&thread->stats, 0, sizeof(thread->stats));
+    stack->detach = DETACH_RUNNING;
+    stack->stats_ready = (flags & MYTHREAD_STATS) ? -1 : 0;  /* -1 - снять при выходе */
+    stack->exit_tid = 0;
+    stack->pidfd = -1;
+    if (stack->specific.used) {
+        /* Стек из кэша: прошлый поток оставил значения без деструкторов */
+        memset(&stack->specific, 0, sizeof(stack->specific));
+    }
 
-    /* Создаём стек */
-    thread->stack = mystack_create(STACK_SIZE);
-    if (!thread->stack) {
-        perror("mystack_create failed");
-        return -1;  /* errno уже установлен mmap/malloc */
+    /* Заполняем обёртку (она внутри стека) */
+    thread_wrapper_t *tw = create_thread_wrapper(thread, attr, start_routine, arg);
+    DEBUG_PRINT("thread_wrapper have been created\n");
+
+    char *stack_top = (char *)thread->stack;  /* Стек растёт вниз от mystack_t */
+    int clone_flags = (flags & MYTHREAD_JOIN_FUTEX) ? CLONE_FLAGS_THREAD : CLONE_FLAGS_PROCESS;
+    void *tls = NULL;
+
+    /* Свой TLS в верхней части стека */
+    if (flags & MYTHREAD_PRIVATE_TLS) {
+        tls = tls_setup(thread->stack, &stack_top);
+        if (!tls) {
+            int saved_errno = errno;
+            perror("tls_setup failed");
+            mystack_release(thread->stack);
+            thread->stack = NULL;
+            errno = saved_errno;
+            return -1;
+        }
+        clone_flags |= CLONE_SETTLS;
     }
-    DEBUG_PRINT("stack have been created\n");
 
-    /* Создаём обёртку */
-    thread_wrapper_t *tw = create_thread_wrapper(thread, start_routine, arg);
-    if (!tw) {
-        perror("create_thread_wrapper failed");
-        mystack_delete(thread->stack);
-        thread->stack = NULL;
-        return -1;  /* errno установлен malloc */
+    /* Профиль: вся свободная часть стека - шаблон (касается каждой страницы) */
+    stack->profile_top = NULL;
+    if (flags & MYTHREAD_STACK_PROFILE) {
+        stack->profile_top = stack_top;
+        stackprof_fill((char *)stack->arr_ptr + stack->guard, stack_top);
     }
-    DEBUG_PRINT("thread_wrapper have been created\n");
 
-    /* Клонируем процесс */
+    /* Клонируем процесс (или поток группы в режиме futex) */
+    TRACE_TIMESTAMP(clone_start);
+    stack->start_ns = stats_now();
     thread->pid = clone(
         thread_wrapper_fn,
-        (char *)thread->stack->arr_ptr + thread->stack->size,  /* Стек растёт вниз */
-        CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | SIGCHLD,
-        (void *)tw
+        stack_top,
+        clone_flags,
+        (void *)tw,
+        &thread->tid,   /* CLONE_PARENT_SETTID */
+        tls,            /* CLONE_SETTLS */
+        &thread->tid    /* CLONE_CHILD_CLEARTID */
     );
 
     if (thread->pid == -1) {
         int saved_errno = errno;  /* Сохраняем errno */
         perror("clone failed");
-        free(tw);
-        mystack_delete(thread->stack);
+        tls_release(thread->stack);
+        mystack_release(thread->stack);
         thread->stack = NULL;
         errno = saved_errno;
         return -1;
     }
     DEBUG_PRINT("clone have been executed, pid=%d\n", thread->pid);
+    TRACE_EVENT_AT(TRACE_CREATE, thread->pid, clone_start);
 
     return 0;
 }
 
-int mythread_join(mythread_t *thread, void **retv) {
-    if (!thread || thread->pid == -1) {
+int mythread_create_attr(mythread_t *thread, 
+                         const mythread_attr_t *attr, 
+                         void *(*start_routine)(void *), 
+                         void *arg) {
+    mythread_attr_t default_attr;
+    if (!attr) {
+        mythread_attr_init(&default_attr);
+        attr = &default_attr;
+    }
+
+    int flags;
+    size_t size, guard;
+    if (!thread || !start_routine) {
         errno = EINVAL;
         return -1;
     }
+    thread->pid = -1;
+    thread->stack = NULL;
+    if (attr_prepare(attr, &flags, &size, &guard) == -1) {
+        return -1;
+    }
 
-    /* Ожидаем завершения потока */
-    if (waitpid(thread->pid, NULL, 0) == -1) {
-        perror("waitpid failed");
-        return -1;  /* errno установлен waitpid */
+    /* Создаём стек */
+    mystack_t *stack = mystack_acquire(size, guard, flags & STACK_MAP_FLAGS, attr->numa_node);
+    if (!stack) {
+        perror("mystack_acquire failed");
+        return -1;  /* errno уже установлен mmap/mprotect/mbind */
+    }
+    DEBUG_PRINT("stack have been created\n");
+
+    return start_thread(thread, attr, flags, stack, start_routine, arg);
+}
+
+int mythread_create_n(mythread_t *threads, 
+                      int n, 
+                      const mythread_attr_t *attr, 
+                      void *(*const *start_routines)(void *), 
+                      void *const *args) {
+    mythread_attr_t default_attr;
+    if (!attr) {
+        mythread_attr_init(&default_attr);
+        attr = &default_attr;
+    }
+
+    if (!threads || n <= 0 || !start_routines) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        threads[i].pid = -1;
+        threads[i].stack = NULL;
+        if (!start_routines[i]) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    int flags;
+    size_t size, guard;
+    if (attr_prepare(attr, &flags, &size, &guard) == -1) {
+        return -1;
+    }
+
+    /* Все стеки - одно отображение и один mbind; дальше каждый живёт сам по себе */
+    char *region = mystack_map(size * (size_t)n, flags & STACK_MAP_FLAGS, attr->numa_node);
+    if (!region) {
+        perror("mystack_map failed");
+        return -1;
     }
+
+    for (int i = 0; i < n; i++) {
+        char *base = region + size * (size_t)i;
+        mystack_t *stack = mystack_init(base, size, guard, flags & STACK_MAP_FLAGS, attr->numa_node);
+        if (!stack ||
+            start_thread(&threads[i], attr, flags, stack, start_routines[i], args ? args[i] : NULL) == -1) {
+            /* Стеки ещё не запущенных потоков больше не нужны */
+            int saved_errno = errno;
+            char *rest = stack ? base + size : base;
+            if (rest < region + size * (size_t)n) {
+                munmap(rest, (size_t)(region + size * (size_t)n - rest));
+            }
+            errno = saved_errno;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Поток запущен и ещё не присоединён */
+static int joinable(const mythread_t *thread) {
+    return thread->pid != -1 && thread->stack != NULL;
+}
+
+/* Забирает результат уже завершившегося потока и освобождает его стек */
+static int join_finish(mythread_t *thread, void **retv) {
+    TRACE_EVENT(TRACE_JOIN, thread->pid);
     INFO_PRINT("have waited for the mythread to finish\n");
 
     /* Возвращаем результат, если нужно */
@@ -197,9 +1296,20 @@ int mythread_join(mythread_t *thread, void **retv) {
         DEBUG_PRINT("have stored value=%p\n", thread->retv);
     }
 
-    /* Освобождаем стек */
-    if (mystack_delete(thread->stack) == -1) {
-        perror("mystack_delete failed");
+    thread->stack_used = stack_profile_collect(thread->stack);
+    if (thread->stack->stats_ready == 1) {
+        thread->stats = thread->stack->stats;
+    }
+
+    if (thread->stack->pidfd != -1) {
+        close(thread->stack->pidfd);
+        thread->stack->pidfd = -1;
+    }
+
+    /* Возвращаем стек в кэш (или освобождаем, если кэш полон) */
+    tls_release(thread->stack);
+    if (mystack_release(thread->stack) == -1) {
+        perror("mystack_release failed");
         thread->stack = NULL;
         return -1;
     }
@@ -207,4 +1317,493 @@ int mythread_join(mythread_t *thread, void **retv) {
     INFO_PRINT("have got the message from the mythread\n");
 
     return 0;
-}
\ No newline at end of file
+}
+
+/* 
+ * Забирает зомби потока обычного режима. ECHILD при обнулённом tid -
+ * зомби уже забрал mythread_join_all другого массива: поток завершился
+ */
+static int reap_process(mythread_t *thread) {
+    while (waitpid(thread->pid, NULL, __WCLONE) == -1) {
+        if (errno == ECHILD && __atomic_load_n(&thread->tid, __ATOMIC_ACQUIRE) == 0) {
+            return 0;
+        }
+        if (errno != EINTR) {
+            perror("waitpid failed");
+            return -1;  /* errno установлен waitpid */
+        }
+    }
+    return 0;
+}
+
+int mythread_join(mythread_t *thread, void **retv) {
+    if (!thread || thread->pid == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Ожидаем завершения потока */
+    if (thread->flags & MYTHREAD_JOIN_FUTEX) {
+        if (join_futex(thread) == -1) {
+            return -1;
+        }
+    } else if (reap_process(thread) == -1) {
+        return -1;
+    }
+
+    return join_finish(thread, retv);
+}
+
+int mythread_detach(mythread_t *thread) {
+    /* Без CLONE_THREAD ядро оставит зомби, которого некому дождаться */
+    if (!thread || !joinable(thread) || !(thread->flags & MYTHREAD_JOIN_FUTEX)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (reaper_start() == -1) {
+        return -1;
+    }
+
+    mystack_t *s = thread->stack;
+    __atomic_add_fetch(&reaper.pending, 1, __ATOMIC_RELAXED);
+
+    int state = DETACH_RUNNING;
+    if (!__atomic_compare_exchange_n(&s->detach, &state, DETACH_DETACHED, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* Поток уже завершается и пишет в *thread - проще дождаться его здесь */
+        __atomic_sub_fetch(&reaper.pending, 1, __ATOMIC_RELAXED);
+        return mythread_join(thread, NULL);
+    }
+
+    DEBUG_PRINT("detached thread pid=%d\n", thread->pid);
+
+    /* Дальше поток и его стек принадлежат сборщику */
+    thread->pid = -1;
+    thread->stack = NULL;
+    return 0;
+}
+
+size_t mythread_detached_pending(void) {
+    return __atomic_load_n(&reaper.pending, __ATOMIC_ACQUIRE);
+}
+
+int mythread_stats(const mythread_t *thread, mythread_stats_t *out) {
+    if (!thread || !out || thread->pid == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Уже присоединён: остались только счётчики, снятые при выходе */
+    if (!thread->stack) {
+        if (!(thread->flags & MYTHREAD_STATS)) {
+            errno = ENODATA;
+            return -1;
+        }
+        *out = thread->stats;
+        return 0;
+    }
+
+    mystack_t *s = thread->stack;
+    if (__atomic_load_n(&s->stats_ready, __ATOMIC_ACQUIRE) != 1) {
+        int group = (thread->flags & MYTHREAD_JOIN_FUTEX) != 0;
+        /*
+         * Вышедший поток режима futex не становится зомби: ядро обнуляет tid
+         * и может сразу отдать номер другому потоку, и /proc/self/task/<tid>
+         * был бы уже чужим. Поэтому tid проверяется до и после чтения:
+         * если он не обнулился, всё прочитанное - счётчики этого потока.
+         * В обычном режиме номер держит зомби до waitpid
+         */
+        if ((!group || __atomic_load_n(&thread->tid, __ATOMIC_ACQUIRE) != 0) &&
+            stats_read_live(thread->pid, group, out) == 0 &&
+            (!group || __atomic_load_n(&thread->tid, __ATOMIC_ACQUIRE) != 0)) {
+            out->lifetime_ns = stats_now() - s->start_ns;
+            return 0;
+        }
+        /* Поток вышел (до или во время чтения /proc) - возможно, счётчики уже сняты */
+        if (__atomic_load_n(&s->stats_ready, __ATOMIC_ACQUIRE) != 1) {
+            errno = ENODATA;
+            return -1;
+        }
+    }
+    *out = s->stats;
+    return 0;
+}
+
+/* --- Ожидание группы потоков --- */
+
+#ifdef HAVE_FUTEX_WAITV
+/* Заполняет waiter для ещё живого потока режима futex. 0 - ждать нечего */
+static int waiter_fill(mythread_t *thread, struct futex_waitv *waiter) {
+    int tid = __atomic_load_n(&thread->tid, __ATOMIC_ACQUIRE);
+    if (!joinable(thread) || !(thread->flags & MYTHREAD_JOIN_FUTEX) || tid == 0) {
+        return 0;
+    }
+    waiter->val = (unsigned)tid;
+    waiter->uaddr = (uintptr_t)&thread->tid;
+    waiter->flags = FUTEX_32;  /* Без FUTEX_PRIVATE_FLAG - как пробуждение по CLEARTID */
+    waiter->__reserved = 0;
+    return 1;
+}
+
+/* 
+ * Собирает в waiters до FUTEX_WAITV_MAX ещё живых потоков режима futex,
+ * начиная с first. В *index - их номера. Возвращает количество.
+ */
+static unsigned collect_waiters(mythread_t *threads, int n, int first,
+                                struct futex_waitv *waiters, int *index) {
+    unsigned nr = 0;
+
+    for (int k = 0; k < n && nr < FUTEX_WAITV_MAX; k++) {
+        int i = (first + k) % n;
+        if (waiter_fill(&threads[i], &waiters[nr])) {
+            index[nr++] = i;
+        }
+    }
+    return nr;
+}
+#endif
+
+/* 
+ * Ждёт, пока ядро обнулит tid у всех потоков режима futex. Один системный
+ * вызов ждёт сразу до 128 потоков. Окно сдвигается по массиву: после
+ * пробуждения проверяются только потоки окна, а место вышедших занимают
+ * следующие - весь массив просматривается один раз.
+ */
+static int wait_futex_all(mythread_t *threads, int n) {
+#ifdef HAVE_FUTEX_WAITV
+    struct futex_waitv waiters[FUTEX_WAITV_MAX];
+    int index[FUTEX_WAITV_MAX];
+    unsigned nr = 0;
+    int next = 0;
+
+    for (;;) {
+        unsigned kept = 0;
+        for (unsigned k = 0; k < nr; k++) {
+            if (__atomic_load_n(&threads[index[k]].tid, __ATOMIC_ACQUIRE) != 0) {
+                waiters[kept] = waiters[k];
+                index[kept++] = index[k];
+            }
+        }
+        for (nr = kept; next < n && nr < FUTEX_WAITV_MAX; next++) {
+            if (waiter_fill(&threads[next], &waiters[nr])) {
+                index[nr++] = next;
+            }
+        }
+        if (nr == 0) {
+            break;
+        }
+        if (futex_waitv(waiters, nr, NULL) == -1) {
+            if (errno == ENOSYS) {
+                break;  /* Старое ядро - ждём по одному */
+            }
+            if (errno != EAGAIN && errno != EINTR) {
+                perror("futex_waitv failed");
+                return -1;
+            }
+        }
+    }
+#endif
+
+    for (int i = 0; i < n; i++) {
+        if (joinable(&threads[i]) && (threads[i].flags & MYTHREAD_JOIN_FUTEX) &&
+            join_futex(&threads[i]) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Поток обычного режима по pid - таблица для join_all_process */
+typedef struct {
+    pid_t pid;
+    int   index;  /* -1 - уже присоединён */
+} pid_entry_t;
+
+static int cmp_pid_entry(const void *a, const void *b) {
+    pid_t pa = ((const pid_entry_t *)a)->pid;
+    pid_t pb = ((const pid_entry_t *)b)->pid;
+    return (pa > pb) - (pa < pb);
+}
+
+/* 
+ * Присоединяет потоки обычного режима в порядке выхода: один waitid(P_ALL)
+ * на поток, номер ищется по pid в отсортированной таблице. __WCLONE не
+ * задевает потомков fork; зомби чужого потока mythread тоже забирается -
+ * его join увидит ECHILD и нулевой tid. Кого не дождались так (ECHILD,
+ * нет памяти под таблицу) - ждём по одному.
+ */
+static int join_all_process(mythread_t *threads, int n, void **retvs) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        if (joinable(&threads[i]) && !(threads[i].flags & MYTHREAD_JOIN_FUTEX)) {
+            count++;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    int ret = 0;
+    pid_entry_t *table = malloc(sizeof(pid_entry_t) * (size_t)count);
+    if (table) {
+        int k = 0;
+        for (int i = 0; i < n; i++) {
+            if (joinable(&threads[i]) && !(threads[i].flags & MYTHREAD_JOIN_FUTEX)) {
+                table[k].pid = threads[i].pid;
+                table[k++].index = i;
+            }
+        }
+        qsort(table, (size_t)count, sizeof(pid_entry_t), cmp_pid_entry);
+
+        for (int left = count; left > 0; ) {
+            siginfo_t info;
+            if (waitid(P_ALL, 0, &info, WEXITED | __WCLONE) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            pid_entry_t key = { info.si_pid, 0 };
+            pid_entry_t *e = bsearch(&key, table, (size_t)count, sizeof(pid_entry_t), cmp_pid_entry);
+            if (!e || e->index == -1) {
+                continue;  /* Поток другого массива */
+            }
+            if (join_finish(&threads[e->index], retvs ? &retvs[e->index] : NULL) == -1) {
+                ret = -1;
+            }
+            e->index = -1;
+            left--;
+        }
+        free(table);
+    }
+
+    for (int i = 0; i < n; i++) {
+        mythread_t *thread = &threads[i];
+        if (!joinable(thread) || (thread->flags & MYTHREAD_JOIN_FUTEX)) {
+            continue;
+        }
+        if (reap_process(thread) == -1 ||
+            join_finish(thread, retvs ? &retvs[i] : NULL) == -1) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+int mythread_join_all(mythread_t *threads, int n, void **retvs) {
+    if (!threads || n <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (wait_futex_all(threads, n) == -1) {
+        return -1;
+    }
+
+    int ret = join_all_process(threads, n, retvs);
+    for (int i = 0; i < n; i++) {
+        mythread_t *thread = &threads[i];
+        if (!joinable(thread) || !(thread->flags & MYTHREAD_JOIN_FUTEX)) {
+            continue;  /* Не запущен, уже присоединён или обычного режима */
+        }
+        if (join_finish(thread, retvs ? &retvs[i] : NULL) == -1) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+/* 
+ * Поток не режима futex: ждём через pidfd, все сразу одним poll. pidfd
+ * открывается при первом ожидании и живёт в mystack_t до join, поэтому
+ * повторные вызовы на том же массиве - один poll без pidfd_open/close.
+ */
+static int wait_any_pidfd(mythread_t *threads, int n) {
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * (size_t)n);
+    int *index = malloc(sizeof(int) * (size_t)n);
+    int nfds = 0, ready = -1;
+
+    if (!fds || !index) {
+        free(fds);
+        free(index);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (!joinable(&threads[i])) {
+            continue;
+        }
+        mystack_t *s = threads[i].stack;
+        if (s->pidfd == -1) {
+            s->pidfd = (int)syscall(SYS_pidfd_open, threads[i].pid, 0);
+        }
+        if (s->pidfd == -1) {
+            /* Зомби уже забран (см. reap_process) - поток завершён */
+            if (errno == ESRCH && __atomic_load_n(&threads[i].tid, __ATOMIC_ACQUIRE) == 0) {
+                ready = i;
+            }
+            break;
+        }
+        fds[nfds].fd = s->pidfd;
+        fds[nfds].events = POLLIN;
+        index[nfds++] = i;
+    }
+
+    if (ready == -1 && nfds > 0 && poll(fds, (nfds_t)nfds, -1) > 0) {
+        for (int k = 0; k < nfds && ready == -1; k++) {
+            if (fds[k].revents) {
+                ready = index[k];
+            }
+        }
+    }
+
+    int saved_errno = errno;
+    free(fds);
+    free(index);
+    errno = saved_errno;
+    return ready;
+}
+
+/* Поток режима futex: один futex_waitv на все (до 128 за раз) */
+static int wait_any_futex(mythread_t *threads, int n, int first) {
+    int alive = -1;
+    for (int i = 0; i < n; i++) {
+        if (joinable(&threads[i]) && __atomic_load_n(&threads[i].tid, __ATOMIC_ACQUIRE) != 0) {
+            alive = i;
+            break;
+        }
+    }
+    if (alive == -1) {
+        return 0;  /* Кто-то уже завершился */
+    }
+
+#ifdef HAVE_FUTEX_WAITV
+    struct futex_waitv waiters[FUTEX_WAITV_MAX];
+    int index[FUTEX_WAITV_MAX];
+    unsigned nr = collect_waiters(threads, n, first, waiters, index);
+
+    /* Потоки вне окна из 128 тоже могут завершиться - тогда ждём с таймаутом */
+    struct timespec deadline, *timeout = NULL;
+    if (n > FUTEX_WAITV_MAX) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        timeout = &deadline;
+    }
+
+    if (futex_waitv(waiters, nr, timeout) >= 0 ||
+        errno == EAGAIN || errno == EINTR || errno == ETIMEDOUT) {
+        return 0;
+    }
+    if (errno != ENOSYS) {
+        return -1;
+    }
+#else
+    (void)first;
+#endif
+
+    /* Без futex_waitv - ждём первого живого, периодически проверяя остальных */
+    struct timespec step = { 0, 1000000 };
+    int tid = __atomic_load_n(&threads[alive].tid, __ATOMIC_ACQUIRE);
+    if (tid != 0) {
+        futex_wait_timeout(&threads[alive].tid, tid, &step);
+    }
+    return 0;
+}
+
+int mythread_join_any(mythread_t *threads, int n, void **retv) {
+    if (!threads || n <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int futex_mode = -1;
+    for (int i = 0; i < n; i++) {
+        if (!joinable(&threads[i])) {
+            continue;
+        }
+        int mode = (threads[i].flags & MYTHREAD_JOIN_FUTEX) != 0;
+        if (futex_mode != -1 && futex_mode != mode) {
+            errno = EINVAL;  /* Нельзя ждать futex и pidfd одним вызовом */
+            return -1;
+        }
+        futex_mode = mode;
+    }
+    if (futex_mode == -1) {
+        errno = ECHILD;  /* Ждать некого */
+        return -1;
+    }
+
+    if (!futex_mode) {
+        int i = wait_any_pidfd(threads, n);
+        if (i == -1) {
+            perror("pidfd wait failed");
+            return -1;
+        }
+        if (reap_process(&threads[i]) == -1) {
+            return -1;
+        }
+        return join_finish(&threads[i], retv) == 0 ? i : -1;
+    }
+
+    for (int round = 0; ; round++) {
+        for (int i = 0; i < n; i++) {
+            if (joinable(&threads[i]) && __atomic_load_n(&threads[i].tid, __ATOMIC_ACQUIRE) == 0) {
+                return join_finish(&threads[i], retv) == 0 ? i : -1;
+            }
+        }
+        /* Окно из 128 потоков сдвигается, чтобы со временем увидеть всех */
+        if (wait_any_futex(threads, n, (round * FUTEX_WAIT_WINDOW) % n) == -1) {
+            perror("futex_waitv failed");
+            return -1;
+        }
+    }
+}
+
+size_t mythread_stack_cache_set_limit(size_t max_bytes) {
+    stack_cache_lock();
+    size_t old = stack_cache.max_bytes;
+    stack_cache.max_bytes = max_bytes;
+    stack_cache_unlock();
+
+    /* Выкидываем то, что не влезает в новый лимит */
+    mythread_stack_cache_trim(max_bytes);
+    return old;
+}
+
+size_t mythread_stack_cache_trim(size_t keep_bytes) {
+    mystack_t *victims = NULL;
+    size_t freed = 0;
+
+    /* Под блокировкой только отцепляем стеки, munmap делаем снаружи */
+    stack_cache_lock();
+    for (int i = 0; i < STACK_CACHE_BUCKETS && stack_cache.cached_bytes > keep_bytes; i++) {
+        stack_bucket_t *b = &stack_cache.buckets[i];
+        while (b->head && stack_cache.cached_bytes > keep_bytes) {
+            mystack_t *s = b->head;
+            b->head = s->next;
+            b->count--;
+            stack_cache.cached_bytes -= s->size;
+
+            s->next = victims;
+            victims = s;
+        }
+        if (b->count == 0) {
+            b->size = 0;
+        }
+    }
+    stack_cache_unlock();
+
+    while (victims) {
+        mystack_t *next = victims->next;
+        freed += victims->size;
+        mystack_delete(victims);
+        victims = next;
+    }
+    DEBUG_PRINT("stack cache trimmed, freed=%zu\n", freed);
+    return freed;
+}
@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+
+#include "mythread.h"
+#include "futex.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+
+/*
+ * Пул потоков с перехватом задач.
+ *
+ * Потоки создаются один раз, дальше задача - это только запись в очередь.
+ * У каждого потока своя дека Chase-Lev ("Dynamic Circular Work-Stealing
+ * Deque", порядок памяти - по Lê et al. 2013): владелец кладёт и берёт
+ * задачи снизу без блокировок, остальные крадут сверху одним CAS.
+ * Задачи извне пула идут в общую очередь под мьютексом.
+ *
+ * Задача живёт в mythread_future_t вызывающего, поэтому отправка задачи
+ * не выделяет память.
+ */
+
+#define POOL_DEQUE_SIZE 1024                 /* Ёмкость деки (степень двойки) */
+#define POOL_DEQUE_MASK (POOL_DEQUE_SIZE - 1)
+#define POOL_MAX_WORKERS 256
+
+/* Состояния mythread_future_t.state */
+#define FUTURE_PENDING 0
+#define FUTURE_WAITING 1  /* Кто-то спит в FUTEX_WAIT на state */
+#define FUTURE_DONE    2
+
+/* Результат кражи: дека пуста или проиграли гонку за задачу */
+#define STEAL_ABORT ((mythread_future_t *)-1)
+
+typedef struct {
+    /* top и bottom в разных строках кэша: их пишут разные потоки */
+    volatile long top __attribute__((aligned(64)));     /* Отсюда крадут */
+    volatile long bottom __attribute__((aligned(64)));  /* Здесь работает владелец */
+    mythread_future_t *buf[POOL_DEQUE_SIZE];
+} ws_deque_t;
+
+typedef struct pool_worker_t {
+    ws_deque_t       deque;
+    mythread_pool_t *pool;
+    mythread_t       thread;
+    unsigned         seed;    /* Для выбора жертвы кражи */
+    int              index;
+} pool_worker_t;
+
+struct mythread_pool_t {
+    int               nworkers;
+    int               local_queues;  /* Потоки видят себя через TLS (режим THREAD_GROUP) */
+    volatile int      stop;
+    volatile int      epoch;         /* futex, на котором спят свободные потоки */
+    volatile int      sleepers;
+    volatile int      outstanding;   /* Отправлено и ещё не выполнено */
+    volatile int      waiters;       /* Сколько потоков в mythread_pool_wait */
+    mythread_mutex_t  inject_lock;
+    mythread_future_t *inject_head;
+    mythread_future_t *inject_tail;
+    pool_worker_t     *workers;
+};
+
+/* Поток пула, в котором мы выполняемся (только при своём TLS) */
+static __thread pool_worker_t *current_worker __attribute__((tls_model("initial-exec")));
+
+/* --- Дека Chase-Lev --- */
+
+/* Только владелец. Возвращает -1, если дека заполнена */
+static int deque_push(ws_deque_t *dq, mythread_future_t *f) {
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    if (b - t >= POOL_DEQUE_SIZE) {
+        return -1;
+    }
+    __atomic_store_n(&dq->buf[b & POOL_DEQUE_MASK], f, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Только владелец: берёт последнюю положенную задачу */
+static mythread_future_t *deque_take(ws_deque_t *dq) {
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        /* Дека была пуста */
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    mythread_future_t *f = __atomic_load_n(&dq->buf[b & POOL_DEQUE_MASK], __ATOMIC_RELAXED);
+    if (t == b) {
+        /* Последняя задача - соревнуемся с ворами */
+        if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            f = NULL;
+        }
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return f;
+}
+
+/* Любой поток: крадёт самую старую задачу */
+static mythread_future_t *deque_steal(ws_deque_t *dq) {
+    long t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+
+    if (t >= b) {
+        return NULL;
+    }
+    mythread_future_t *f = __atomic_load_n(&dq->buf[t & POOL_DEQUE_MASK], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return STEAL_ABORT;
+    }
+    return f;
+}
+
+static int deque_empty(ws_deque_t *dq) {
+    return __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE) >=
+           __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+}
+
+/* --- Общая очередь --- */
+
+static void inject_push(mythread_pool_t *pool, mythread_future_t *f) {
+    f->next = NULL;
+    mythread_mutex_lock(&pool->inject_lock);
+    if (pool->inject_tail) {
+        pool->inject_tail->next = f;
+    } else {
+        __atomic_store_n(&pool->inject_head, f, __ATOMIC_RELAXED);
+    }
+    pool->inject_tail = f;
+    mythread_mutex_unlock(&pool->inject_lock);
+}
+
+static mythread_future_t *inject_pop(mythread_pool_t *pool) {
+    /* Не берём мьютекс, если очередь заведомо пуста */
+    if (!__atomic_load_n(&pool->inject_head, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+
+    mythread_mutex_lock(&pool->inject_lock);
+    mythread_future_t *f = pool->inject_head;
+    if (f) {
+        pool->inject_head = f->next;
+        if (!pool->inject_head) {
+            pool->inject_tail = NULL;
+        }
+    }
+    mythread_mutex_unlock(&pool->inject_lock);
+    return f;
+}
+
+/* --- Поиск и выполнение задач --- */
+
+static int pool_has_work(mythread_pool_t *pool) {
+    if (__atomic_load_n(&pool->inject_head, __ATOMIC_RELAXED)) {
+        return 1;
+    }
+    for (int i = 0; i < pool->nworkers; i++) {
+        if (!deque_empty(&pool->workers[i].deque)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Своя дека, затем общая очередь, затем кража у остальных, начиная со случайного */
+static mythread_future_t *find_task(pool_worker_t *w) {
+    mythread_pool_t *pool = w->pool;
+    mythread_future_t *f = deque_take(&w->deque);
+    if (f) {
+        return f;
+    }
+    if ((f = inject_pop(pool)) != NULL) {
+        return f;
+    }
+
+    int n = pool->nworkers;
+    w->seed = w->seed * 1103515245u + 12345u;
+    int start = (int)((w->seed >> 16) % (unsigned)n);
+    for (int i = 0; i < n; i++) {
+        pool_worker_t *victim = &pool->workers[(start + i) % n];
+        if (victim == w) {
+            continue;
+        }
+        /* Проигранную гонку повторяем: у жертвы ещё есть задачи */
+        while ((f = deque_steal(&victim->deque)) == STEAL_ABORT) {
+            cpu_relax();
+        }
+        if (f) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+static void run_task(mythread_pool_t *pool, mythread_future_t *f) {
+    f->result = f->fn(f->arg);
+
+    /* После DONE future может быть уже освобождён ожидающим */
+    if (__atomic_exchange_n(&f->state, FUTURE_DONE, __ATOMIC_ACQ_REL) == FUTURE_WAITING) {
+        futex_wake(&f->state, INT_MAX);
+    }
+
+    if (__atomic_sub_fetch(&pool->outstanding, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&pool->waiters, __ATOMIC_SEQ_CST) > 0) {
+        futex_wake(&pool->outstanding, INT_MAX);
+    }
+}
+
+/* Будит один спящий поток, если такие есть */
+static void pool_notify(mythread_pool_t *pool) {
+    /* Пара к seq_cst-инкременту sleepers в worker_idle: кто-то из двоих увидит другого */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_RELAXED) > 0) {
+        __atomic_add_fetch(&pool->epoch, 1, __ATOMIC_RELEASE);
+        futex_wake(&pool->epoch, 1);
+    }
+}
+
+static void worker_idle(mythread_pool_t *pool) {
+    __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    int epoch = __atomic_load_n(&pool->epoch, __ATOMIC_ACQUIRE);
+
+    /* Перепроверка после объявления себя спящим: иначе можно проспать задачу */
+    if (!pool_has_work(pool) && !__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) {
+        futex_wait(&pool->epoch, epoch);
+    }
+    __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_RELAXED);
+}
+
+static void *worker_fn(void *arg) {
+    pool_worker_t *w = (pool_worker_t *)arg;
+    mythread_pool_t *pool = w->pool;
+
+    if (pool->local_queues) {
+        current_worker = w;
+    }
+
+    for (;;) {
+        mythread_future_t *f = find_task(w);
+        if (f) {
+            run_task(pool, f);
+            continue;
+        }
+        if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        worker_idle(pool);
+    }
+    return NULL;
+}
+
+/* --- Публичные функции --- */
+
+mythread_pool_t *mythread_pool_create(int nworkers) {
+    if (nworkers < 0 || nworkers > POOL_MAX_WORKERS) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (nworkers == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nworkers = ncpu > 0 ? (int)(ncpu < POOL_MAX_WORKERS ? ncpu : POOL_MAX_WORKERS) : 1;
+    }
+
+    mythread_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+    if (posix_memalign((void **)&pool->workers, 64, sizeof(pool_worker_t) * (size_t)nworkers) != 0) {
+        free(pool);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(pool->workers, 0, sizeof(pool_worker_t) * (size_t)nworkers);
+    mythread_mutex_init(&pool->inject_lock);
+    pool->nworkers = nworkers;
+    pool->local_queues = 1;
+
+    /* Свой TLS нужен, чтобы задача могла найти поток пула и его деку */
+    int flags = MYTHREAD_THREAD_GROUP;
+    for (int i = 0; i < nworkers; i++) {
+        pool_worker_t *w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i;
+        w->seed = (unsigned)i * 2654435761u + 1;
+
+        int ret = mythread_create_flags(&w->thread, worker_fn, w, flags);
+        if (ret != 0 && errno == ENOTSUP && i == 0) {
+            /* Нет своего TLS - все задачи идут через общую очередь */
+            flags = MYTHREAD_JOIN_FUTEX;
+            pool->local_queues = 0;
+            ret = mythread_create_flags(&w->thread, worker_fn, w, flags);
+        }
+        if (ret != 0) {
+            int saved = errno;
+            pool->nworkers = i;
+            mythread_pool_destroy(pool);
+            errno = saved;
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+int mythread_pool_submit(mythread_pool_t *pool,
+                         mythread_future_t *future,
+                         void *(*fn)(void *),
+                         void *arg) {
+    if (!pool || !future || !fn) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    future->fn = fn;
+    future->arg = arg;
+    future->result = NULL;
+    future->next = NULL;
+    future->state = FUTURE_PENDING;
+    __atomic_add_fetch(&pool->outstanding, 1, __ATOMIC_RELAXED);
+
+    /* Из задачи пула - в свою деку, чтобы задача осталась на этом ядре */
+    pool_worker_t *w = pool->local_queues ? current_worker : NULL;
+    if (!w || w->pool != pool || deque_push(&w->deque, future) != 0) {
+        inject_push(pool, future);
+    }
+
+    pool_notify(pool);
+    return 0;
+}
+
+int mythread_future_wait(mythread_future_t *future, void **retv) {
+    if (!future) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pool_worker_t *w = current_worker;
+    if (w) {
+        /* Поток пула не спит, а выполняет задачи, пока ждёт */
+        while (__atomic_load_n(&future->state, __ATOMIC_ACQUIRE) != FUTURE_DONE) {
+            mythread_future_t *f = find_task(w);
+            if (f) {
+                run_task(w->pool, f);
+            } else {
+                sched_yield();
+            }
+        }
+    } else {
+        int state = FUTURE_PENDING;
+        while (state != FUTURE_DONE) {
+            if (state == FUTURE_PENDING &&
+                !__atomic_compare_exchange_n(&future->state, &state, FUTURE_WAITING, 0,
+                                             __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+                continue;  /* state обновлён CAS */
+            }
+            futex_wait(&future->state, FUTURE_WAITING);
+            state = __atomic_load_n(&future->state, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    if (retv) {
+        *retv = future->result;
+    }
+    return 0;
+}
+
+int mythread_pool_wait(mythread_pool_t *pool) {
+    if (!pool) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (current_worker && current_worker->pool == pool) {
+        errno = EDEADLK;  /* Собственная задача никогда не завершится */
+        return -1;
+    }
+
+    __atomic_add_fetch(&pool->waiters, 1, __ATOMIC_SEQ_CST);
+    int n;
+    while ((n = __atomic_load_n(&pool->outstanding, __ATOMIC_SEQ_CST)) != 0) {
+        futex_wait(&pool->outstanding, n);
+    }
+    __atomic_sub_fetch(&pool->waiters, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int mythread_pool_destroy(mythread_pool_t *pool) {
+    if (!pool) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (current_worker && current_worker->pool == pool) {
+        errno = EDEADLK;
+        return -1;
+    }
+
+    /* Потоки выходят, только когда задач не осталось */
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&pool->epoch, 1, __ATOMIC_RELEASE);
+    futex_wake(&pool->epoch, INT_MAX);
+
+    int ret = 0;
+    for (int i = 0; i < pool->nworkers; i++) {
+        if (mythread_join(&pool->workers[i].thread, NULL) != 0) {
+            ret = -1;
+        }
+    }
+
+    free(pool->workers);
+    free(pool);
+    return ret;
+}
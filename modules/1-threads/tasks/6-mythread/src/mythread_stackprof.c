@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+
+#include "mythread.h"
+#include "stackprof.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <unistd.h>
+
+/*
+ * Сводка по start_routine: сколько потоков, максимальная и средняя
+ * глубина стека. Пишется при join (и сборщиком отсоединённых потоков),
+ * поэтому обычный мьютекс не мешает - профиль и так дорогой.
+ */
+
+#define STACKPROF_PATTERN 0x5a5a5a5a5a5a5a5aULL
+#define STACKPROF_ROUTINES 64   /* Когда таблица заполнена, остальные идут в "other" */
+
+typedef struct {
+    void *(*fn)(void *);
+    size_t threads;
+    size_t max_peak;
+    size_t total_peak;
+    size_t stack_size;     /* Наибольший доступный стек среди этих потоков */
+} stackprof_entry_t;
+
+static struct {
+    mythread_mutex_t  lock;
+    size_t            used;
+    stackprof_entry_t entries[STACKPROF_ROUTINES + 1];  /* Последняя - "other" */
+} prof = { .lock = MYTHREAD_MUTEX_INITIALIZER };
+
+int stackprof_forced;
+
+void stackprof_fill(char *base, char *top) {
+    memset(base, 0x5a, (size_t)(top - base));
+}
+
+size_t stackprof_peak(const char *base, const char *top) {
+    const uint64_t *word = (const uint64_t *)(((uintptr_t)base + 7) & ~(uintptr_t)7);
+    const uint64_t *end = (const uint64_t *)((uintptr_t)top & ~(uintptr_t)7);
+
+    /* Стек растёт вниз: нетронутый шаблон лежит внизу */
+    while (word < end && *word == STACKPROF_PATTERN) {
+        word++;
+    }
+    return (size_t)(top - (const char *)word);
+}
+
+void stackprof_record(void *(*start_routine)(void *), size_t peak, size_t size) {
+    mythread_mutex_lock(&prof.lock);
+
+    stackprof_entry_t *e = NULL;
+    for (size_t i = 0; i < prof.used; i++) {
+        if (prof.entries[i].fn == start_routine) {
+            e = &prof.entries[i];
+            break;
+        }
+    }
+    if (!e && prof.used < STACKPROF_ROUTINES) {
+        e = &prof.entries[prof.used++];
+        e->fn = start_routine;
+    } else if (!e) {
+        e = &prof.entries[STACKPROF_ROUTINES];
+    }
+
+    e->threads++;
+    e->total_peak += peak;
+    if (peak > e->max_peak) {
+        e->max_peak = peak;
+    }
+    if (size > e->stack_size) {
+        e->stack_size = size;
+    }
+
+    mythread_mutex_unlock(&prof.lock);
+}
+
+/* Имя функции из таблицы символов (у исполняемого файла - только с -rdynamic) */
+static const char *routine_name(void *(*fn)(void *), char *buf, size_t len) {
+    Dl_info info;
+    if (dladdr((void *)fn, &info) && info.dli_sname) {
+        return info.dli_sname;
+    }
+    snprintf(buf, len, "%p", (void *)fn);
+    return buf;
+}
+
+int mythread_stack_report(int fd) {
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    mythread_mutex_lock(&prof.lock);
+    dprintf(fd, "%-32s %8s %12s %12s %12s\n",
+            "start_routine", "threads", "max bytes", "avg bytes", "stack bytes");
+
+    for (size_t i = 0; i <= STACKPROF_ROUTINES; i++) {
+        const stackprof_entry_t *e = &prof.entries[i];
+        if (e->threads == 0) {
+            continue;
+        }
+        char buf[32];
+        const char *name = i == STACKPROF_ROUTINES ? "other" : routine_name(e->fn, buf, sizeof(buf));
+        dprintf(fd, "%-32s %8zu %12zu %12zu %12zu\n",
+                name, e->threads, e->max_peak, e->total_peak / e->threads, e->stack_size);
+    }
+
+    mythread_mutex_unlock(&prof.lock);
+    return 0;
+}
+
+/* MYTHREAD_STACK_PROFILE=1 - профиль всех потоков, сводка в stderr при выходе */
+static void stackprof_report_at_exit(void) {
+    mythread_stack_report(STDERR_FILENO);
+}
+
+__attribute__((constructor))
+static void stackprof_init(void) {
+    const char *env = getenv("MYTHREAD_STACK_PROFILE");
+    if (env && *env && strcmp(env, "0") != 0) {
+        stackprof_forced = 1;
+        atexit(stackprof_report_at_exit);
+    }
+}
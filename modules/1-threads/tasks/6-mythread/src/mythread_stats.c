@@ -0,0 +1,122 @@
+#define _GNU_SOURCE
+
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+/* Часы CPU чужого потока - как MAKE_THREAD_CPUCLOCK ядра (CPUCLOCK_SCHED) */
+#define THREAD_CPUCLOCK(tid)  ((~(clockid_t)(tid) << 3) | 6)
+#define PROCESS_CPUCLOCK(pid) ((~(clockid_t)(pid) << 3) | 2)
+
+static uint64_t timespec_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000000ull + (uint64_t)ts->tv_nsec;
+}
+
+static uint64_t timeval_ns(const struct timeval *tv) {
+    return (uint64_t)tv->tv_sec * 1000000000ull + (uint64_t)tv->tv_usec * 1000ull;
+}
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_ns(&ts);
+}
+
+void stats_capture(mythread_stats_t *out) {
+    struct rusage ru;
+    struct timespec cpu;
+
+    memset(out, 0, sizeof(*out));
+    if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+        out->user_ns = timeval_ns(&ru.ru_utime);
+        out->sys_ns = timeval_ns(&ru.ru_stime);
+        out->voluntary_switches = ru.ru_nvcsw;
+        out->involuntary_switches = ru.ru_nivcsw;
+        out->minor_faults = ru.ru_minflt;
+        out->major_faults = ru.ru_majflt;
+    }
+    /* getrusage считает время тиками, часы потока - точно */
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu) == 0) {
+        out->cpu_ns = timespec_ns(&cpu);
+    } else {
+        out->cpu_ns = out->user_ns + out->sys_ns;
+    }
+}
+
+/* /proc/<...>/stat: minflt, majflt, utime, stime (поля 10, 12, 14, 15) */
+static int read_stat(const char *dir, mythread_stats_t *out) {
+    char path[64];
+    char buf[512];
+
+    snprintf(path, sizeof(path), "%s/stat", dir);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+
+    /* Имя команды может содержать пробелы и скобки - поля идут после последней ')' */
+    char *p = strrchr(buf, ')');
+    unsigned long minflt, majflt, utime, stime;
+    if (!p || sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %lu %*u %lu %*u %lu %lu",
+                     &minflt, &majflt, &utime, &stime) != 4) {
+        errno = EIO;
+        return -1;
+    }
+
+    uint64_t tick_ns = 1000000000ull / (uint64_t)sysconf(_SC_CLK_TCK);
+    out->minor_faults = (long)minflt;
+    out->major_faults = (long)majflt;
+    out->user_ns = utime * tick_ns;
+    out->sys_ns = stime * tick_ns;
+    return 0;
+}
+
+/* /proc/<...>/status: voluntary_ctxt_switches, nonvoluntary_ctxt_switches */
+static int read_status(const char *dir, mythread_stats_t *out) {
+    char path[64];
+    char line[128];
+
+    snprintf(path, sizeof(path), "%s/status", dir);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        sscanf(line, "voluntary_ctxt_switches: %ld", &out->voluntary_switches);
+        sscanf(line, "nonvoluntary_ctxt_switches: %ld", &out->involuntary_switches);
+    }
+    fclose(f);
+    return 0;
+}
+
+int stats_read_live(int pid, int group, mythread_stats_t *out) {
+    char dir[48];
+    struct timespec cpu;
+
+    memset(out, 0, sizeof(*out));
+    if (group) {
+        snprintf(dir, sizeof(dir), "/proc/self/task/%d", pid);
+    } else {
+        snprintf(dir, sizeof(dir), "/proc/%d/task/%d", pid, pid);
+    }
+    if (read_stat(dir, out) == -1 || read_status(dir, out) == -1) {
+        errno = ESRCH;
+        return -1;
+    }
+
+    /* Точное время CPU, если часы ещё доступны */
+    clockid_t clock = group ? THREAD_CPUCLOCK(pid) : PROCESS_CPUCLOCK(pid);
+    if (clock_gettime(clock, &cpu) == 0) {
+        out->cpu_ns = timespec_ns(&cpu);
+    } else {
+        out->cpu_ns = out->user_ns + out->sys_ns;
+    }
+    return 0;
+}
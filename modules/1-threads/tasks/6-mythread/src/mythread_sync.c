@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+
+#include "mythread.h"
+#include "futex.h"
+#include <errno.h>
+#include <unistd.h>
+
+/*
+ * Примитивы синхронизации на futex.
+ *
+ * Мьютекс - классическая схема из "Futexes Are Tricky" (Drepper):
+ *   0 - свободен, 1 - захвачен, 2 - захвачен и есть ожидающие.
+ * Без конкуренции lock/unlock - одна атомарная операция без системных
+ * вызовов. При конкуренции сначала крутимся (если ядер больше одного),
+ * потом засыпаем в FUTEX_WAIT.
+ */
+
+#define MUTEX_UNLOCKED  0
+#define MUTEX_LOCKED    1
+#define MUTEX_CONTENDED 2
+
+#define MUTEX_SPIN_COUNT 100  /* Итераций активного ожидания перед сном */
+
+/* Имеет ли смысл крутиться: на одном ядре владелец не отпустит мьютекс, пока мы крутимся */
+static int spin_enabled(void) {
+    static volatile int ncpu = 0;
+    int n = __atomic_load_n(&ncpu, __ATOMIC_RELAXED);
+    if (n == 0) {
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        __atomic_store_n(&ncpu, n > 0 ? n : 1, __ATOMIC_RELAXED);
+    }
+    return n > 1;
+}
+
+/* --- Мьютекс --- */
+
+int mythread_mutex_init(mythread_mutex_t *mutex) {
+    if (!mutex) {
+        errno = EINVAL;
+        return -1;
+    }
+    mutex->state = MUTEX_UNLOCKED;
+    return 0;
+}
+
+int mythread_mutex_trylock(mythread_mutex_t *mutex) {
+    int expected = MUTEX_UNLOCKED;
+    if (__atomic_compare_exchange_n(&mutex->state, &expected, MUTEX_LOCKED, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    errno = EBUSY;
+    return -1;
+}
+
+int mythread_mutex_lock(mythread_mutex_t *mutex) {
+    /* Быстрый путь: мьютекс свободен */
+    int state = MUTEX_UNLOCKED;
+    if (__atomic_compare_exchange_n(&mutex->state, &state, MUTEX_LOCKED, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
+    /* Адаптивное ожидание: владелец, скорее всего, скоро отпустит */
+    if (spin_enabled()) {
+        for (int i = 0; i < MUTEX_SPIN_COUNT; i++) {
+            cpu_relax();
+            state = __atomic_load_n(&mutex->state, __ATOMIC_RELAXED);
+            if (state == MUTEX_UNLOCKED &&
+                __atomic_compare_exchange_n(&mutex->state, &state, MUTEX_LOCKED, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return 0;
+            }
+            if (state == MUTEX_CONTENDED) {
+                break;  /* Уже есть спящие - крутиться бесполезно */
+            }
+        }
+    }
+
+    /* Медленный путь: помечаем, что есть ожидающие, и спим */
+    while (__atomic_exchange_n(&mutex->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE) != MUTEX_UNLOCKED) {
+        futex_wait(&mutex->state, MUTEX_CONTENDED);
+    }
+    return 0;
+}
+
+int mythread_mutex_unlock(mythread_mutex_t *mutex) {
+    /* Будим одного, только если кто-то мог уснуть */
+    if (__atomic_exchange_n(&mutex->state, MUTEX_UNLOCKED, __ATOMIC_RELEASE) == MUTEX_CONTENDED) {
+        futex_wake(&mutex->state, 1);
+    }
+    return 0;
+}
+
+/* --- Условная переменная --- */
+
+/*
+ * Счётчик последовательности: signal/broadcast увеличивают его и будят,
+ * wait засыпает, пока счётчик равен значению, прочитанному под мьютексом.
+ * Так сигнал между unlock и FUTEX_WAIT не теряется.
+ */
+
+int mythread_cond_init(mythread_cond_t *cond) {
+    if (!cond) {
+        errno = EINVAL;
+        return -1;
+    }
+    cond->seq = 0;
+    return 0;
+}
+
+int mythread_cond_wait(mythread_cond_t *cond, mythread_mutex_t *mutex) {
+    int seq = __atomic_load_n(&cond->seq, __ATOMIC_RELAXED);
+
+    mythread_mutex_unlock(mutex);
+    futex_wait(&cond->seq, seq);
+
+    /*
+     * После пробуждения сразу ставим CONTENDED: рядом могут быть
+     * другие разбуженные, и unlock должен будет их разбудить.
+     */
+    while (__atomic_exchange_n(&mutex->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE) != MUTEX_UNLOCKED) {
+        futex_wait(&mutex->state, MUTEX_CONTENDED);
+    }
+    return 0;
+}
+
+int mythread_cond_signal(mythread_cond_t *cond) {
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&cond->seq, 1);
+    return 0;
+}
+
+int mythread_cond_broadcast(mythread_cond_t *cond) {
+    __atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&cond->seq, INT_MAX);
+    return 0;
+}
+
+/* --- Барьер --- */
+
+/*
+ * Последний пришедший обнуляет счётчик и увеличивает поколение,
+ * остальные спят на поколении. Обнуление идёт до смены поколения,
+ * поэтому барьер можно сразу использовать повторно.
+ */
+
+int mythread_barrier_init(mythread_barrier_t *barrier, unsigned count) {
+    if (!barrier || count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    barrier->count = count;
+    barrier->arrived = 0;
+    barrier->generation = 0;
+    return 0;
+}
+
+int mythread_barrier_wait(mythread_barrier_t *barrier) {
+    int generation = __atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE);
+
+    if (__atomic_add_fetch(&barrier->arrived, 1, __ATOMIC_ACQ_REL) == barrier->count) {
+        __atomic_store_n(&barrier->arrived, 0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&barrier->generation, 1, __ATOMIC_RELEASE);
+        futex_wake(&barrier->generation, INT_MAX);
+        return MYTHREAD_BARRIER_SERIAL_THREAD;
+    }
+
+    while (__atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE) == generation) {
+        futex_wait(&barrier->generation, generation);
+    }
+    return 0;
+}
@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+
+#include "mythread.h"
+#include "trace.h"
+#include <stdio.h>
+#include <errno.h>
+
+#ifdef MYTHREAD_TRACE
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/*
+ * Трассировка без блокировок.
+ *
+ * Каждый контекст TLS пишет в своё кольцо: потоки со своим TLS
+ * (MYTHREAD_PRIVATE_TLS, main) - каждый в своё, потоки, делящие TLS
+ * создателя, - в кольцо создателя. Место в кольце занимается одним
+ * fetch_add, поэтому общее кольцо тоже корректно, просто с конкуренцией.
+ * Заполненное кольцо идёт по кругу и затирает самые старые события:
+ * концы отрезков, чьи начала затёрты, выгрузка пропускает.
+ *
+ * Кольца берутся из статического пула. Поток со своим TLS при выходе
+ * возвращает кольцо в список свободных, и его берёт следующий поток -
+ * старые события остаются в нём, пока их не затрут новые.
+ */
+
+#define TRACE_RING_SIZE 4096   /* Событий в кольце (степень двойки) */
+#define TRACE_MAX_RINGS 256    /* Когда пул и список свободных кончатся, все пишут в последнее кольцо */
+
+typedef struct {
+    uint64_t ts;      /* Нс по CLOCK_MONOTONIC */
+    int32_t  tid;     /* Поток, о котором событие */
+    int32_t  type;    /* TRACE_* (0 - слот ещё не записан) */
+} trace_event_t;
+
+typedef struct {
+    volatile uint64_t head;  /* Сколько событий пришло; сверх TRACE_RING_SIZE - затёрты */
+    unsigned          next_free;  /* Следующее в списке свободных (номер + 1) */
+    trace_event_t     events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+/* Событие при выгрузке */
+typedef struct {
+    trace_event_t e;
+    int paired;   /* Предыдущее событие того же потока открыло отрезок, который это закрывает */
+    int closed;   /* Следующее событие того же потока закрывает отрезок, который это открыло */
+} dump_event_t;
+
+static trace_ring_t trace_rings[TRACE_MAX_RINGS];
+static volatile unsigned trace_rings_used;
+
+/* Вершина списка свободных колец: младшие 32 бита - номер + 1, старшие - счётчик против ABA */
+static volatile uint64_t trace_free;
+
+static __thread trace_ring_t *trace_ring __attribute__((tls_model("initial-exec")));
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);  /* vDSO, без системного вызова */
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int trace_self_tid(void) {
+    return (int)syscall(SYS_gettid);
+}
+
+static trace_ring_t *ring_acquire(void) {
+    uint64_t top = __atomic_load_n(&trace_free, __ATOMIC_ACQUIRE);
+    while ((uint32_t)top != 0) {
+        trace_ring_t *ring = &trace_rings[(uint32_t)top - 1];
+        uint64_t next = ((top >> 32) + 1) << 32 | ring->next_free;
+        if (__atomic_compare_exchange_n(&trace_free, &top, next, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return ring;
+        }
+    }
+
+    unsigned i = __atomic_fetch_add(&trace_rings_used, 1, __ATOMIC_RELAXED);
+    if (i >= TRACE_MAX_RINGS) {
+        i = TRACE_MAX_RINGS - 1;
+    }
+    return &trace_rings[i];
+}
+
+void trace_record(int type, int tid, uint64_t ts) {
+    trace_ring_t *ring = trace_ring;
+    if (!ring) {
+        ring = trace_ring = ring_acquire();
+    }
+
+    uint64_t slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    trace_event_t *e = &ring->events[slot & (TRACE_RING_SIZE - 1)];
+    __atomic_store_n(&e->type, 0, __ATOMIC_RELAXED);  /* Пока слот пишется, выгрузка его пропустит */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    e->ts = ts;
+    e->tid = tid;
+    __atomic_store_n(&e->type, type, __ATOMIC_RELEASE);  /* type пишется последним */
+}
+
+void trace_release(void) {
+    trace_ring_t *ring = trace_ring;
+    trace_ring = NULL;
+    /* Последнее кольцо может быть общим для нескольких потоков - его не отдаём */
+    if (!ring || ring == &trace_rings[TRACE_MAX_RINGS - 1]) {
+        return;
+    }
+
+    uint64_t top = __atomic_load_n(&trace_free, __ATOMIC_RELAXED);
+    uint64_t next;
+    do {
+        ring->next_free = (uint32_t)top;
+        next = ((top >> 32) + 1) << 32 | (uint64_t)(ring - trace_rings + 1);
+    } while (!__atomic_compare_exchange_n(&trace_free, &top, next, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static int cmp_event(const void *a, const void *b) {
+    const trace_event_t *x = &((const dump_event_t *)a)->e;
+    const trace_event_t *y = &((const dump_event_t *)b)->e;
+    return (x->ts > y->ts) - (x->ts < y->ts);
+}
+
+static int cmp_tid_event(const void *a, const void *b) {
+    const trace_event_t *x = &((const dump_event_t *)a)->e;
+    const trace_event_t *y = &((const dump_event_t *)b)->e;
+    if (x->tid != y->tid) {
+        return (x->tid > y->tid) - (x->tid < y->tid);
+    }
+    return (x->ts > y->ts) - (x->ts < y->ts);
+}
+
+/* Пишет одно событие Chrome trace (ph: B - начало отрезка, E - конец) */
+static void emit(FILE *out, int *first, const char *name, char ph, const trace_event_t *e) {
+    fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+            *first ? "" : ",", name, ph, (int)getpid(), e->tid, e->ts / 1000.0);
+    *first = 0;
+}
+
+int mythread_trace_dump(const char *path) {
+    if (!path) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Собираем все записанные события (и из свободных колец) и упорядочиваем по времени */
+    unsigned nrings = __atomic_load_n(&trace_rings_used, __ATOMIC_RELAXED);
+    if (nrings > TRACE_MAX_RINGS) {
+        nrings = TRACE_MAX_RINGS;
+    }
+    dump_event_t *all = malloc(sizeof(dump_event_t) * TRACE_RING_SIZE * (nrings ? nrings : 1));
+    if (!all) {
+        return -1;
+    }
+
+    /*
+     * Затёртые события старше всех уцелевших в своём кольце. После horizon -
+     * самого позднего из "старейших уцелевших" переполненных колец - трасса
+     * полная, до него у отрезка мог пропасть конец
+     */
+    size_t count = 0;
+    uint64_t dropped = 0, horizon = 0;
+    for (unsigned r = 0; r < nrings; r++) {
+        trace_ring_t *ring = &trace_rings[r];
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        uint64_t n = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+        uint64_t oldest = UINT64_MAX;
+        dropped += head - n;
+        for (uint64_t k = 0; k < n; k++) {
+            trace_event_t *e = &ring->events[k];
+            int type = __atomic_load_n(&e->type, __ATOMIC_ACQUIRE);
+            if (type == 0) {
+                continue;
+            }
+            all[count].e = *e;
+            /* Слот могли затереть, пока копировали */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&e->type, __ATOMIC_RELAXED) != type) {
+                continue;
+            }
+            all[count].e.type = type;
+            all[count].paired = 0;
+            all[count].closed = 0;
+            if (all[count].e.ts < oldest) {
+                oldest = all[count].e.ts;
+            }
+            count++;
+        }
+        if (head > n && oldest != UINT64_MAX && oldest > horizon) {
+            horizon = oldest;
+        }
+    }
+
+    /*
+     * Конец отрезка пишется, только если его начало - предыдущее событие
+     * того же потока: начало могло быть затёрто в кольце, а незакрытое
+     * "E" просмотрщики рисуют сломанным отрезком. Начало без конца до
+     * horizon тоже пропускается - конец мог быть затёрт; после horizon это
+     * ещё идущий отрезок. Номер потока после его завершения может достаться
+     * новому - цепочка тогда начнётся с create
+     */
+    qsort(all, count, sizeof(dump_event_t), cmp_tid_event);
+    for (size_t i = 1; i < count; i++) {
+        all[i].paired = all[i - 1].e.tid == all[i].e.tid &&
+                        all[i - 1].e.type == all[i].e.type - 1;
+        all[i - 1].closed = all[i].paired;
+    }
+    qsort(all, count, sizeof(dump_event_t), cmp_event);
+
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        free(all);
+        return -1;
+    }
+
+    /*
+     * Дорожка на каждый поток: spawn (create -> start), run (start -> finish),
+     * unjoined (finish -> join). Длина spawn - задержка запуска потока.
+     */
+    int first = 1;
+    fprintf(out, "{\"traceEvents\":[");
+    for (size_t i = 0; i < count; i++) {
+        const trace_event_t *e = &all[i].e;
+        int paired = all[i].paired;
+        int open = all[i].closed || e->ts >= horizon;
+        switch (e->type) {
+        case TRACE_CREATE:
+            if (open) {
+                emit(out, &first, "spawn", 'B', e);
+            }
+            break;
+        case TRACE_START:
+            if (paired) {
+                emit(out, &first, "spawn", 'E', e);
+            }
+            if (open) {
+                emit(out, &first, "run", 'B', e);
+            }
+            break;
+        case TRACE_FINISH:
+            if (paired) {
+                emit(out, &first, "run", 'E', e);
+            }
+            if (open) {
+                emit(out, &first, "unjoined", 'B', e);
+            }
+            break;
+        case TRACE_JOIN:
+            if (paired) {
+                emit(out, &first, "unjoined", 'E', e);
+            }
+            break;
+        }
+    }
+    /* Затёртые при переполнении колец события - в метаданных трассы */
+    fprintf(out, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped_events\":%llu}}\n",
+            (unsigned long long)dropped);
+
+    free(all);
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+/* MYTHREAD_TRACE_FILE=путь - сбросить трассу при выходе из программы */
+static void trace_dump_at_exit(void) {
+    const char *path = getenv("MYTHREAD_TRACE_FILE");
+    if (path && mythread_trace_dump(path) == -1) {
+        perror("mythread_trace_dump");
+    }
+}
+
+__attribute__((constructor))
+static void trace_init(void) {
+    if (getenv("MYTHREAD_TRACE_FILE")) {
+        atexit(trace_dump_at_exit);
+    }
+}
+
+#else
+
+int mythread_trace_dump(const char *path) {
+    (void)path;
+    errno = ENOTSUP;  /* Библиотека собрана без MYTHREAD_TRACE */
+    return -1;
+}
+
+#endif /* MYTHREAD_TRACE */
@@ -0,0 +1,26 @@
+#ifndef MYTHREAD_STACKPROF_H
+#define MYTHREAD_STACKPROF_H
+
+/*
+ * Профиль использования стека - не входит в публичный API.
+ *
+ * Перед запуском потока свободная часть стека заполняется шаблоном,
+ * после завершения снизу ищется первое затёртое слово: всё выше него
+ * поток хотя бы раз использовал.
+ */
+
+#include <stddef.h>
+
+/* MYTHREAD_STACK_PROFILE=1 в окружении - профиль для всех потоков */
+extern int stackprof_forced;
+
+/* Заполняет [base, top) шаблоном */
+void stackprof_fill(char *base, char *top);
+
+/* Максимальная глубина стека [base, top) в байтах */
+size_t stackprof_peak(const char *base, const char *top);
+
+/* Добавляет завершившийся поток в сводку по start_routine */
+void stackprof_record(void *(*start_routine)(void *), size_t peak, size_t size);
+
+#endif /* MYTHREAD_STACKPROF_H */
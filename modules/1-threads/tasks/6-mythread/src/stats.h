@@ -0,0 +1,23 @@
+#ifndef MYTHREAD_STATS_H
+#define MYTHREAD_STATS_H
+
+/*
+ * Учёт ресурсов потока - не входит в публичный API.
+ */
+
+#include "mythread.h"
+#include <stdint.h>
+
+/* CLOCK_MONOTONIC в нс (vDSO, без системного вызова) */
+uint64_t stats_now(void);
+
+/* Счётчики вызывающего потока: getrusage(RUSAGE_THREAD) + свои часы CPU */
+void stats_capture(mythread_stats_t *out);
+
+/* 
+ * Счётчики работающего потока из /proc. group - поток группы (CLONE_THREAD),
+ * иначе поток - отдельный процесс. -1 с ESRCH, если поток уже вышел.
+ */
+int stats_read_live(int pid, int group, mythread_stats_t *out);
+
+#endif /* MYTHREAD_STATS_H */
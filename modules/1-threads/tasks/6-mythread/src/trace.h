@@ -0,0 +1,44 @@
+#ifndef MYTHREAD_TRACE_H
+#define MYTHREAD_TRACE_H
+
+/*
+ * Внутренняя трассировка - не входит в публичный API.
+ *
+ * Собирается только с -DMYTHREAD_TRACE (make trace). В обычной сборке
+ * макросы раскрываются в пустоту и аргументы не вычисляются.
+ */
+
+#include <stdint.h>
+
+/* Типы событий. Поток, к которому относится событие, - всегда tid созданного */
+enum {
+    TRACE_CREATE = 1,  /* Создатель вошёл в clone (время - до системного вызова) */
+    TRACE_START,       /* Поток начал выполнять обёртку, до start_routine */
+    TRACE_FINISH,      /* start_routine вернула результат */
+    TRACE_JOIN,        /* Создатель забрал результат (отсоединённый поток - сам, после finish) */
+};
+
+#ifdef MYTHREAD_TRACE
+
+uint64_t trace_now(void);
+void trace_record(int type, int tid, uint64_t ts);
+int trace_self_tid(void);
+void trace_release(void);
+
+#define TRACE_TIMESTAMP(var)            uint64_t var = trace_now()
+#define TRACE_SELF(var)                 int var = trace_self_tid()
+#define TRACE_EVENT_AT(type, tid, ts)   trace_record((type), (tid), (ts))
+#define TRACE_EVENT(type, tid)          trace_record((type), (tid), trace_now())
+#define TRACE_RELEASE()                 trace_release()  /* Поток со своим TLS выходит - кольцо свободно */
+
+#else
+
+#define TRACE_TIMESTAMP(var)            ((void)0)
+#define TRACE_SELF(var)                 ((void)0)
+#define TRACE_EVENT_AT(type, tid, ts)   ((void)0)
+#define TRACE_EVENT(type, tid)          ((void)0)
+#define TRACE_RELEASE()                 ((void)0)
+
+#endif /* MYTHREAD_TRACE */
+
+#endif /* MYTHREAD_TRACE_H */
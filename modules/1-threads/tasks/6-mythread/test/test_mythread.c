@@ -1,10 +1,19 @@
+#define _GNU_SOURCE
+
 #include "mythread.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
-#include <pthread.h>  /* Для pthread_mutex - синхронизация между потоками */
+#include <time.h>
+#include <signal.h>
+#include <sched.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 /* Цвета для вывода */
 #define COLOR_GREEN  "\033[0;32m"
@@ -18,7 +27,7 @@
 
 /* Глобальный счётчик для теста синхронизации */
 static int global_counter = 0;
-static pthread_mutex_t counter_mutex = PTHREAD_MUTEX_INITIALIZER;
+static mythread_mutex_t counter_mutex = MYTHREAD_MUTEX_INITIALIZER;
 
 /* --- Тест 1: Базовое создание и join --- */
 void *simple_thread_fn(void *arg) {
@@ -58,9 +67,9 @@ void *counter_thread_fn(void *arg) {
     int thread_id = (int)(long)arg;  // Передаём ID по значению, не по указателю
     
     for (int i = 0; i < 100; i++) {
-        pthread_mutex_lock(&counter_mutex);
+        mythread_mutex_lock(&counter_mutex);
         global_counter++;
-        pthread_mutex_unlock(&counter_mutex);
+        mythread_mutex_unlock(&counter_mutex);
     }
     
     printf("  [Thread %d] Finished incrementing\n", thread_id);
@@ -218,6 +227,7 @@ int test_sequential_creation(void) {
 
 /* --- Тест 6: Стресс-тест с большим количеством потоков --- */
 #define STRESS_THREADS 50
+#define RATE_ITERATIONS 500
 
 void *stress_thread_fn(void *arg) {
     int id = *(int *)arg;
@@ -226,6 +236,33 @@ void *stress_thread_fn(void *arg) {
     return NULL;
 }
 
+/* Время в секундах по монотонным часам */
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Скорость create+join (потоков в секунду), -1 при ошибке */
+static double measure_create_join_rate(int iterations) {
+    int id = 0;
+    double start = now_sec();
+
+    for (int i = 0; i < iterations; i++) {
+        mythread_t thread;
+        if (mythread_create(&thread, stress_thread_fn, &id) != 0) {
+            perror("  mythread_create");
+            return -1;
+        }
+        if (mythread_join(&thread, NULL) != 0) {
+            perror("  mythread_join");
+            return -1;
+        }
+    }
+
+    return iterations / (now_sec() - start);
+}
+
 int test_stress(void) {
     TEST_INFO("Test 6: Stress test (%d threads)", STRESS_THREADS);
     
@@ -257,8 +294,18 @@ int test_stress(void) {
     }
     
     printf("  [Main] Created: %d, Joined: %d\n", created, joined);
+
+    /* Скорость create+join без кэша стеков (mmap/munmap на каждый поток) и с ним */
+    size_t old_limit = mythread_stack_cache_set_limit(0);
+    double rate_uncached = measure_create_join_rate(RATE_ITERATIONS);
+    mythread_stack_cache_set_limit(old_limit);
+    double rate_cached = measure_create_join_rate(RATE_ITERATIONS);
+
+    printf("  [Main] create+join rate: %.0f threads/s without stack cache, "
+           "%.0f threads/s with stack cache\n", rate_uncached, rate_cached);
     
-    if (created == STRESS_THREADS && joined == STRESS_THREADS) {
+    if (created == STRESS_THREADS && joined == STRESS_THREADS &&
+        rate_uncached > 0 && rate_cached > 0) {
         TEST_PASS("Stress test");
         return 0;
     } else {
@@ -267,6 +314,999 @@ int test_stress(void) {
     }
 }
 
+/* --- Тест 7: join через futex, в том числе из другого потока --- */
+void *futex_target_fn(void *arg) {
+    usleep(100000);  /* 100ms - чтобы join действительно ждал */
+    return arg;
+}
+
+void *futex_joiner_fn(void *arg) {
+    mythread_t *target = (mythread_t *)arg;
+    void *result = NULL;
+
+    /* Ждём поток, который создал не мы, а main */
+    if (mythread_join(target, &result) != 0) {
+        perror("  mythread_join (from joiner)");
+        return NULL;
+    }
+    return result;
+}
+
+int test_futex_join(void) {
+    TEST_INFO("Test 7: Futex join (MYTHREAD_JOIN_FUTEX)");
+
+    mythread_t target, joiner;
+    int ret = mythread_create_flags(&target, futex_target_fn, (void *)"futex result",
+                                    MYTHREAD_JOIN_FUTEX);
+    if (ret != 0) {
+        perror("  mythread_create_flags");
+        TEST_FAIL("Futex join");
+        return -1;
+    }
+
+    ret = mythread_create_flags(&joiner, futex_joiner_fn, &target, MYTHREAD_JOIN_FUTEX);
+    if (ret != 0) {
+        perror("  mythread_create_flags");
+        mythread_join(&target, NULL);
+        TEST_FAIL("Futex join");
+        return -1;
+    }
+
+    char *result = NULL;
+    ret = mythread_join(&joiner, (void **)&result);
+    if (ret != 0 || !result || strcmp(result, "futex result") != 0) {
+        TEST_FAIL("Futex join");
+        return -1;
+    }
+
+    printf("  [Main] Joiner thread received: %s\n", result);
+    TEST_PASS("Futex join");
+    return 0;
+}
+
+/* --- Тест 8: поток группы со своим TLS --- */
+#define TLS_THREADS 4
+
+static __thread int tls_value = 42;  /* Инициализированная TLS-переменная (.tdata) */
+
+void *tls_thread_fn(void *arg) {
+    int id = (int)(long)arg;
+
+    /* У каждого потока своя копия с начальным значением */
+    if (tls_value != 42) {
+        return (void *)-1L;
+    }
+
+    tls_value = id;
+    errno = 1000 + id;
+    usleep(50000);  /* Даём остальным потокам записать свои значения */
+
+    char *buf = malloc(64);  /* malloc с собственным TLS */
+    if (!buf) {
+        return (void *)-1L;
+    }
+    snprintf(buf, 64, "thread %d", id);
+    free(buf);
+
+    if (tls_value != id || errno != 1000 + id) {
+        return (void *)-1L;
+    }
+    return (void *)(long)id;
+}
+
+/* Рекурсивный мьютекс glibc узнаёт владельца по tid в TCB потока */
+static pthread_mutex_t tls_rmutex;
+static volatile int tls_rmutex_held = 0;
+static volatile int tls_rmutex_release = 0;
+
+void *tls_rmutex_fn(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&tls_rmutex);
+    tls_rmutex_held = 1;
+    while (!tls_rmutex_release) {
+        usleep(1000);
+    }
+    pthread_mutex_unlock(&tls_rmutex);
+    return NULL;
+}
+
+/* Кэш malloc выходящего потока должен вернуться в арену */
+#define TLS_CHURN_THREADS 200
+
+void *tls_churn_fn(void *arg) {
+    (void)arg;
+    void *p[64];
+    for (int i = 0; i < 64; i++) {
+        p[i] = malloc(16 * i + 8);
+    }
+    for (int i = 0; i < 64; i++) {
+        free(p[i]);
+    }
+    return NULL;
+}
+
+static int private_tls_owner_and_tcache(void) {
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&tls_rmutex, &mattr);
+
+    mythread_t thread;
+    if (mythread_create_flags(&thread, tls_rmutex_fn, NULL, MYTHREAD_THREAD_GROUP) != 0) {
+        return -1;
+    }
+    while (!tls_rmutex_held) {
+        usleep(1000);
+    }
+    int ret = pthread_mutex_trylock(&tls_rmutex);
+    if (ret == 0) {
+        pthread_mutex_unlock(&tls_rmutex);
+    }
+    tls_rmutex_release = 1;
+    mythread_join(&thread, NULL);
+    printf("  [Main] trylock of a mutex held by the thread: %s\n",
+           ret == EBUSY ? "EBUSY" : "acquired");
+    if (ret != EBUSY) {
+        return -1;
+    }
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    /* Первые потоки заводят арены - считаем после них */
+    for (int i = 0; i < 16; i++) {
+        mythread_create_flags(&thread, tls_churn_fn, NULL, MYTHREAD_THREAD_GROUP);
+        mythread_join(&thread, NULL);
+    }
+    size_t before = mallinfo2().uordblks;
+    for (int i = 0; i < TLS_CHURN_THREADS; i++) {
+        mythread_create_flags(&thread, tls_churn_fn, NULL, MYTHREAD_THREAD_GROUP);
+        mythread_join(&thread, NULL);
+    }
+    long grown = (long)(mallinfo2().uordblks - before);
+    printf("  [Main] heap in use after %d threads: %+ld bytes\n", TLS_CHURN_THREADS, grown);
+    if (grown > 64 * 1024) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+int test_private_tls(void) {
+    TEST_INFO("Test 8: Thread group with private TLS (MYTHREAD_THREAD_GROUP)");
+
+    mythread_t threads[TLS_THREADS];
+    int created = 0;
+
+    errno = 0;
+    tls_value = 7;
+
+    for (int i = 0; i < TLS_THREADS; i++) {
+        if (mythread_create_flags(&threads[i], tls_thread_fn, (void *)(long)(i + 1),
+                                  MYTHREAD_THREAD_GROUP) != 0) {
+            if (errno == ENOTSUP && i == 0) {
+                printf("  [Main] Private TLS is not supported on this platform\n");
+                TEST_PASS("Private TLS (skipped)");
+                return 0;
+            }
+            perror("  mythread_create_flags");
+            break;
+        }
+        created++;
+    }
+
+    int success = (created == TLS_THREADS);
+    for (int i = 0; i < created; i++) {
+        void *result;
+        if (mythread_join(&threads[i], &result) != 0 || (long)result != i + 1) {
+            printf("  [Main] Thread %d saw a foreign TLS value\n", i + 1);
+            success = 0;
+        }
+    }
+
+    /* TLS главного потока не тронут */
+    printf("  [Main] main tls_value=%d (expected 7)\n", tls_value);
+    if (success && private_tls_owner_and_tcache() != 0) {
+        success = 0;
+    }
+    if (!success || tls_value != 7) {
+        TEST_FAIL("Private TLS");
+        return -1;
+    }
+
+    TEST_PASS("Private TLS");
+    return 0;
+}
+
+/* --- Тест 9: атрибуты - размер стека и сторожевая страница --- */
+#define SMALL_STACK_SIZE (64 * 1024)
+
+void *small_stack_fn(void *arg) {
+    /* Используем почти весь маленький стек */
+    volatile char buf[SMALL_STACK_SIZE / 2];
+    memset((char *)buf, 1, sizeof(buf));
+    return arg;
+}
+
+/* Глубокая рекурсия (~1 ГБ стека) - должна упереться в сторожевую страницу */
+int overflow_depth(int depth) {
+    volatile char buf[1024];
+    if (depth > 1000000) {
+        return 0;
+    }
+    buf[0] = (char)depth;
+    return overflow_depth(depth + 1) + buf[0];
+}
+
+void *overflow_fn(void *arg) {
+    (void)arg;
+    overflow_depth(0);
+    return NULL;
+}
+
+int test_attributes(void) {
+    TEST_INFO("Test 9: Thread attributes (stack size, guard page)");
+
+    mythread_attr_t attr;
+    mythread_attr_init(&attr);
+    attr.stack_size = SMALL_STACK_SIZE;
+    attr.flags = MYTHREAD_JOIN_FUTEX | MYTHREAD_STACK_NORESERVE;
+
+    mythread_t thread;
+    void *result = NULL;
+    if (mythread_create_attr(&thread, &attr, small_stack_fn, (void *)"small") != 0 ||
+        mythread_join(&thread, &result) != 0 || result == NULL) {
+        perror("  small stack thread");
+        TEST_FAIL("Attributes - small stack");
+        return -1;
+    }
+    printf("  [Main] Thread with %d KB stack finished\n", SMALL_STACK_SIZE / 1024);
+
+    /* Слишком маленький стек */
+    attr.stack_size = MYTHREAD_STACK_MIN - 1;
+    if (mythread_create_attr(&thread, &attr, small_stack_fn, NULL) == 0) {
+        mythread_join(&thread, NULL);
+        TEST_FAIL("Attributes - tiny stack should fail");
+        return -1;
+    }
+    printf("  [Main] Too small stack correctly rejected (errno=%d)\n", errno);
+
+    /* Переполнение стека в отдельном процессе: ожидаем SIGSEGV на guard */
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        attr.stack_size = SMALL_STACK_SIZE;
+        if (mythread_create_attr(&thread, &attr, overflow_fn, NULL) == 0) {
+            mythread_join(&thread, NULL);
+        }
+        _exit(0);
+    }
+
+    int status;
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 ||
+        !WIFSIGNALED(status) || WTERMSIG(status) != SIGSEGV) {
+        TEST_FAIL("Attributes - guard page should catch overflow");
+        return -1;
+    }
+    printf("  [Main] Stack overflow hit the guard page (SIGSEGV)\n");
+
+    TEST_PASS("Attributes");
+    return 0;
+}
+
+/* --- Тест 10: условная переменная и барьер --- */
+#define SYNC_THREADS 8
+#define SYNC_ROUNDS  20
+
+static mythread_mutex_t sync_mutex = MYTHREAD_MUTEX_INITIALIZER;
+static mythread_cond_t sync_cond = MYTHREAD_COND_INITIALIZER;
+static mythread_barrier_t sync_barrier;
+static int sync_ready = 0;
+static int sync_round_counter[SYNC_ROUNDS];
+static int sync_serial_count = 0;
+
+void *sync_thread_fn(void *arg) {
+    (void)arg;
+
+    /* Ждём старта от main через условную переменную */
+    mythread_mutex_lock(&sync_mutex);
+    while (!sync_ready) {
+        mythread_cond_wait(&sync_cond, &sync_mutex);
+    }
+    mythread_mutex_unlock(&sync_mutex);
+
+    /* Раунды через барьер: к концу раунда все потоки должны отметиться */
+    for (int round = 0; round < SYNC_ROUNDS; round++) {
+        __atomic_add_fetch(&sync_round_counter[round], 1, __ATOMIC_RELAXED);
+        if (mythread_barrier_wait(&sync_barrier) == MYTHREAD_BARRIER_SERIAL_THREAD) {
+            __atomic_add_fetch(&sync_serial_count, 1, __ATOMIC_RELAXED);
+        }
+        if (__atomic_load_n(&sync_round_counter[round], __ATOMIC_RELAXED) != SYNC_THREADS) {
+            return (void *)-1L;
+        }
+    }
+    return NULL;
+}
+
+int test_cond_barrier(void) {
+    TEST_INFO("Test 10: Condition variable and barrier (%d threads)", SYNC_THREADS);
+
+    mythread_t threads[SYNC_THREADS];
+    mythread_barrier_init(&sync_barrier, SYNC_THREADS);
+
+    int created = 0;
+    for (int i = 0; i < SYNC_THREADS; i++) {
+        if (mythread_create_flags(&threads[i], sync_thread_fn, NULL, MYTHREAD_JOIN_FUTEX) != 0) {
+            perror("  mythread_create_flags");
+            break;
+        }
+        created++;
+    }
+
+    usleep(50000);  /* Потоки успевают уснуть на условной переменной */
+    mythread_mutex_lock(&sync_mutex);
+    sync_ready = 1;
+    mythread_cond_broadcast(&sync_cond);
+    mythread_mutex_unlock(&sync_mutex);
+
+    int success = (created == SYNC_THREADS);
+    for (int i = 0; i < created; i++) {
+        void *result;
+        if (mythread_join(&threads[i], &result) != 0 || result != NULL) {
+            success = 0;
+        }
+    }
+
+    printf("  [Main] %d rounds passed, serial thread chosen %d times\n",
+           SYNC_ROUNDS, sync_serial_count);
+    if (!success || sync_serial_count != SYNC_ROUNDS) {
+        TEST_FAIL("Condition variable and barrier");
+        return -1;
+    }
+
+    TEST_PASS("Condition variable and barrier");
+    return 0;
+}
+
+/* --- Тест 11: пул потоков --- */
+#define POOL_WORKERS 4
+#define POOL_TASKS   1000
+#define POOL_FIB_N   18
+
+static int pool_done_counter = 0;
+
+void *square_task_fn(void *arg) {
+    long x = (long)arg;
+    __atomic_add_fetch(&pool_done_counter, 1, __ATOMIC_RELAXED);
+    return (void *)(x * x);
+}
+
+/* Рекурсивное разбиение: подзадачи уходят в деку текущего потока пула */
+static mythread_pool_t *fib_pool;
+
+void *fib_task_fn(void *arg) {
+    long n = (long)arg;
+    if (n < 2) {
+        return (void *)n;
+    }
+
+    mythread_future_t left;
+    void *a, *b;
+    if (mythread_pool_submit(fib_pool, &left, fib_task_fn, (void *)(n - 1)) != 0) {
+        return (void *)-1L;
+    }
+    b = fib_task_fn((void *)(n - 2));
+    mythread_future_wait(&left, &a);
+    return (void *)((long)a + (long)b);
+}
+
+int test_pool(void) {
+    TEST_INFO("Test 11: Work-stealing pool (%d workers)", POOL_WORKERS);
+
+    mythread_pool_t *pool = mythread_pool_create(POOL_WORKERS);
+    if (!pool) {
+        perror("  mythread_pool_create");
+        TEST_FAIL("Work-stealing pool");
+        return -1;
+    }
+
+    /* Задачи извне пула с результатами через future */
+    static mythread_future_t futures[POOL_TASKS];
+    int success = 1;
+    for (long i = 0; i < POOL_TASKS; i++) {
+        if (mythread_pool_submit(pool, &futures[i], square_task_fn, (void *)i) != 0) {
+            success = 0;
+        }
+    }
+    for (long i = 0; i < POOL_TASKS; i++) {
+        void *result;
+        if (mythread_future_wait(&futures[i], &result) != 0 || (long)result != i * i) {
+            success = 0;
+        }
+    }
+    printf("  [Main] %d futures completed\n", POOL_TASKS);
+
+    /* Вложенные задачи с ожиданием изнутри пула */
+    mythread_future_t fib;
+    void *fib_result = NULL;
+    fib_pool = pool;
+    if (mythread_pool_submit(pool, &fib, fib_task_fn, (void *)(long)POOL_FIB_N) != 0 ||
+        mythread_future_wait(&fib, &fib_result) != 0 || (long)fib_result != 2584) {
+        success = 0;
+    }
+    printf("  [Main] fib(%d) = %ld\n", POOL_FIB_N, (long)fib_result);
+
+    /* Ожидание всех задач без future */
+    pool_done_counter = 0;
+    for (long i = 0; i < POOL_TASKS; i++) {
+        mythread_pool_submit(pool, &futures[i], square_task_fn, (void *)i);
+    }
+    if (mythread_pool_wait(pool) != 0 ||
+        __atomic_load_n(&pool_done_counter, __ATOMIC_RELAXED) != POOL_TASKS) {
+        success = 0;
+    }
+
+    if (mythread_pool_destroy(pool) != 0 || !success) {
+        TEST_FAIL("Work-stealing pool");
+        return -1;
+    }
+
+    TEST_PASS("Work-stealing pool");
+    return 0;
+}
+
+/* --- Тест 12: привязка к процессору и узлу NUMA --- */
+typedef struct {
+    int cpu;          /* На каком процессоре поток начал выполняться */
+    int cpu_count;    /* Сколько процессоров в его маске */
+    int mempolicy;    /* Политика страницы со стеком потока */
+} placement_t;
+
+void *placement_fn(void *arg) {
+    placement_t *p = (placement_t *)arg;
+    cpu_set_t mask;
+    int mode = -1;
+
+    p->cpu = sched_getcpu();
+    p->cpu_count = (sched_getaffinity(0, sizeof(mask), &mask) == 0) ? CPU_COUNT(&mask) : -1;
+    if (syscall(SYS_get_mempolicy, &mode, NULL, 0, (void *)&mode, MPOL_F_ADDR) == 0) {
+        p->mempolicy = mode;
+    }
+    return NULL;
+}
+
+int test_placement(void) {
+    TEST_INFO("Test 12: CPU affinity and NUMA node attributes");
+
+    /* Первый доступный процессор */
+    cpu_set_t allowed, mask;
+    int cpu = 0;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    while (!CPU_ISSET(cpu, &allowed)) {
+        cpu++;
+    }
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+
+    mythread_attr_t attr;
+    mythread_attr_init(&attr);
+    attr.flags = MYTHREAD_JOIN_FUTEX;
+    attr.cpuset_size = sizeof(mask);
+    attr.cpuset = &mask;
+    attr.numa_node = 0;
+
+    mythread_t thread;
+    placement_t p = { -1, -1, -1 };
+    int numa = 1;
+    if (mythread_create_attr(&thread, &attr, placement_fn, &p) != 0) {
+        if (errno != ENOSYS) {
+            perror("  mythread_create_attr");
+            TEST_FAIL("Placement");
+            return -1;
+        }
+        /* Ядро без NUMA - проверяем только affinity */
+        numa = 0;
+        attr.numa_node = -1;
+        if (mythread_create_attr(&thread, &attr, placement_fn, &p) != 0) {
+            perror("  mythread_create_attr");
+            TEST_FAIL("Placement");
+            return -1;
+        }
+    }
+    mythread_join(&thread, NULL);
+
+    printf("  [Main] Thread started on CPU %d (wanted %d), mask has %d CPUs, mempolicy=%d\n",
+           p.cpu, cpu, p.cpu_count, p.mempolicy);
+    if (p.cpu != cpu || p.cpu_count != 1 || (numa && p.mempolicy != MPOL_PREFERRED)) {
+        TEST_FAIL("Placement");
+        return -1;
+    }
+
+    /* Некорректные атрибуты */
+    CPU_ZERO(&mask);
+    attr.numa_node = -1;
+    if (mythread_create_attr(&thread, &attr, placement_fn, &p) == 0 || errno != EINVAL) {
+        TEST_FAIL("Placement - empty CPU mask should fail");
+        return -1;
+    }
+    attr.cpuset_size = 0;
+    attr.numa_node = -2;
+    if (mythread_create_attr(&thread, &attr, placement_fn, &p) == 0 || errno != EINVAL) {
+        TEST_FAIL("Placement - bad NUMA node should fail");
+        return -1;
+    }
+
+    TEST_PASS("Placement");
+    return 0;
+}
+
+/* --- Тест 13: пакетное создание и ожидание --- */
+#define BATCH_THREADS 200
+
+void *batch_fn(void *arg) {
+    long i = (long)arg;
+    if (i == 7) {
+        return (void *)(i * 2);  /* Этот завершится первым */
+    }
+    usleep(20000 + (i % 10) * 1000);
+    return (void *)(i * 2);
+}
+
+/* Создаёт пакет, ждёт одного через join_any и остальных через join_all */
+static int run_batch(int n, int flags) {
+    static mythread_t threads[BATCH_THREADS];
+    static void *(*routines[BATCH_THREADS])(void *);
+    static void *args[BATCH_THREADS];
+    static void *retvs[BATCH_THREADS];
+
+    for (int i = 0; i < n; i++) {
+        routines[i] = batch_fn;
+        args[i] = (void *)(long)i;
+        retvs[i] = NULL;
+    }
+
+    mythread_attr_t attr;
+    mythread_attr_init(&attr);
+    attr.stack_size = 64 * 1024;
+    attr.flags = flags;
+    if (mythread_create_n(threads, n, &attr, routines, args) != 0) {
+        perror("  mythread_create_n");
+        return -1;
+    }
+
+    /* Стеки идут подряд в одном отображении */
+    for (int i = 1; i < n; i++) {
+        if ((char *)threads[i].stack - (char *)threads[i - 1].stack !=
+            (char *)threads[1].stack - (char *)threads[0].stack) {
+            printf("  [Main] Stacks are not in a single mapping\n");
+            return -1;
+        }
+    }
+
+    void *first;
+    int index = mythread_join_any(threads, n, &first);
+    printf("  [Main] join_any (flags=%d): thread %d finished first\n", flags, index);
+    if (index < 0 || (long)first != index * 2L) {
+        return -1;
+    }
+
+    if (mythread_join_all(threads, n, retvs) != 0) {
+        perror("  mythread_join_all");
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (i != index && (long)retvs[i] != i * 2L) {
+            return -1;
+        }
+    }
+    if (mythread_join_any(threads, n, NULL) != -1 || errno != ECHILD) {
+        return -1;
+    }
+    return 0;
+}
+
+int test_batch(void) {
+    TEST_INFO("Test 13: Batch create + join_all/join_any (%d threads)", BATCH_THREADS);
+
+    if (run_batch(BATCH_THREADS, MYTHREAD_JOIN_FUTEX) != 0 || run_batch(8, 0) != 0) {
+        TEST_FAIL("Batch create and join");
+        return -1;
+    }
+
+    TEST_PASS("Batch create and join");
+    return 0;
+}
+
+/* --- Тест 14: трасса в Chrome trace JSON --- */
+int test_trace_dump(void) {
+    TEST_INFO("Test 14: Trace dump");
+
+    char path[] = "/tmp/mythread_trace_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("  mkstemp");
+        TEST_FAIL("Trace dump");
+        return -1;
+    }
+    close(fd);
+
+    mythread_t thread;
+    mythread_create_flags(&thread, simple_thread_fn, (void *)"traced", MYTHREAD_JOIN_FUTEX);
+    mythread_join(&thread, NULL);
+
+    int ret = mythread_trace_dump(path);
+    if (ret == -1 && errno == ENOTSUP) {
+        /* Обычная сборка: трассировка вырезана */
+        printf("  [Main] Tracing is compiled out (build with make trace)\n");
+        unlink(path);
+        TEST_PASS("Trace dump");
+        return 0;
+    }
+
+    /* Сборка с трассировкой: в файле должен быть запуск нашего потока */
+    char buf[256] = { 0 };
+    FILE *f = fopen(path, "r");
+    size_t len = f ? fread(buf, 1, sizeof(buf) - 1, f) : 0;
+    if (f) {
+        fclose(f);
+    }
+    unlink(path);
+    if (ret != 0 || len == 0 || strncmp(buf, "{\"traceEvents\":[", 16) != 0 ||
+        !strstr(buf, "\"spawn\"")) {
+        TEST_FAIL("Trace dump");
+        return -1;
+    }
+    printf("  [Main] Trace written (%zu+ bytes)\n", len);
+
+    TEST_PASS("Trace dump");
+    return 0;
+}
+
+/* --- Тест 15: отсоединённые потоки --- */
+#define DETACH_ROUNDS  10
+#define DETACH_THREADS 200
+
+static volatile int detached_done = 0;
+
+void *detached_fn(void *arg) {
+    (void)arg;
+    __atomic_add_fetch(&detached_done, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/* Ждёт, пока сборщик вернёт все стеки (не дольше ~5 с) */
+static int wait_reaped(void) {
+    for (int i = 0; i < 5000 && mythread_detached_pending() != 0; i++) {
+        usleep(1000);
+    }
+    return mythread_detached_pending() == 0 ? 0 : -1;
+}
+
+/* Виртуальная память процесса в страницах */
+static long vm_pages(void) {
+    long size = -1;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld", &size) != 1) {
+            size = -1;
+        }
+        fclose(f);
+    }
+    return size;
+}
+
+int test_detach(void) {
+    TEST_INFO("Test 15: Detached threads (%d rounds x %d)", DETACH_ROUNDS, DETACH_THREADS);
+
+    mythread_attr_t attr;
+    mythread_attr_init(&attr);
+    attr.stack_size = 64 * 1024;
+    attr.flags = MYTHREAD_JOIN_FUTEX;
+
+    long first_round = 0;
+    for (int r = 0; r < DETACH_ROUNDS; r++) {
+        for (int i = 0; i < DETACH_THREADS; i++) {
+            /* Структура потока не нужна после detach - одна на всех */
+            mythread_t thread;
+            if (mythread_create_attr(&thread, &attr, detached_fn, NULL) != 0 ||
+                mythread_detach(&thread) != 0) {
+                perror("  create/detach");
+                TEST_FAIL("Detached threads");
+                return -1;
+            }
+        }
+        if (wait_reaped() != 0) {
+            printf("  [Main] %zu stacks were not reaped\n", mythread_detached_pending());
+            TEST_FAIL("Detached threads");
+            return -1;
+        }
+        if (r == 0) {
+            first_round = vm_pages();
+        }
+    }
+
+    /* Стеки переиспользуются через кэш - память не растёт от раунда к раунду */
+    long growth = vm_pages() - first_round;
+    printf("  [Main] %d threads finished, memory growth after first round: %ld pages\n",
+           __atomic_load_n(&detached_done, __ATOMIC_RELAXED), growth);
+    if (detached_done != DETACH_ROUNDS * DETACH_THREADS || growth > 256) {
+        TEST_FAIL("Detached threads");
+        return -1;
+    }
+
+    /* Отсоединение уже завершившегося потока работает как join */
+    mythread_t thread;
+    mythread_create_attr(&thread, &attr, detached_fn, NULL);
+    while (__atomic_load_n(&thread.tid, __ATOMIC_ACQUIRE) != 0) {
+        usleep(100);
+    }
+    if (mythread_detach(&thread) != 0 || thread.stack != NULL) {
+        TEST_FAIL("Detached threads");
+        return -1;
+    }
+
+    /* Обычный режим не поддерживается: ждать зомби некому */
+    mythread_create(&thread, detached_fn, NULL);
+    if (mythread_detach(&thread) != -1 || errno != EINVAL) {
+        TEST_FAIL("Detached threads");
+        return -1;
+    }
+    mythread_join(&thread, NULL);
+
+    TEST_PASS("Detached threads");
+    return 0;
+}
+
+/* --- Тест 16: данные потока (mythread_key_*) --- */
+#define KEY_THREADS 8
+
+static mythread_key_t value_key;    /* С деструктором */
+static mythread_key_t plain_key;    /* Без деструктора */
+static volatile long destructed_sum = 0;
+
+static void value_destructor(void *value) {
+    __atomic_add_fetch(&destructed_sum, (long)value, __ATOMIC_RELAXED);
+}
+
+void *key_fn(void *arg) {
+    long id = (long)arg;
+
+    /* Стек мог прийти из кэша от потока, который задал plain_key */
+    if (mythread_getspecific(value_key) != NULL || mythread_getspecific(plain_key) != NULL) {
+        return (void *)-1L;
+    }
+    mythread_setspecific(value_key, (void *)id);
+    mythread_setspecific(plain_key, (void *)(id * 100));
+    for (int i = 0; i < 100; i++) {
+        sched_yield();
+        if ((long)mythread_getspecific(value_key) != id ||
+            (long)mythread_getspecific(plain_key) != id * 100) {
+            return (void *)-1L;
+        }
+    }
+    return NULL;
+}
+
+static int run_keys(int flags) {
+    mythread_t threads[KEY_THREADS];
+
+    destructed_sum = 0;
+    for (long i = 0; i < KEY_THREADS; i++) {
+        if (mythread_create_flags(&threads[i], key_fn, (void *)(i + 1), flags) != 0) {
+            perror("  mythread_create_flags");
+            return -1;
+        }
+    }
+    int failed = 0;
+    for (int i = 0; i < KEY_THREADS; i++) {
+        void *retv;
+        mythread_join(&threads[i], &retv);
+        failed |= retv != NULL;
+    }
+
+    long expected = KEY_THREADS * (KEY_THREADS + 1) / 2;
+    printf("  [Main] flags=%d: destructors got sum %ld (expected %ld)\n",
+           flags, destructed_sum, expected);
+    return failed || destructed_sum != expected ? -1 : 0;
+}
+
+int test_keys(void) {
+    TEST_INFO("Test 16: Thread-specific data");
+
+    if (mythread_key_create(&value_key, value_destructor) != 0 ||
+        mythread_key_create(&plain_key, NULL) != 0) {
+        if (errno == ENOTSUP) {
+            printf("  [Main] Keys are not supported here (not x86-64 or %%gs is in use)\n");
+            TEST_PASS("Thread-specific data");
+            return 0;
+        }
+        perror("  mythread_key_create");
+        TEST_FAIL("Thread-specific data");
+        return -1;
+    }
+
+    /* main тоже может хранить значения, потоки их не видят */
+    mythread_setspecific(value_key, (void *)1000L);
+    if (run_keys(0) != 0 || run_keys(MYTHREAD_JOIN_FUTEX) != 0 ||
+        run_keys(MYTHREAD_THREAD_GROUP) != 0 ||
+        (long)mythread_getspecific(value_key) != 1000L) {
+        TEST_FAIL("Thread-specific data");
+        return -1;
+    }
+
+    /* После удаления ключ недействителен */
+    mythread_key_delete(plain_key);
+    if (mythread_setspecific(MYTHREAD_KEYS_MAX, NULL) != -1 || errno != EINVAL ||
+        mythread_getspecific(MYTHREAD_KEYS_MAX) != NULL) {
+        TEST_FAIL("Thread-specific data");
+        return -1;
+    }
+    mythread_setspecific(value_key, NULL);
+
+    TEST_PASS("Thread-specific data");
+    return 0;
+}
+
+/* --- Тест 17: профиль глубины стека --- */
+#define PROFILE_DEPTH (40 * 1024)
+
+void *deep_stack_fn(void *arg) {
+    volatile char buf[PROFILE_DEPTH];
+    size_t depth = (size_t)arg;
+
+    for (size_t i = 0; i < depth; i += 256) {
+        buf[sizeof(buf) - 1 - i] = (char)i;
+    }
+    return (void *)(long)buf[sizeof(buf) - 1];
+}
+
+int test_stack_profile(void) {
+    TEST_INFO("Test 17: Stack high-water mark");
+
+    mythread_attr_t attr;
+    mythread_attr_init(&attr);
+    attr.stack_size = 128 * 1024;
+    attr.flags = MYTHREAD_STACK_PROFILE | MYTHREAD_JOIN_FUTEX;
+
+    mythread_t shallow, deep;
+    if (mythread_create_attr(&shallow, &attr, deep_stack_fn, (void *)(size_t)1024) != 0 ||
+        mythread_create_attr(&deep, &attr, deep_stack_fn, (void *)(size_t)PROFILE_DEPTH) != 0) {
+        perror("  mythread_create_attr");
+        TEST_FAIL("Stack high-water mark");
+        return -1;
+    }
+    mythread_join(&shallow, NULL);
+    mythread_join(&deep, NULL);
+    printf("  [Main] Peak stack: shallow %zu bytes, deep %zu bytes\n",
+           shallow.stack_used, deep.stack_used);
+
+    /* Глубина покрывает тронутую часть буфера, но не весь стек */
+    if (shallow.stack_used == 0 || shallow.stack_used > 8 * 1024 + PROFILE_DEPTH ||
+        deep.stack_used < PROFILE_DEPTH - 256 || deep.stack_used >= attr.stack_size) {
+        TEST_FAIL("Stack high-water mark");
+        return -1;
+    }
+
+    /* Без флага (и без MYTHREAD_STACK_PROFILE в окружении) глубина не считается */
+    mythread_t plain;
+    mythread_create_flags(&plain, deep_stack_fn, (void *)(size_t)1024, MYTHREAD_JOIN_FUTEX);
+    mythread_join(&plain, NULL);
+
+    /* Сводка по функциям: одна строка заголовка и строка deep_stack_fn */
+    char path[] = "/tmp/mythread_stackprof_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1 || mythread_stack_report(fd) != 0) {
+        TEST_FAIL("Stack high-water mark");
+        return -1;
+    }
+    char buf[512] = { 0 };
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    close(fd);
+    unlink(path);
+    printf("%s", buf);
+    if ((plain.stack_used != 0 && !getenv("MYTHREAD_STACK_PROFILE")) || len <= 0 || !strstr(buf, "start_routine") ||
+        !strchr(strchr(buf, '\n') + 1, '\n')) {
+        TEST_FAIL("Stack high-water mark");
+        return -1;
+    }
+
+    TEST_PASS("Stack high-water mark");
+    return 0;
+}
+
+/* --- Тест 18: учёт ресурсов потока --- */
+#define STATS_SLEEPS 5
+
+static volatile int stats_release = 0;
+
+void *stats_fn(void *arg) {
+    (void)arg;
+
+    /* ~20 мс CPU */
+    struct timespec start, now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    do {
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec) < 20000000L);
+
+    /* Каждый сон - добровольное переключение */
+    for (int i = 0; i < STATS_SLEEPS; i++) {
+        usleep(1000);
+    }
+
+    /* Ждём, пока main прочитает счётчики работающего потока */
+    while (!__atomic_load_n(&stats_release, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+    return NULL;
+}
+
+static int run_stats(int flags) {
+    mythread_t thread;
+    mythread_stats_t live, final;
+
+    stats_release = 0;
+    if (mythread_create_flags(&thread, stats_fn, NULL, flags | MYTHREAD_STATS) != 0) {
+        perror("  mythread_create_flags");
+        return -1;
+    }
+
+    /* Пока поток работает - чтение из /proc */
+    usleep(50000);
+    int live_ret = mythread_stats(&thread, &live);
+    __atomic_store_n(&stats_release, 1, __ATOMIC_RELEASE);
+    mythread_join(&thread, NULL);
+
+    /* После join - счётчики, снятые потоком при выходе */
+    if (live_ret != 0 || mythread_stats(&thread, &final) != 0) {
+        perror("  mythread_stats");
+        return -1;
+    }
+    printf("  [Main] flags=%d: live cpu %.1f ms; final cpu %.1f ms, lifetime %.1f ms, "
+           "switches %ld/%ld, faults %ld/%ld\n",
+           flags, live.cpu_ns / 1e6, final.cpu_ns / 1e6, final.lifetime_ns / 1e6,
+           final.voluntary_switches, final.involuntary_switches,
+           final.minor_faults, final.major_faults);
+
+    if (live.cpu_ns < 15000000 || final.cpu_ns < live.cpu_ns ||
+        final.lifetime_ns < final.cpu_ns || final.voluntary_switches < STATS_SLEEPS) {
+        return -1;
+    }
+    return 0;
+}
+
+int test_stats(void) {
+    TEST_INFO("Test 18: Per-thread resource accounting");
+
+    if (run_stats(MYTHREAD_JOIN_FUTEX) != 0 || run_stats(0) != 0) {
+        TEST_FAIL("Resource accounting");
+        return -1;
+    }
+
+    /* Без MYTHREAD_STATS после join данных нет */
+    mythread_t thread;
+    mythread_stats_t st;
+    mythread_create_flags(&thread, simple_thread_fn, (void *)"no stats", MYTHREAD_JOIN_FUTEX);
+    mythread_join(&thread, NULL);
+    if (mythread_stats(&thread, &st) != -1 || errno != ENODATA) {
+        TEST_FAIL("Resource accounting");
+        return -1;
+    }
+
+    /* ... и до join тоже: номер вышедшего потока ядро могло отдать другому */
+    mythread_create_flags(&thread, simple_thread_fn, (void *)"no stats", MYTHREAD_JOIN_FUTEX);
+    while (__atomic_load_n(&thread.tid, __ATOMIC_ACQUIRE) != 0) {
+        usleep(1000);
+    }
+    int exited_nodata = mythread_stats(&thread, &st) == -1 && errno == ENODATA;
+    mythread_join(&thread, NULL);
+    if (!exited_nodata) {
+        TEST_FAIL("Resource accounting");
+        return -1;
+    }
+
+    TEST_PASS("Resource accounting");
+    return 0;
+}
+
 /* --- Главная функция --- */
 int main(void) {
     printf("\n" COLOR_YELLOW "=== MYTHREAD LIBRARY TEST SUITE ===" COLOR_RESET "\n\n");
@@ -287,6 +1327,18 @@ int main(void) {
     RUN_TEST(test_error_handling);
     RUN_TEST(test_sequential_creation);
     RUN_TEST(test_stress);
+    RUN_TEST(test_futex_join);
+    RUN_TEST(test_private_tls);
+    RUN_TEST(test_attributes);
+    RUN_TEST(test_cond_barrier);
+    RUN_TEST(test_pool);
+    RUN_TEST(test_placement);
+    RUN_TEST(test_batch);
+    RUN_TEST(test_trace_dump);
+    RUN_TEST(test_detach);
+    RUN_TEST(test_keys);
+    RUN_TEST(test_stack_profile);
+    RUN_TEST(test_stats);
     
     printf(COLOR_YELLOW "=== TEST SUMMARY ===" COLOR_RESET "\n");
     printf("Passed: %d/%d\n", tests_passed, tests_total);
@@ -0,0 +1,738 @@
+#define _GNU_SOURCE
+
+#include "uthread.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+// Микробенчмарки uthread
+//
+// Запуск: bench_uthread [имя ...]
+// Без аргументов выполняются все бенчмарки.
+
+#define YIELD_ROUNDS 1000000
+#define SPAWN_TOTAL  1000000  // Потоков за всё время бенчмарка
+#define SPAWN_BATCH  1000     // Создаются между двумя yield создателя
+#define SPAWN_CHUNKS 10
+
+#define PREEMPT_QUANTUM_US 1000
+#define PREEMPT_HOGS       2      // Потоков, не уступающих процессор
+#define PREEMPT_BURN_MS    200    // Сколько каждый из них считает
+#define PREEMPT_SAMPLES    100000
+
+#define SEM_ROUNDS    200000
+#define CHAN_ROUNDS   1000000
+
+#define SLEEP_FIBERS  10000
+#define SLEEP_ROUNDS  20
+#define SLEEP_MAX_MS  20      // Сон - случайно от 0 до SLEEP_MAX_MS
+
+#define IO_ROUNDS     100000
+#define IO_CONNS      5000    // Соединений (пар сокетов) в одном ядерном потоке
+#define IO_CONN_ROUNDS 20
+
+#define FILE_SIZE     (16 << 20)
+#define FILE_BLOCK    4096
+#define FILE_FIBERS   32      // Потоков, читающих файл вперемешку с вычислениями
+#define FILE_READS    256     // Случайных блоков на поток
+#define FILE_SPINS    20000   // Итераций вычислений после каждого чтения
+
+#define WORK_THREADS  256     // "Запросов" - потоков с вычислениями
+#define WORK_STEPS    200     // Шагов с yield между ними
+#define WORK_SPINS    2000    // Итераций вычислений на шаг
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+// --- yield: пинг-понг двух потоков через uthread_yield ---
+
+static void *yield_fn(void *arg) {
+    (void)arg;
+    for (int i = 0; i < YIELD_ROUNDS; i++) {
+        uthread_yield();
+    }
+    return NULL;
+}
+
+// Тот же пинг-понг на swapcontext - как переключался uthread раньше
+static ucontext_t swap_main, swap_ctx[2];
+
+static void swap_fn(int self) {
+    for (int i = 0; i < YIELD_ROUNDS; i++) {
+        swapcontext(&swap_ctx[self], &swap_ctx[!self]);
+    }
+    swapcontext(&swap_ctx[self], &swap_main);
+}
+
+static int bench_yield(void) {
+    uthread_t a, b;
+
+    if (uthread_create(&a, yield_fn, NULL) != 0 || uthread_create(&b, yield_fn, NULL) != 0) {
+        return -1;
+    }
+    double start = now_ns();
+    uthread_yield();
+    double uthread_ns = (now_ns() - start) / (2.0 * YIELD_ROUNDS);
+    uthread_join(&a, NULL);
+    uthread_join(&b, NULL);
+
+    static char stacks[2][16 * 1024];
+    for (int i = 0; i < 2; i++) {
+        getcontext(&swap_ctx[i]);
+        swap_ctx[i].uc_stack.ss_sp = stacks[i];
+        swap_ctx[i].uc_stack.ss_size = sizeof(stacks[i]);
+        swap_ctx[i].uc_link = NULL;
+        makecontext(&swap_ctx[i], (void (*)())swap_fn, 1, i);
+    }
+    start = now_ns();
+    swapcontext(&swap_main, &swap_ctx[0]);
+    double swap_ns = (now_ns() - start) / (2.0 * YIELD_ROUNDS);
+
+    printf("%-10s uthread_yield=%6.1f ns/switch  swapcontext=%6.1f ns/switch  (x%.1f)\n",
+           "yield", uthread_ns, swap_ns, swap_ns / uthread_ns);
+    return 0;
+}
+
+
+// --- spawn: 1M потоков за время жизни, стоимость не должна расти ---
+
+static double spawn_chunk_ns[SPAWN_CHUNKS];
+
+static void *spawn_child_fn(void *arg) {
+    return arg;
+}
+
+static void *spawner_fn(void *arg) {
+    (void)arg;
+    uthread_t child;
+    double start = now_ns();
+
+    for (int i = 1; i <= SPAWN_TOTAL; i++) {
+        if (uthread_create(&child, spawn_child_fn, NULL) != 0 || uthread_detach(&child) != 0) {
+            return (void *)-1L;
+        }
+        // Созданные потоки отрабатывают и завершаются, пока создатель в очереди
+        if (i % SPAWN_BATCH == 0) {
+            uthread_yield();
+        }
+        if (i % (SPAWN_TOTAL / SPAWN_CHUNKS) == 0) {
+            double end = now_ns();
+            spawn_chunk_ns[i / (SPAWN_TOTAL / SPAWN_CHUNKS) - 1] = (end - start) / (SPAWN_TOTAL / SPAWN_CHUNKS);
+            start = end;
+        }
+    }
+    return NULL;
+}
+
+static int bench_spawn(void) {
+    uthread_t spawner;
+
+    if (uthread_create(&spawner, spawner_fn, NULL) != 0) {
+        return -1;
+    }
+    uthread_join(&spawner, NULL);
+
+    // Время на create + запуск + выход одного потока в первой и последней десятой части
+    printf("%-10s %d threads: first 10%% %6.1f ns/thread  last 10%% %6.1f ns/thread\n",
+           "spawn", SPAWN_TOTAL, spawn_chunk_ns[0], spawn_chunk_ns[SPAWN_CHUNKS - 1]);
+    return 0;
+}
+
+
+// --- preempt: задержка короткого потока рядом с вычисляющими ---
+//
+// Короткий поток меряет, сколько ждал между двумя своими yield, пока
+// рядом работают потоки без единого yield. Без вытеснения он ждёт их
+// до конца; с вытеснением - не дольше PREEMPT_HOGS квантов.
+
+static volatile int hogs_running;
+static double *gap_samples;
+static int gap_count;
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void *hog_fn(void *arg) {
+    (void)arg;
+    double end = now_ns() + PREEMPT_BURN_MS * 1e6;
+    while (now_ns() < end) {
+    }
+    uthread_preempt_disable();  // Чтение-изменение-запись счётчика
+    hogs_running--;
+    uthread_preempt_enable();
+    return NULL;
+}
+
+static void *latency_fn(void *arg) {
+    (void)arg;
+    double prev = now_ns();
+    while (hogs_running > 0 && gap_count < PREEMPT_SAMPLES) {
+        uthread_yield();
+        double now = now_ns();
+        gap_samples[gap_count++] = now - prev;
+        prev = now;
+    }
+    return NULL;
+}
+
+static int preempt_run(unsigned quantum_us, double *p50, double *p99, double *max) {
+    uthread_t hogs[PREEMPT_HOGS], latency;
+
+    if (uthread_preempt(quantum_us) != 0) {
+        return -1;
+    }
+    gap_count = 0;
+    hogs_running = PREEMPT_HOGS;
+    if (uthread_create(&latency, latency_fn, NULL) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < PREEMPT_HOGS; i++) {
+        if (uthread_create(&hogs[i], hog_fn, NULL) != 0) {
+            return -1;
+        }
+    }
+    uthread_join(&latency, NULL);
+    for (int i = 0; i < PREEMPT_HOGS; i++) {
+        uthread_join(&hogs[i], NULL);
+    }
+    uthread_preempt(0);
+
+    qsort(gap_samples, gap_count, sizeof(double), cmp_double);
+    *p50 = gap_samples[gap_count / 2];
+    *p99 = gap_samples[gap_count * 99 / 100];
+    *max = gap_samples[gap_count - 1];
+    return 0;
+}
+
+static int bench_preempt(void) {
+    double p50, p99, max;
+
+    gap_samples = malloc(PREEMPT_SAMPLES * sizeof(double));
+    if (!gap_samples) {
+        return -1;
+    }
+    if (preempt_run(0, &p50, &p99, &max) != 0) {
+        free(gap_samples);
+        return -1;
+    }
+    printf("%-10s cooperative:      wait p50 %9.1f us  p99 %9.1f us  max %9.1f us\n",
+           "preempt", p50 / 1e3, p99 / 1e3, max / 1e3);
+    if (preempt_run(PREEMPT_QUANTUM_US, &p50, &p99, &max) != 0) {
+        free(gap_samples);
+        return -1;
+    }
+    printf("%-10s quantum %4d us:  wait p50 %9.1f us  p99 %9.1f us  max %9.1f us\n",
+           "preempt", PREEMPT_QUANTUM_US, p50 / 1e3, p99 / 1e3, max / 1e3);
+    free(gap_samples);
+    return 0;
+}
+
+
+// --- sem: пинг-понг двух потоков через пару семафоров ---
+//
+// Каждый круг - два ожидания на занятом семафоре. У uthread ожидание -
+// переключение контекста, у pthread и sem_t - сон в futex и пробуждение.
+
+static uthread_sem_t usem[2];
+static sem_t psem[2];
+
+static void *usem_fn(void *arg) {
+    int self = (int)(long)arg;
+    for (int i = 0; i < SEM_ROUNDS; i++) {
+        uthread_sem_wait(&usem[self]);
+        uthread_sem_post(&usem[!self]);
+    }
+    return NULL;
+}
+
+static void *psem_fn(void *arg) {
+    int self = (int)(long)arg;
+    for (int i = 0; i < SEM_ROUNDS; i++) {
+        sem_wait(&psem[self]);
+        sem_post(&psem[!self]);
+    }
+    return NULL;
+}
+
+static int bench_sem(void) {
+    uthread_t ua, ub;
+    pthread_t pa, pb;
+
+    uthread_sem_init(&usem[0], 1);
+    uthread_sem_init(&usem[1], 0);
+    double start = now_ns();
+    if (uthread_create(&ua, usem_fn, (void *)0L) != 0 || uthread_create(&ub, usem_fn, (void *)1L) != 0) {
+        return -1;
+    }
+    uthread_join(&ua, NULL);
+    uthread_join(&ub, NULL);
+    double uthread_ns = (now_ns() - start) / (2.0 * SEM_ROUNDS);
+
+    sem_init(&psem[0], 0, 1);
+    sem_init(&psem[1], 0, 0);
+    start = now_ns();
+    if (pthread_create(&pa, NULL, psem_fn, (void *)0L) != 0 ||
+        pthread_create(&pb, NULL, psem_fn, (void *)1L) != 0) {
+        return -1;
+    }
+    pthread_join(pa, NULL);
+    pthread_join(pb, NULL);
+    double pthread_ns = (now_ns() - start) / (2.0 * SEM_ROUNDS);
+    sem_destroy(&psem[0]);
+    sem_destroy(&psem[1]);
+
+    printf("%-10s uthread_sem=%7.1f ns/handoff  pthread+sem_t=%7.1f ns/handoff  (x%.1f)\n",
+           "sem", uthread_ns, pthread_ns, pthread_ns / uthread_ns);
+    return 0;
+}
+
+
+// --- chan: пинг-понг через два канала без буфера и через буфер ---
+
+static uthread_chan_t *ping_chan, *pong_chan;
+
+static void *chan_pong_fn(void *arg) {
+    (void)arg;
+    long v;
+    while (uthread_chan_recv(ping_chan, &v) == 0) {
+        uthread_chan_send(pong_chan, &v);
+    }
+    return NULL;
+}
+
+// Один переход - send и ответный recv на другой стороне
+static double chan_pingpong(size_t capacity) {
+    uthread_t pong;
+    ping_chan = uthread_chan_of(long, capacity);
+    pong_chan = uthread_chan_of(long, capacity);
+    if (!ping_chan || !pong_chan || uthread_create(&pong, chan_pong_fn, NULL) != 0) {
+        return -1;
+    }
+
+    double start = now_ns();
+    for (long i = 0; i < CHAN_ROUNDS; i++) {
+        long v;
+        uthread_chan_send(ping_chan, &i);
+        uthread_chan_recv(pong_chan, &v);
+    }
+    double elapsed = now_ns() - start;
+
+    uthread_chan_close(ping_chan);
+    uthread_join(&pong, NULL);
+    uthread_chan_destroy(ping_chan);
+    uthread_chan_destroy(pong_chan);
+    return elapsed / (2.0 * CHAN_ROUNDS);
+}
+
+static int bench_chan(void) {
+    double unbuffered = chan_pingpong(0);
+    double buffered = chan_pingpong(1);
+    if (unbuffered < 0 || buffered < 0) {
+        return -1;
+    }
+    printf("%-10s unbuffered=%6.1f ns/hop  buffered(1)=%6.1f ns/hop\n", "chan", unbuffered, buffered);
+    return 0;
+}
+
+
+// --- sleep: тысячи спящих потоков ---
+//
+// Опоздание пробуждения относительно срока и процессорное время за прогон:
+// пока все спят, ядерный поток спит в ядре до ближайшего срока.
+
+static double *late_samples;
+static int late_count;
+
+static void *sleep_fn(void *arg) {
+    unsigned seed = (unsigned)(long)arg;
+    for (int i = 0; i < SLEEP_ROUNDS; i++) {
+        uint64_t deadline = uthread_now() + (uint64_t)(rand_r(&seed) % (SLEEP_MAX_MS * 1000)) * 1000;
+        uthread_sleep_until(deadline);
+        late_samples[late_count++] = (double)(uthread_now() - deadline);
+    }
+    return NULL;
+}
+
+static double cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int bench_sleep(void) {
+    uthread_t *threads = malloc(SLEEP_FIBERS * sizeof(uthread_t));
+    late_samples = malloc(SLEEP_FIBERS * SLEEP_ROUNDS * sizeof(double));
+    if (!threads || !late_samples) {
+        free(threads);
+        free(late_samples);
+        return -1;
+    }
+
+    late_count = 0;
+    double start = now_ns();
+    double cpu_start = cpu_ns();
+    for (long i = 0; i < SLEEP_FIBERS; i++) {
+        if (uthread_create(&threads[i], sleep_fn, (void *)i) != 0) {
+            free(threads);
+            free(late_samples);
+            return -1;
+        }
+    }
+    for (int i = 0; i < SLEEP_FIBERS; i++) {
+        uthread_join(&threads[i], NULL);
+    }
+    double wall = now_ns() - start;
+    double cpu = cpu_ns() - cpu_start;
+
+    qsort(late_samples, late_count, sizeof(double), cmp_double);
+    printf("%-10s %d fibers x %d: late p50 %6.1f us  p99 %6.1f us  cpu %4.1f%% of %.0f ms (%.0f ns/wakeup)\n",
+           "sleep", SLEEP_FIBERS, SLEEP_ROUNDS, late_samples[late_count / 2] / 1e3,
+           late_samples[late_count * 99 / 100] / 1e3, 100.0 * cpu / wall, wall / 1e6, cpu / late_count);
+    free(threads);
+    free(late_samples);
+    return 0;
+}
+
+
+// --- io: обмен через socketpair ---
+//
+// Пинг-понг: у uthread ждущий read - EAGAIN, сон в реакторе epoll и
+// переключение, у pthread - блокирующий read в ядре. Затем IO_CONNS
+// соединений с эхо-потоком на каждом: все ждут в одном epoll.
+
+static int io_pair[2];
+
+static void *io_pong_fn(void *arg) {
+    (void)arg;
+    char c;
+    while (uthread_read(io_pair[1], &c, 1) == 1) {
+        uthread_write(io_pair[1], &c, 1);
+    }
+    return NULL;
+}
+
+static void *io_ppong_fn(void *arg) {
+    (void)arg;
+    char c;
+    while (read(io_pair[1], &c, 1) == 1) {
+        if (write(io_pair[1], &c, 1) != 1) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static double io_pingpong(int fibers) {
+    uthread_t upong;
+    pthread_t ppong;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, io_pair) != 0 ||
+        (fibers ? uthread_create(&upong, io_pong_fn, NULL) : pthread_create(&ppong, NULL, io_ppong_fn, NULL)) != 0) {
+        return -1;
+    }
+
+    double start = now_ns();
+    for (int i = 0; i < IO_ROUNDS; i++) {
+        char c = 'x';
+        if (fibers) {
+            uthread_write(io_pair[0], &c, 1);
+            uthread_read(io_pair[0], &c, 1);
+        } else if (write(io_pair[0], &c, 1) != 1 || read(io_pair[0], &c, 1) != 1) {
+            return -1;
+        }
+    }
+    double elapsed = now_ns() - start;
+
+    if (fibers) {
+        uthread_close(io_pair[0]);
+        uthread_join(&upong, NULL);
+        uthread_close(io_pair[1]);
+    } else {
+        close(io_pair[0]);
+        pthread_join(ppong, NULL);
+        close(io_pair[1]);
+    }
+    return elapsed / (2.0 * IO_ROUNDS);
+}
+
+static int (*io_conns)[2];
+
+static void *io_echo_fn(void *arg) {
+    int fd = io_conns[(long)arg][1];
+    char c;
+    while (uthread_read(fd, &c, 1) == 1) {
+        uthread_write(fd, &c, 1);
+    }
+    return NULL;
+}
+
+// Круг: по байту в каждое соединение, потом все ответы
+static double io_fanout(void) {
+    uthread_t *echo = malloc(IO_CONNS * sizeof(uthread_t));
+    io_conns = malloc(IO_CONNS * sizeof(*io_conns));
+    if (!echo || !io_conns) {
+        free(echo);
+        free(io_conns);
+        return -1;
+    }
+
+    int opened = 0;
+    double result = -1;
+    for (; opened < IO_CONNS; opened++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, io_conns[opened]) != 0 ||
+            uthread_create(&echo[opened], io_echo_fn, (void *)(long)opened) != 0) {
+            break;
+        }
+    }
+    if (opened == IO_CONNS) {
+        double start = now_ns();
+        for (int r = 0; r < IO_CONN_ROUNDS; r++) {
+            char c = 'x';
+            for (int i = 0; i < IO_CONNS; i++) {
+                uthread_write(io_conns[i][0], &c, 1);
+            }
+            for (int i = 0; i < IO_CONNS; i++) {
+                uthread_read(io_conns[i][0], &c, 1);
+            }
+        }
+        result = (now_ns() - start) / ((double)IO_CONNS * IO_CONN_ROUNDS);
+    }
+
+    for (int i = 0; i < opened; i++) {
+        uthread_close(io_conns[i][0]);
+        uthread_join(&echo[i], NULL);
+        uthread_close(io_conns[i][1]);
+    }
+    free(echo);
+    free(io_conns);
+    return result;
+}
+
+static int bench_io(void) {
+    // Два fd на соединение - поднимаем мягкий предел до жёсткого
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    double fibers = io_pingpong(1);
+    double threads = io_pingpong(0);
+    double fanout = io_fanout();
+    if (fibers < 0 || threads < 0) {
+        return -1;
+    }
+    printf("%-10s uthread=%7.1f ns/msg  pthread=%7.1f ns/msg  (x%.1f)\n",
+           "io", fibers, threads, threads / fibers);
+    if (fanout < 0) {
+        printf("%-10s %d connections: not enough file descriptors\n", "io", IO_CONNS);
+    } else {
+        printf("%-10s %d connections, one kernel thread: %7.1f ns/echo\n", "io", IO_CONNS, fanout);
+    }
+    return 0;
+}
+
+
+// --- file: случайное чтение файла вперемешку с вычислениями ---
+//
+// Потоки в одном ядерном потоке читают случайные блоки и считают после
+// каждого. Блокирующий pread останавливает всех на время чтения с диска;
+// uthread_pread отдаёт процессор, пока чтение идёт в io_uring, и заявки
+// потоков уходят в ядро пачками. Файл открыт с O_DIRECT - иначе после
+// первого прохода всё читалось бы из кэша страниц.
+
+static int file_fd;
+static int file_async;
+static volatile unsigned long file_sink;
+
+static void *file_fn(void *arg) {
+    unsigned long x = (unsigned long)arg + 1;
+    char *buf = aligned_alloc(FILE_BLOCK, FILE_BLOCK);
+    if (!buf) {
+        return (void *)-1L;
+    }
+    long failed = 0;
+    for (int r = 0; r < FILE_READS; r++) {
+        x = x * 6364136223846793005UL + 1442695040888963407UL;
+        off_t off = (off_t)((x >> 33) % (FILE_SIZE / FILE_BLOCK)) * FILE_BLOCK;
+        ssize_t n = file_async ? uthread_pread(file_fd, buf, FILE_BLOCK, off)
+                               : pread(file_fd, buf, FILE_BLOCK, off);
+        failed |= n != FILE_BLOCK;
+        for (int i = 0; i < FILE_SPINS; i++) {
+            x = x * 6364136223846793005UL + 1442695040888963407UL;
+        }
+    }
+    file_sink = x + (unsigned char)buf[0];
+    free(buf);
+    return (void *)failed;
+}
+
+static double file_run(int async) {
+    uthread_t threads[FILE_FIBERS];
+    file_async = async;
+    long failed = 0;
+
+    double start = now_ns();
+    for (int i = 0; i < FILE_FIBERS; i++) {
+        if (uthread_create(&threads[i], file_fn, (void *)(long)i) != 0) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < FILE_FIBERS; i++) {
+        void *retval;
+        uthread_join(&threads[i], &retval);
+        failed |= (long)retval;
+    }
+    return failed ? -1 : now_ns() - start;
+}
+
+static int bench_file(void) {
+    char path[] = "/tmp/uthread-bench-XXXXXX";
+    int fd = mkstemp(path);
+    char *block = aligned_alloc(FILE_BLOCK, FILE_BLOCK);
+    if (fd < 0 || !block) {
+        return -1;
+    }
+    memset(block, 'x', FILE_BLOCK);
+    int written = 1;
+    for (off_t off = 0; off < FILE_SIZE && written; off += FILE_BLOCK) {
+        written = pwrite(fd, block, FILE_BLOCK, off) == FILE_BLOCK;
+    }
+    free(block);
+    if (!written || fsync(fd) != 0) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    close(fd);
+
+    int direct = 1;
+    file_fd = open(path, O_RDONLY | O_DIRECT);
+    if (file_fd < 0) {
+        direct = 0;  // tmpfs и некоторые другие ФС без O_DIRECT
+        file_fd = open(path, O_RDONLY);
+    }
+    unlink(path);
+    if (file_fd < 0) {
+        return -1;
+    }
+
+    double blocking = file_run(0);
+    double async = file_run(1);
+    close(file_fd);
+    if (blocking < 0 || async < 0) {
+        return -1;
+    }
+    double reads = (double)FILE_FIBERS * FILE_READS;
+    printf("%-10s %d threads x %d reads%s: pread %7.1f ms  uthread_pread %7.1f ms  (x%.2f, %.0f ns/read)\n",
+           "file", FILE_FIBERS, FILE_READS, direct ? " (O_DIRECT)" : "",
+           blocking / 1e6, async / 1e6, blocking / async, async / reads);
+    return 0;
+}
+
+
+// --- workers: те же вычисления на одном ядерном потоке и на M:N ---
+//
+// Поток на запрос: каждый считает WORK_STEPS шагов и уступает процессор
+// между ними. Включает воркеров - поэтому в таблице последний.
+
+static volatile unsigned long work_sink;
+
+static void *work_fn(void *arg) {
+    unsigned long x = (unsigned long)arg;
+    for (int step = 0; step < WORK_STEPS; step++) {
+        for (int i = 0; i < WORK_SPINS; i++) {
+            x = x * 6364136223846793005UL + 1442695040888963407UL;
+        }
+        uthread_yield();
+    }
+    work_sink = x;
+    return NULL;
+}
+
+static double work_run(void) {
+    uthread_t threads[WORK_THREADS];
+
+    double start = now_ns();
+    for (int i = 0; i < WORK_THREADS; i++) {
+        if (uthread_create(&threads[i], work_fn, (void *)(long)i) != 0) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < WORK_THREADS; i++) {
+        uthread_join(&threads[i], NULL);
+    }
+    return now_ns() - start;
+}
+
+static int bench_workers(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        cpus = 1;
+    }
+
+    double single_ns = work_run();
+    if (single_ns < 0 || uthread_workers((int)cpus) != 0) {
+        return -1;
+    }
+    double mn_ns = work_run();
+    if (mn_ns < 0) {
+        return -1;
+    }
+
+    printf("%-10s %d threads x %d steps: 1 kernel thread %7.1f ms  %ld workers %7.1f ms  (x%.2f)\n",
+           "workers", WORK_THREADS, WORK_STEPS, single_ns / 1e6, cpus, mn_ns / 1e6, single_ns / mn_ns);
+    return 0;
+}
+
+
+typedef struct {
+    const char *name;
+    int (*fn)(void);
+} bench_t;
+
+static const bench_t benches[] = {
+    { "yield", bench_yield },
+    { "spawn", bench_spawn },
+    { "preempt", bench_preempt },
+    { "sem", bench_sem },
+    { "chan", bench_chan },
+    { "sleep", bench_sleep },
+    { "io", bench_io },
+    { "file", bench_file },
+    { "workers", bench_workers },   // Последним: переводит процесс в режим M:N
+};
+
+#define NUM_BENCHES (int)(sizeof(benches) / sizeof(benches[0]))
+
+int main(int argc, char **argv) {
+    int failed = 0;
+
+    for (int i = 0; i < NUM_BENCHES; i++) {
+        int selected = (argc < 2);
+        for (int j = 1; j < argc; j++) {
+            if (strcmp(argv[j], benches[i].name) == 0) {
+                selected = 1;
+            }
+        }
+        if (selected && benches[i].fn() != 0) {
+            fprintf(stderr, "benchmark %s failed\n", benches[i].name);
+            failed = 1;
+        }
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,5 +1,13 @@
+#define _GNU_SOURCE
+
 #include "uthread.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 void *thread_func1(void *arg) {
     int id = *(int *)arg;
@@ -9,7 +17,7 @@ void *thread_func1(void *arg) {
         uthread_yield();
     }
     printf("  [Поток %d] Завершился\n", id);
-    return NULL;
+    return (void *)(long)(id * 10);
 }
 
 void *thread_func2(void *arg) {
@@ -20,7 +28,7 @@ void *thread_func2(void *arg) {
         uthread_yield();
     }    
     printf("  [Поток %d] Завершился\n", id);
-    return NULL;
+    return (void *)(long)(id * 10);
 }
 
 void *thread_func3(void *arg) {
@@ -31,15 +39,574 @@ void *thread_func3(void *arg) {
         uthread_yield();
     }    
     printf("  [Поток %d] Завершился\n", id);
+    return (void *)(long)(id * 10);
+}
+
+// Производитель и потребитель через буфер на мьютексе и условной
+// переменной; семафор ограничивает число одновременных "запросов"
+#define BUF_SIZE   4
+#define BUF_ITEMS  10
+
+static uthread_mutex_t buf_mutex = UTHREAD_MUTEX_INITIALIZER;
+static uthread_cond_t buf_not_empty = UTHREAD_COND_INITIALIZER;
+static uthread_cond_t buf_not_full = UTHREAD_COND_INITIALIZER;
+static int buf[BUF_SIZE];
+static int buf_count = 0;
+
+void *producer_func(void *arg) {
+    (void)arg;
+    for (int i = 1; i <= BUF_ITEMS; i++) {
+        uthread_mutex_lock(&buf_mutex);
+        while (buf_count == BUF_SIZE) {
+            uthread_cond_wait(&buf_not_full, &buf_mutex);
+        }
+        buf[buf_count++] = i;
+        uthread_cond_signal(&buf_not_empty);
+        uthread_mutex_unlock(&buf_mutex);
+    }
+    return NULL;
+}
+
+void *consumer_func(void *arg) {
+    (void)arg;
+    long sum = 0;
+    for (int i = 0; i < BUF_ITEMS; i++) {
+        uthread_mutex_lock(&buf_mutex);
+        while (buf_count == 0) {
+            uthread_cond_wait(&buf_not_empty, &buf_mutex);
+        }
+        sum += buf[--buf_count];
+        uthread_cond_signal(&buf_not_full);
+        uthread_mutex_unlock(&buf_mutex);
+    }
+    return (void *)sum;
+}
+
+#define SEM_SLOTS   2
+#define SEM_THREADS 5
+
+static uthread_sem_t slots;
+static int in_slot = 0;
+static int max_in_slot = 0;
+
+void *slot_func(void *arg) {
+    (void)arg;
+    uthread_sem_wait(&slots);
+    if (++in_slot > max_in_slot) {
+        max_in_slot = in_slot;
+    }
+    uthread_yield();  // Остальные в это время ждут на семафоре
+    in_slot--;
+    uthread_sem_post(&slots);
+    return NULL;
+}
+
+static int sync_demo(void) {
+    printf("===[ Мьютекс, условная переменная, семафор ]===\n\n");
+
+    uthread_t producer, consumer;
+    void *sum;
+    if (uthread_create(&consumer, consumer_func, NULL) != 0 ||
+        uthread_create(&producer, producer_func, NULL) != 0) {
+        return -1;
+    }
+    uthread_join(&producer, NULL);
+    uthread_join(&consumer, &sum);
+    printf("Потребитель получил сумму %ld (ожидалось %d), буфер на %d элемента\n",
+           (long)sum, BUF_ITEMS * (BUF_ITEMS + 1) / 2, BUF_SIZE);
+
+    uthread_t threads[SEM_THREADS];
+    uthread_sem_init(&slots, SEM_SLOTS);
+    for (int i = 0; i < SEM_THREADS; i++) {
+        if (uthread_create(&threads[i], slot_func, NULL) != 0) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < SEM_THREADS; i++) {
+        uthread_join(&threads[i], NULL);
+    }
+    printf("Семафор на %d: одновременно работало не больше %d из %d потоков\n\n",
+           SEM_SLOTS, max_in_slot, SEM_THREADS);
+    return 0;
+}
+
+// Конвейер на каналах: генератор -> квадрат -> main; select слушает
+// два канала и канал остановки
+#define PIPE_ITEMS 5
+
+void *gen_func(void *arg) {
+    uthread_chan_t *out = (uthread_chan_t *)arg;
+    for (int i = 1; i <= PIPE_ITEMS; i++) {
+        uthread_chan_send(out, &i);
+    }
+    uthread_chan_close(out);
+    return NULL;
+}
+
+static uthread_chan_t *square_in, *square_out;
+
+void *square_func(void *arg) {
+    (void)arg;
+    int v;
+    while (uthread_chan_recv(square_in, &v) == 0) {
+        int sq = v * v;
+        uthread_chan_send(square_out, &sq);
+    }
+    uthread_chan_close(square_out);
     return NULL;
 }
 
+static uthread_chan_t *words, *numbers, *quit;
+
+void *select_func(void *arg) {
+    (void)arg;
+    const char *word;
+    int number;
+    for (;;) {
+        uthread_chan_case_t cases[] = {
+            { words,   UTHREAD_CHAN_RECV, &word,   0 },
+            { numbers, UTHREAD_CHAN_RECV, &number, 0 },
+            { quit,    UTHREAD_CHAN_RECV, NULL,    0 },
+        };
+        switch (uthread_chan_select(cases, 3, 1)) {
+        case 0:
+            printf("  select: слово \"%s\"\n", word);
+            break;
+        case 1:
+            printf("  select: число %d\n", number);
+            break;
+        default:
+            printf("  select: канал остановки закрыт\n");
+            return NULL;
+        }
+    }
+}
+
+static int chan_demo(void) {
+    printf("===[ Каналы ]===\n\n");
+
+    uthread_t gen, square;
+    square_in = uthread_chan_of(int, 0);
+    square_out = uthread_chan_of(int, 2);
+    if (!square_in || !square_out ||
+        uthread_create(&gen, gen_func, square_in) != 0 ||
+        uthread_create(&square, square_func, NULL) != 0) {
+        return -1;
+    }
+    int v, sum = 0;
+    while (uthread_chan_recv(square_out, &v) == 0) {
+        sum += v;
+    }
+    uthread_join(&gen, NULL);
+    uthread_join(&square, NULL);
+    uthread_chan_destroy(square_in);
+    uthread_chan_destroy(square_out);
+    printf("Сумма квадратов 1..%d через конвейер: %d\n", PIPE_ITEMS, sum);
+
+    uthread_t selector;
+    words = uthread_chan_of(const char *, 0);
+    numbers = uthread_chan_of(int, 0);
+    quit = uthread_chan_create(0, 0);
+    if (!words || !numbers || !quit || uthread_create(&selector, select_func, NULL) != 0) {
+        return -1;
+    }
+    const char *word = "канал";
+    int number = 42;
+    uthread_chan_send(words, &word);
+    uthread_chan_send(numbers, &number);
+    uthread_chan_close(quit);
+    uthread_join(&selector, NULL);
+    uthread_chan_destroy(words);
+    uthread_chan_destroy(numbers);
+    uthread_chan_destroy(quit);
+    printf("\n");
+    return 0;
+}
+
+// Ждёт флага, не уступая процессор: без вытеснения второй поток
+// никогда бы не запустился
+static volatile int spin_flag = 0;
+
+void *spin_func(void *arg) {
+    (void)arg;
+    unsigned long spins = 0;
+    while (!spin_flag) {
+        spins++;
+    }
+    return (void *)spins;
+}
+
+void *flag_func(void *arg) {
+    (void)arg;
+    spin_flag = 1;
+    return NULL;
+}
+
+static int preempt_demo(void) {
+    printf("===[ Вытеснение по таймеру ]===\n\n");
+
+    if (uthread_preempt(1000) != 0) {
+        if (errno == ENOTSUP) {
+            printf("Вытеснение не поддерживается на этой архитектуре\n\n");
+            return 0;
+        }
+        perror("uthread_preempt");
+        return -1;
+    }
+
+    uthread_t spinner, setter;
+    void *spins;
+    if (uthread_create(&spinner, spin_func, NULL) != 0 ||
+        uthread_create(&setter, flag_func, NULL) != 0) {
+        return -1;
+    }
+    uthread_join(&spinner, &spins);
+    uthread_join(&setter, NULL);
+    uthread_preempt(0);
+
+    printf("Поток без yield вытеснен, второй поток поднял флаг (%lu итераций ожидания)\n\n",
+           (unsigned long)spins);
+    return 0;
+}
+
+// Потоки засыпают в обратном порядке сроков - просыпаться должны по сроку
+#define SLEEPERS    4
+#define SLEEP_STEP  (5 * 1000000ull)   // 5 мс
+
+static int wake_order[SLEEPERS];
+static int woken = 0;
+
+void *sleeper_func(void *arg) {
+    int n = *(int *)arg;
+    uthread_sleep((uint64_t)n * SLEEP_STEP);
+    wake_order[woken++] = n;
+    return NULL;
+}
+
+static uthread_sem_t never_posted;
+
+void *timeout_func(void *arg) {
+    (void)arg;
+    uint64_t start = uthread_now();
+    if (uthread_sem_timedwait(&never_posted, start + SLEEP_STEP) == 0 || errno != ETIMEDOUT) {
+        return (void *)-1L;
+    }
+    return (void *)(long)((uthread_now() - start) / 1000);
+}
+
+static int sleep_demo(void) {
+    printf("===[ Сон и ожидание со сроком ]===\n\n");
+
+    uthread_t threads[SLEEPERS], waiter;
+    int ids[SLEEPERS];
+    for (int i = 0; i < SLEEPERS; i++) {
+        ids[i] = SLEEPERS - i;
+        if (uthread_create(&threads[i], sleeper_func, &ids[i]) != 0) {
+            return -1;
+        }
+    }
+    uthread_sem_init(&never_posted, 0);
+    if (uthread_create(&waiter, timeout_func, NULL) != 0) {
+        return -1;
+    }
+
+    // main тоже спит - и все ждут в ядре одного ближайшего срока
+    uint64_t start = uthread_now();
+    uthread_sleep(SLEEP_STEP / 2);
+    printf("main проспала %llu мкс (просила %llu)\n",
+           (unsigned long long)((uthread_now() - start) / 1000),
+           (unsigned long long)(SLEEP_STEP / 2000));
+
+    void *waited;
+    for (int i = 0; i < SLEEPERS; i++) {
+        uthread_join(&threads[i], NULL);
+    }
+    uthread_join(&waiter, &waited);
+    if ((long)waited < 0) {
+        return -1;
+    }
+
+    printf("Порядок пробуждения (срок - номер x %llu мс):",
+           (unsigned long long)(SLEEP_STEP / 1000000));
+    for (int i = 0; i < SLEEPERS; i++) {
+        printf(" %d", wake_order[i]);
+    }
+    printf("\nsem_timedwait без post: ETIMEDOUT через %ld мкс\n\n", (long)waited);
+
+    // Сроки разнесены на SLEEP_STEP - будить обязаны строго по порядку
+    for (int i = 0; i < SLEEPERS; i++) {
+        if (wake_order[i] != i + 1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Читатель ждёт пустой pipe, а ядерный поток тем временем выполняет
+// остальных; эхо-сервер на unix-сокете - поток на соединение
+#define TICKER_STEPS 1000
+#define ECHO_CLIENTS 8
+
+static int demo_pipe[2];
+static int ticks = 0;
+
+void *pipe_reader_func(void *arg) {
+    (void)arg;
+    char buf[16];
+    if (uthread_read(demo_pipe[0], buf, sizeof(buf)) <= 0) {
+        return (void *)-1L;
+    }
+    return (void *)(long)ticks;
+}
+
+void *ticker_func(void *arg) {
+    (void)arg;
+    for (int i = 0; i < TICKER_STEPS; i++) {
+        ticks++;
+        uthread_yield();
+    }
+    uthread_write(demo_pipe[1], "done", 4);
+    return NULL;
+}
+
+void *echo_conn_func(void *arg) {
+    int fd = (int)(long)arg;
+    char buf[64];
+    ssize_t n;
+    while ((n = uthread_read(fd, buf, sizeof(buf))) > 0) {
+        uthread_write(fd, buf, n);
+    }
+    uthread_close(fd);
+    return NULL;
+}
+
+void *echo_server_func(void *arg) {
+    int listener = (int)(long)arg;
+    uthread_t conns[ECHO_CLIENTS];
+    for (int i = 0; i < ECHO_CLIENTS; i++) {
+        int fd = uthread_accept(listener, NULL, NULL);
+        if (fd < 0 || uthread_create(&conns[i], echo_conn_func, (void *)(long)fd) != 0) {
+            return (void *)-1L;
+        }
+    }
+    for (int i = 0; i < ECHO_CLIENTS; i++) {
+        uthread_join(&conns[i], NULL);
+    }
+    return NULL;
+}
+
+void *echo_client_func(void *arg) {
+    const struct sockaddr_un *addr = (const struct sockaddr_un *)arg;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) != 0) {
+        return (void *)-1L;
+    }
+    char msg[] = "ping", reply[sizeof(msg)];
+    long ok = uthread_write(fd, msg, sizeof(msg)) == sizeof(msg) &&
+              uthread_read(fd, reply, sizeof(reply)) == sizeof(reply) &&
+              memcmp(msg, reply, sizeof(msg)) == 0;
+    uthread_close(fd);
+    return (void *)ok;
+}
+
+static int io_demo(void) {
+    printf("===[ Ввод-вывод через epoll ]===\n\n");
+
+    uthread_t reader, ticker;
+    void *seen;
+    if (pipe(demo_pipe) != 0 ||
+        uthread_create(&reader, pipe_reader_func, NULL) != 0 ||
+        uthread_create(&ticker, ticker_func, NULL) != 0) {
+        return -1;
+    }
+    uthread_join(&reader, &seen);
+    uthread_join(&ticker, NULL);
+    uthread_close(demo_pipe[0]);
+    uthread_close(demo_pipe[1]);
+    printf("Читатель пустого pipe проснулся после %ld шагов другого потока\n", (long)seen);
+
+    // Абстрактный адрес (sun_path начинается с нуля) - без файла на диске
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "uthread-demo-%d", (int)getpid());
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listener, ECHO_CLIENTS) != 0) {
+        perror("unix socket");
+        return -1;
+    }
+
+    uthread_t server, clients[ECHO_CLIENTS];
+    void *failed;
+    if (uthread_create(&server, echo_server_func, (void *)(long)listener) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < ECHO_CLIENTS; i++) {
+        if (uthread_create(&clients[i], echo_client_func, &addr) != 0) {
+            return -1;
+        }
+    }
+    long echoed = 0;
+    for (int i = 0; i < ECHO_CLIENTS; i++) {
+        void *ok;
+        uthread_join(&clients[i], &ok);
+        echoed += (long)ok == 1;
+    }
+    uthread_join(&server, &failed);
+    uthread_close(listener);
+    if (failed || echoed != ECHO_CLIENTS) {
+        return -1;
+    }
+    printf("Эхо-сервер на unix-сокете ответил %ld из %d клиентов\n\n", echoed, ECHO_CLIENTS);
+    return 0;
+}
+
+// Потоки пишут и читают свои блоки одного файла через io_uring; пока
+// операции в ядре, счётчик продолжает шагать
+#define FILE_BLOCKS 8
+#define FILE_BLOCK  4096
+
+static int demo_file;
+static volatile int file_busy;
+
+void *file_block_func(void *arg) {
+    long i = (long)arg;
+    char out[FILE_BLOCK], in[FILE_BLOCK];
+    memset(out, 'a' + (int)i, sizeof(out));
+    off_t off = (off_t)i * FILE_BLOCK;
+    long ok = uthread_pwrite(demo_file, out, sizeof(out), off) == sizeof(out) &&
+              uthread_fsync(demo_file) == 0 &&
+              uthread_pread(demo_file, in, sizeof(in), off) == sizeof(in) &&
+              memcmp(out, in, sizeof(out)) == 0;
+    __atomic_sub_fetch(&file_busy, 1, __ATOMIC_RELAXED);
+    return (void *)ok;
+}
+
+void *file_ticker_func(void *arg) {
+    (void)arg;
+    long steps = 0;
+    while (__atomic_load_n(&file_busy, __ATOMIC_RELAXED)) {
+        steps++;
+        uthread_yield();
+    }
+    return (void *)steps;
+}
+
+static int file_demo(void) {
+    printf("===[ Файловый ввод-вывод через io_uring ]===\n\n");
+
+    char path[] = "/tmp/uthread-demo-XXXXXX";
+    demo_file = mkstemp(path);
+    if (demo_file < 0) {
+        perror("mkstemp");
+        return -1;
+    }
+    unlink(path);
+
+    uthread_t blocks[FILE_BLOCKS], ticker;
+    file_busy = FILE_BLOCKS;
+    for (long i = 0; i < FILE_BLOCKS; i++) {
+        if (uthread_create(&blocks[i], file_block_func, (void *)i) != 0) {
+            return -1;
+        }
+    }
+    if (uthread_create(&ticker, file_ticker_func, NULL) != 0) {
+        return -1;
+    }
+    long good = 0;
+    for (int i = 0; i < FILE_BLOCKS; i++) {
+        void *ok;
+        uthread_join(&blocks[i], &ok);
+        good += (long)ok == 1;
+    }
+    void *steps;
+    uthread_join(&ticker, &steps);
+    close(demo_file);
+    if (good != FILE_BLOCKS) {
+        return -1;
+    }
+    printf("%d блоков записано, сброшено на диск и прочитано обратно;\n"
+           "другой поток тем временем сделал %ld шагов\n\n", FILE_BLOCKS, (long)steps);
+    return 0;
+}
+
+// Поток считает, сколько раз продолжал после yield на другом ядерном потоке.
+// Между yield он считает MN_BURN_NS: пока воркер занят, остальные успевают
+// проснуться и украсть ждущих в его очереди - даже на одном процессоре
+#define MN_WORKERS 4
+#define MN_THREADS 8
+#define MN_STEPS   50
+#define MN_BURN_NS 200000ull
+
+void *migrate_func(void *arg) {
+    (void)arg;
+    long moves = 0;
+    pid_t tid = gettid();
+    for (int i = 0; i < MN_STEPS; i++) {
+        uint64_t until = uthread_now() + MN_BURN_NS;
+        while (uthread_now() < until) {
+        }
+        uthread_yield();
+        if (gettid() != tid) {
+            tid = gettid();
+            moves++;
+        }
+    }
+    return (void *)moves;
+}
+
+// Все потоки создаются в очереди одного воркера - остальные их крадут
+void *spawn_func(void *arg) {
+    (void)arg;
+    uthread_t threads[MN_THREADS];
+    for (int i = 0; i < MN_THREADS; i++) {
+        if (uthread_create(&threads[i], migrate_func, NULL) != 0) {
+            return (void *)-1L;
+        }
+    }
+    long moves = 0;
+    for (int i = 0; i < MN_THREADS; i++) {
+        void *retval;
+        uthread_join(&threads[i], &retval);
+        moves += (long)retval;
+    }
+    return (void *)moves;
+}
+
+// Последней: после uthread_workers main сама потоки не выполняет
+static int workers_demo(void) {
+    printf("===[ Режим M:N ]===\n\n");
+
+    if (uthread_workers(MN_WORKERS) != 0) {
+        perror("uthread_workers");
+        return -1;
+    }
+
+    uthread_t spawner;
+    void *moves;
+    if (uthread_create(&spawner, spawn_func, NULL) != 0 ||
+        uthread_join(&spawner, &moves) != 0 || (long)moves < 0) {
+        return -1;
+    }
+
+    printf("%d потоков на %d воркерах, переходов между ядерными потоками: %ld\n\n",
+           MN_THREADS, MN_WORKERS, (long)moves);
+    if ((long)moves == 0) {
+        return -1;  // Никого не украли - остальные воркеры простаивали
+    }
+    return 0;
+}
+
 int main() {
     printf("\n\n===[ Демонстрация пользовательских потоков ]===\n\n");
     
     uthread_t t1, t2, t3;
     int id1 = 1, id2 = 2, id3 = 3;
     
+    // Заодно смотрим, сколько из 16 КБ стека реально нужно потокам
+    uthread_stack_profile(1);
+
     printf("Создание потоков...\n");
     if (uthread_create(&t1, thread_func1, &id1) != 0) {
         fprintf(stderr, "Ошибка создания потока 1\n");
@@ -59,7 +626,60 @@ int main() {
     printf("\nЗапуск планировщика...\n\n");
     uthread_yield();
     
-    printf("\n=== Все потоки завершились ===\n\n\n");
+    printf("\n=== Все потоки завершились ===\n\n");
+
+    // Результаты забираем join - стеки уходят в пул библиотеки
+    uthread_t *threads[] = { &t1, &t2, &t3 };
+    for (int i = 0; i < 3; i++) {
+        void *retval;
+        if (uthread_join(threads[i], &retval) != 0) {
+            fprintf(stderr, "Ошибка join потока %d\n", i + 1);
+            return 1;
+        }
+        printf("Поток %d вернул %ld\n", i + 1, (long)retval);
+    }
+    printf("\n");
+
+    printf("Глубина стека: поток 1 - %zu, поток 2 - %zu, поток 3 - %zu байт\n\n",
+           t1.stack_used, t2.stack_used, t3.stack_used);
+    fflush(stdout);
+    uthread_stack_report(1);
+    printf("\n\n");
+
+    if (sync_demo() != 0) {
+        fprintf(stderr, "Ошибка демонстрации синхронизации\n");
+        return 1;
+    }
+
+    if (chan_demo() != 0) {
+        fprintf(stderr, "Ошибка демонстрации каналов\n");
+        return 1;
+    }
+
+    if (preempt_demo() != 0) {
+        fprintf(stderr, "Ошибка демонстрации вытеснения\n");
+        return 1;
+    }
+
+    if (sleep_demo() != 0) {
+        fprintf(stderr, "Ошибка демонстрации сна\n");
+        return 1;
+    }
+
+    if (io_demo() != 0) {
+        fprintf(stderr, "Ошибка демонстрации ввода-вывода\n");
+        return 1;
+    }
+
+    if (file_demo() != 0) {
+        fprintf(stderr, "Ошибка демонстрации файлового ввода-вывода\n");
+        return 1;
+    }
+
+    if (workers_demo() != 0) {
+        fprintf(stderr, "Ошибка демонстрации M:N\n");
+        return 1;
+    }
     
     return 0;
 }
\ No newline at end of file
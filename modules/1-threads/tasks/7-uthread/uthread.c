@@ -1,117 +1,3001 @@
+#define _GNU_SOURCE
+
 #include "uthread.h"
+#include <dlfcn.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <link.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
 
 #define STACK_SIZE (16 * 1024)
+#define POOL_MAX   256   // Сколько свободных узлов со стеками держать про запас (на воркер)
 
+#define PROFILE_BYTE     0x5a
+#define PROFILE_PATTERN  0x5a5a5a5a5a5a5a5aULL
+#define PROFILE_ROUTINES 32
 
-static uthread_node_t *thread_list = NULL;
-static uthread_node_t *current_thread = NULL;
-static ucontext_t main_context;
-static int scheduler_started = 0;
+#define PREEMPT_SIGNAL    SIGALRM
+#define PREEMPT_MAX_CODE  32  // Сегментов кода разделяемых библиотек
 
+#define SPIN_LIMIT        100  // Итераций ожидания спинлока до sched_yield
+#define RUNNEXT_STREAK    16   // Передач подряд через runnext, потом - очередь
 
-static void thread_wrapper(void *(*start_routine)(void*), void *arg) {
-    void *retval = start_routine(arg);
-    uthread_exit(retval);
+#define SELECT_MAX        16   // Вариантов в uthread_chan_select (заявки - на стеке потока)
+
+#define TICK_SHIFT        16   // Тик колеса таймеров - 2^16 нс (65.5 мкс)
+#define WHEEL_BITS        6
+#define WHEEL_SLOTS       (1 << WHEEL_BITS)
+#define WHEEL_LEVELS      5    // 2^(16 + 30) нс - около 19 часов, дальше срок раскладывается повторно
+
+#define IO_CHUNK          1024  // Описателей fd в блоке таблицы
+#define IO_CHUNKS         1024  // Блоков: fd до 2^20
+#define IO_EVENTS         64    // Событий за один epoll_wait
+#define IO_POLL_INTERVAL  (1ull << TICK_SHIFT)  // Опрос epoll без ожидания - не чаще раза в тик
+
+#define URING_ENTRIES     256   // Заявок в очереди io_uring
+
+// Ожидающий в uthread_join - не поток планировщика, а main при работающих
+// воркерах: он спит на futex, а не в очереди
+#define JOINER_EXTERNAL ((uthread_node_t *)1)
+
+
+// Что сделать с уходящим потоком, когда его контекст уже сохранён.
+// При нескольких воркерах раньше нельзя: поток, поставленный в очередь
+// до переключения, другой воркер мог бы запустить с недосохранённым стеком
+typedef enum {
+    AFTER_NONE,
+    AFTER_READY,     // Встать в очередь готовых (yield, вытеснение)
+    AFTER_PARK,      // Ждать завершения after_target (join)
+    AFTER_EXIT,      // Поток завершился
+    AFTER_UNLOCK     // Поток ждёт объектов или срока: завести таймер, отпустить спинлоки
+} after_t;
+
+struct worker;
+
+typedef enum {
+    TIMER_IDLE,
+    TIMER_PENDING,   // В колесе
+    TIMER_FIRING     // Снят с колеса, fire ещё выполняется
+} timer_state_t;
+
+// Таймер лежит на стеке ждущего потока. fire вызывается воркером-владельцем
+// колеса без его спинлока: ждущий, проснувшись, дожидается TIMER_IDLE
+typedef struct utimer {
+    uint64_t tick;                  // Срок в тиках (округлён вверх)
+    struct utimer *prev;
+    struct utimer *next;
+    struct utimer **slot;
+    struct worker *owner;           // В чьём колесе (NULL - таймер не заводился)
+    volatile int state;
+    void (*fire)(struct worker *w, uthread_node_t *node, void *arg);
+    uthread_node_t *node;
+    void *arg;
+} utimer_t;
+
+// Иерархическое колесо: уровень L делит время на слоты по 64^L тиков.
+// Вставка и отмена - O(1); таймер старшего уровня при наступлении своего
+// слота переносится на уровень ниже
+typedef struct {
+    utimer_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t now_tick;              // Тики до него включительно обработаны
+    volatile size_t count;
+    volatile int lock;              // Отмена с других воркеров (у main_worker без блокировки)
+} timer_wheel_t;
+
+// Ядерный поток, выполняющий потоки uthread, со своей очередью готовых
+typedef struct worker {
+    uthread_queue_t queue;
+    volatile int lock;              // Очередь (у main_worker без блокировки)
+    uthread_node_t *runnext;        // Разбуженный каналом - выполняется следующим
+    int runnext_streak;
+    unsigned select_seq;            // С какого варианта select начинает проверку
+    uthread_node_t *current;
+    uthread_node_t *idle;           // Цикл планировщика: куда уйти, когда готовых нет
+
+    after_t after;
+    uthread_node_t *after_node;
+    uthread_node_t *after_target;
+    volatile int **after_locks;
+    int after_nlocks;
+    utimer_t *after_timer;
+
+    // Сроки спящих потоков этого воркера
+    timer_wheel_t wheel;
+
+    // Свободные узлы со стеками
+    uthread_node_t *pool;
+    size_t pool_size;
+
+    // Вытеснение: глубина запрета (библиотека или критическая секция
+    // пользователя), отложенное переключение и тики таймера текущего кванта
+    volatile sig_atomic_t preempt_depth;
+    volatile sig_atomic_t preempt_pending;
+    volatile sig_atomic_t slice_ticks;
+    timer_t preempt_timer;
+    int preempt_active;
+} worker_t;
+
+
+// main - такой же поток планировщика, только со своим стеком
+static uthread_node_t main_node;
+static int main_idle = 0;           // main ждёт в uthread_yield, пока есть готовые
+
+// Без uthread_workers все потоки выполняет main_worker - ядерный поток,
+// вызывающий uthread_*. После uthread_workers он только создаёт потоки
+// и ждёт их, а выполняют их воркеры пула
+static worker_t main_worker = { .current = &main_node };
+static __thread worker_t *tls_worker __attribute__((tls_model("initial-exec")));
+
+static worker_t *workers = NULL;
+static int num_workers = 0;
+static volatile int workers_started = 0;
+static unsigned next_worker = 0;        // Куда main кладёт следующий поток
+
+static volatile int idle_workers = 0;   // Воркеры, спящие на idle_seq
+static volatile int idle_seq = 0;
+static volatile int join_seq = 0;       // Будит main, ждущую в uthread_join
+static volatile int runnable = 0;       // Потоки (без main) в очередях и на процессоре
+static volatile int main_waiting = 0;   // main ждёт runnable == 0 в uthread_yield
+static volatile int main_wakeup = 0;    // main при воркерах ждёт мьютекс, условие или семафор
+
+static volatile int io_waiting = 0;     // Потоки, ждущие готовности fd
+static volatile int uring_inflight = 0; // Потоки, ждущие завершения в io_uring
+static volatile int io_poller = 0;      // 1 - воркер ждёт в epoll_wait, 2 - его уже будят
+
+static unsigned preempt_quantum_us = 0;  // Для воркеров, запущенных после uthread_preempt
+
+static int stack_profile = 0;
+static volatile int profile_lock = 0;
+
+
+// Воркер текущего ядерного потока. После любого переключения поток может
+// оказаться на другом воркере - указатель нужно перечитать
+static inline worker_t *this_worker(void) {
+    worker_t *w = tls_worker;
+    return w ? w : &main_worker;
 }
 
 
-int uthread_create(uthread_t *thread, void *(*start_routine)(void*), void *arg) {
-    if (!thread || !start_routine) {
-        return -1;
+static long futex(volatile int *addr, int op, int val) {
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+
+// FUTEX_WAIT до момента deadline по CLOCK_MONOTONIC (UINT64_MAX - без срока)
+static void futex_wait_until(volatile int *addr, int val, uint64_t deadline) {
+    if (deadline == UINT64_MAX) {
+        futex(addr, FUTEX_WAIT_PRIVATE, val);
+        return;
     }
-    
-    thread->stack = malloc(STACK_SIZE);
-    if (!thread->stack) {
-        perror("malloc");
-        return -1;
+    struct timespec ts = { (time_t)(deadline / 1000000000), (long)(deadline % 1000000000) };
+    syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE, val, &ts, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+
+uint64_t uthread_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);  // vDSO, без системного вызова
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+
+static inline void spin_lock(volatile int *lock) {
+    int spins = 0;
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+            if (++spins < SPIN_LIMIT) {
+                cpu_relax();
+            } else {
+                sched_yield();  // Владелец мог потерять процессор
+                spins = 0;
+            }
+        }
     }
-    
-    thread->state = UTHREAD_RUNNING;
-    thread->retval = NULL;
-    
-    if (getcontext(&thread->context) == -1) {
-        perror("getcontext");
-        free(thread->stack);
-        return -1;
+}
+
+
+static inline void spin_unlock(volatile int *lock) {
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+// Сводка по start_routine (последняя запись - все остальные)
+static struct {
+    void *(*fn)(void*);
+    size_t threads;
+    size_t max_peak;
+    size_t total_peak;
+} profile[PROFILE_ROUTINES + 1];
+static size_t profile_used = 0;
+
+
+void uthread_stack_profile(int enable) {
+    stack_profile = enable;
+}
+
+
+// Стек растёт вниз: снизу остаётся нетронутый шаблон
+static size_t stack_peak(const void *stack) {
+    const uint64_t *word = (const uint64_t *)stack;
+    const uint64_t *end = (const uint64_t *)((const char *)stack + STACK_SIZE);
+
+    while (word < end && *word == PROFILE_PATTERN) {
+        word++;
     }
-    
-    thread->context.uc_stack.ss_sp = thread->stack;
-    thread->context.uc_stack.ss_size = STACK_SIZE;
-    thread->context.uc_link = NULL;
-    
-    makecontext(&thread->context, (void(*)())thread_wrapper, 2, start_routine, arg);
-    
-    uthread_node_t *node = malloc(sizeof(uthread_node_t));
-    if (!node) {
-        perror("malloc");
-        free(thread->stack);
-        return -1;
+    return (size_t)((const char *)end - (const char *)word);
+}
+
+
+static void profile_record(void *(*fn)(void*), size_t peak) {
+    spin_lock(&profile_lock);  // Потоки завершаются на разных воркерах
+
+    size_t i = 0;
+    while (i < profile_used && profile[i].fn != fn) {
+        i++;
     }
-    
-    node->thread = *thread;
-    
-    if (thread_list == NULL) {
-        thread_list = node;
-        node->next = node;
+    if (i == profile_used) {
+        if (profile_used < PROFILE_ROUTINES) {
+            profile[profile_used++].fn = fn;
+        } else {
+            i = PROFILE_ROUTINES;
+        }
+    }
+
+    profile[i].threads++;
+    profile[i].total_peak += peak;
+    if (peak > profile[i].max_peak) {
+        profile[i].max_peak = peak;
+    }
+    spin_unlock(&profile_lock);
+}
+
+
+void uthread_stack_report(int fd) {
+    dprintf(fd, "%-20s %8s %10s %10s %10s\n",
+            "start_routine", "threads", "max bytes", "avg bytes", "stack");
+    for (size_t i = 0; i <= PROFILE_ROUTINES; i++) {
+        if (profile[i].threads == 0) {
+            continue;
+        }
+        // Имена функций программы видны только с -rdynamic
+        char buf[32];
+        const char *name = "other";
+        Dl_info info;
+        if (i < PROFILE_ROUTINES) {
+            if (dladdr((void *)profile[i].fn, &info) && info.dli_sname) {
+                name = info.dli_sname;
+            } else {
+                snprintf(buf, sizeof(buf), "%p", (void *)profile[i].fn);
+                name = buf;
+            }
+        }
+        dprintf(fd, "%-20s %8zu %10zu %10zu %10d\n", name, profile[i].threads,
+                profile[i].max_peak, profile[i].total_peak / profile[i].threads, STACK_SIZE);
+    }
+}
+
+
+static void report_at_exit(void) {
+    uthread_stack_report(STDERR_FILENO);
+}
+
+
+__attribute__((constructor))
+static void profile_init(void) {
+    const char *env = getenv("UTHREAD_STACK_PROFILE");
+    if (env && *env && strcmp(env, "0") != 0) {
+        stack_profile = 1;
+        atexit(report_at_exit);
+    }
+}
+
+
+// Переключение контекста.
+//
+// swapcontext сохраняет и восстанавливает маску сигналов системным вызовом
+// rt_sigprocmask на каждом переключении. Потокам планировщика маска общая,
+// поэтому на x86-64 сохраняем только то, что по ABI обязана сохранить
+// вызываемая функция: rbx, rbp, r12-r15, управляющие слова MXCSR и x87 -
+// на стек уходящего потока, а в контекст - указатель стека.
+#if defined(__x86_64__)
+
+void uthread_context_switch(uthread_context_t *from, uthread_context_t *to);
+void uthread_context_start(void);
+
+__asm__(
+    ".text\n"
+    ".globl uthread_context_switch\n"
+    ".hidden uthread_context_switch\n"
+    ".type uthread_context_switch, @function\n"
+    "uthread_context_switch:\n"          // rdi = from, rsi = to
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq (%rsi), %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size uthread_context_switch, .-uthread_context_switch\n"
+    "\n"
+    // Первый переход в новый поток: ret из uthread_context_switch попадает
+    // сюда, функция и её аргументы лежат в rbx, r12, r13
+    ".globl uthread_context_start\n"
+    ".hidden uthread_context_start\n"
+    ".type uthread_context_start, @function\n"
+    "uthread_context_start:\n"
+    "    movq %r12, %rdi\n"
+    "    movq %r13, %rsi\n"
+    "    callq *%rbx\n"
+    "    ud2\n"                          // Функция потока не возвращается
+    ".size uthread_context_start, .-uthread_context_start\n"
+);
+
+// Начальный кадр: то, что снимет uthread_context_switch, и адрес возврата
+typedef struct {
+    uint32_t mxcsr;
+    uint16_t fpu_cw;
+    uint16_t pad;
+    uint64_t r15, r14, r13, r12, rbx, rbp;
+    void   (*ret)(void);
+} start_frame_t;
+
+static void context_init(uthread_context_t *ctx, void *stack, size_t size,
+                         void (*fn)(void *, void *), void *a, void *b) {
+    // После ret в трамплин указатель стека - top: перед его call он кратен 16
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    start_frame_t *frame = (start_frame_t *)(top - sizeof(start_frame_t));
+
+    memset(frame, 0, sizeof(*frame));
+    __asm__ volatile("stmxcsr %0" : "=m"(frame->mxcsr));
+    __asm__ volatile("fnstcw %0" : "=m"(frame->fpu_cw));
+    frame->rbx = (uint64_t)(uintptr_t)fn;
+    frame->r12 = (uint64_t)(uintptr_t)a;
+    frame->r13 = (uint64_t)(uintptr_t)b;
+    frame->ret = uthread_context_start;
+    ctx->sp = frame;
+}
+
+static inline void context_switch(uthread_context_t *from, uthread_context_t *to) {
+    uthread_context_switch(from, to);
+}
+
+#else
+
+// Остальные архитектуры - через ucontext (с системным вызовом на переключение)
+static void context_init(uthread_context_t *ctx, void *stack, size_t size,
+                         void (*fn)(void *, void *), void *a, void *b) {
+    getcontext(&ctx->uc);
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = size;
+    ctx->uc.uc_link = NULL;
+    makecontext(&ctx->uc, (void(*)())fn, 2, a, b);
+}
+
+static inline void context_switch(uthread_context_t *from, uthread_context_t *to) {
+    swapcontext(&from->uc, &to->uc);
+}
+
+#endif
+
+
+// --- Очередь готовых потоков ---
+
+static void queue_push(uthread_queue_t *q, uthread_node_t *node) {
+    node->next = NULL;
+    if (q->tail) {
+        q->tail->next = node;
     } else {
-        uthread_node_t *last = thread_list;
-        while (last->next != thread_list) {
-            last = last->next;
+        q->head = node;
+    }
+    q->tail = node;
+}
+
+
+static uthread_node_t *queue_pop(uthread_queue_t *q) {
+    uthread_node_t *node = q->head;
+    if (node) {
+        q->head = node->next;
+        if (!q->head) {
+            q->tail = NULL;
         }
-        node->next = thread_list;
-        last->next = node;
+        node->next = NULL;
+    }
+    return node;
+}
+
+
+// Снимает node из середины очереди - за O(n), нужно только по таймауту.
+// 0 - его в очереди уже нет
+static int queue_remove(uthread_queue_t *q, uthread_node_t *node) {
+    uthread_node_t *prev = NULL;
+    for (uthread_node_t *cur = q->head; cur; prev = cur, cur = cur->next) {
+        if (cur != node) {
+            continue;
+        }
+        if (prev) {
+            prev->next = node->next;
+        } else {
+            q->head = node->next;
+        }
+        if (q->tail == node) {
+            q->tail = prev;
+        }
+        node->next = NULL;
+        return 1;
     }
-    
     return 0;
 }
 
 
-void uthread_yield(void) {
-    if (!thread_list) {
-        return;
+// --- Пул узлов со стеками ---
+
+static uthread_node_t *node_alloc(worker_t *w) {
+    uthread_node_t *node = w->pool;
+    if (node) {
+        w->pool = node->next;
+        w->pool_size--;
+        return node;
     }
-    
-    if (!scheduler_started) {
-        scheduler_started = 1;
-        current_thread = thread_list;
-    
-        swapcontext(&main_context, &current_thread->thread.context);
-        return;
+
+    node = malloc(sizeof(uthread_node_t));
+    if (!node) {
+        return NULL;
     }
-    
-    uthread_node_t *prev = current_thread;
-    uthread_node_t *next = current_thread->next;
-    
-    while (next->thread.state == UTHREAD_FINISHED && next != current_thread) {
-        next = next->next;
+    node->stack = malloc(STACK_SIZE);
+    if (!node->stack) {
+        free(node);
+        return NULL;
     }
-    
-    if (next->thread.state == UTHREAD_FINISHED && next == current_thread) {
-        setcontext(&main_context);
+    return node;
+}
+
+
+// Узел можно вернуть в пул любого воркера - стек уже никем не занят
+static void node_release(worker_t *w, uthread_node_t *node) {
+    if (w->pool_size < POOL_MAX) {
+        node->next = w->pool;
+        w->pool = node;
+        w->pool_size++;
+    } else {
+        free(node->stack);
+        free(node);
+    }
+}
+
+
+// --- Воркеры ---
+//
+// У каждого воркера своя очередь готовых. Поток, уступивший процессор,
+// встаёт в очередь своего воркера; воркер без готовых потоков забирает
+// первый поток из чужой очереди, так потоки переходят между ядерными
+// потоками. Очереди пула защищены спинлоками; очередь main_worker
+// видит только он сам, поэтому в однопоточном режиме блокировок нет.
+
+static inline int worker_shared(const worker_t *w) {
+    return w != &main_worker;
+}
+
+
+// Счётчик нужен только main, ждущей воркеров в uthread_yield. До их
+// запуска ни один поток, кроме main, не выполняется, поэтому отсчёт с
+// нуля в момент запуска точен - а однопоточный режим не платит за атомики
+static void runnable_inc(uthread_node_t *node) {
+    if (workers_started && node != &main_node) {
+        __atomic_add_fetch(&runnable, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+static void runnable_dec(uthread_node_t *node) {
+    if (workers_started && node != &main_node &&
+        __atomic_sub_fetch(&runnable, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&main_waiting, __ATOMIC_SEQ_CST)) {
+        futex(&runnable, FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+}
+
+
+// Будит один спящий воркер: в очереди появился поток, который можно украсть
+// Реактор ввода-вывода - в конце файла
+static void io_break(void);
+static void io_poll(worker_t *w, uint64_t deadline);
+static void io_poll_periodic(worker_t *w);
+static void uring_flush(void);
+static void uring_reap(worker_t *w);
+
+
+static void wake_idle_worker(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&idle_workers, __ATOMIC_RELAXED) > 0) {
+        __atomic_add_fetch(&idle_seq, 1, __ATOMIC_RELEASE);
+        futex(&idle_seq, FUTEX_WAKE_PRIVATE, 1);
+        // Воркер в epoll_wait futex не разбудит
+        int polling = 1;
+        if (__atomic_compare_exchange_n(&io_poller, &polling, 2, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            io_break();
+        }
+    }
+}
+
+
+static void ready_push(worker_t *w, uthread_node_t *node) {
+    if (!worker_shared(w)) {
+        queue_push(&w->queue, node);
         return;
     }
-    
-    if (current_thread->thread.state == UTHREAD_FINISHED) {
-        current_thread = next;
-        setcontext(&current_thread->thread.context);
+    spin_lock(&w->lock);
+    queue_push(&w->queue, node);
+    spin_unlock(&w->lock);
+    wake_idle_worker();
+}
+
+
+static uthread_node_t *ready_pop(worker_t *w) {
+    if (!worker_shared(w)) {
+        return queue_pop(&w->queue);
+    }
+    if (!__atomic_load_n(&w->queue.head, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    spin_lock(&w->lock);
+    uthread_node_t *node = queue_pop(&w->queue);
+    spin_unlock(&w->lock);
+    return node;
+}
+
+
+// Сначала поток из runnext - его разбудил канал, и данные ещё в кэше.
+// Но не больше RUNNEXT_STREAK раз подряд: пара потоков, передающих
+// друг другу данные, иначе никогда не пустила бы очередь
+static uthread_node_t *next_ready(worker_t *w) {
+    uthread_node_t *node = w->runnext;
+    if (node) {
+        w->runnext = NULL;
+        if (w->runnext_streak++ < RUNNEXT_STREAK) {
+            return node;
+        }
+        ready_push(w, node);
+    }
+    w->runnext_streak = 0;
+    return ready_pop(w);
+}
+
+
+static inline int has_ready(const worker_t *w) {
+    return w->runnext || w->queue.head;
+}
+
+
+// Обходит остальных воркеров пула, начиная со следующего за собой
+static uthread_node_t *steal(worker_t *w) {
+    if (!worker_shared(w)) {
+        return NULL;
+    }
+    int self = (int)(w - workers);
+    for (int i = 1; i < num_workers; i++) {
+        uthread_node_t *node = ready_pop(&workers[(self + i) % num_workers]);
+        if (node) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+
+static int any_ready(void) {
+    for (int i = 0; i < num_workers; i++) {
+        if (__atomic_load_n(&workers[i].queue.head, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+// --- Таймеры ---
+//
+// У каждого воркера своё колесо сроков. Заводит таймер и выполняет
+// сработавшие только сам воркер - после каждого переключения, когда
+// спинлоки объектов уже отпущены. Другие воркеры только отменяют таймеры
+// проснувшихся потоков, поэтому спинлок колеса почти не конкурентный.
+// Воркер без готовых потоков спит до ближайшего срока.
+
+static inline uint64_t deadline_tick(uint64_t deadline) {
+    return (deadline >> TICK_SHIFT) + ((deadline & ((1ull << TICK_SHIFT) - 1)) != 0);
+}
+
+
+static inline void wheel_lock(worker_t *w) {
+    if (worker_shared(w)) {
+        spin_lock(&w->wheel.lock);
+    }
+}
+
+
+static inline void wheel_unlock(worker_t *w) {
+    if (worker_shared(w)) {
+        spin_unlock(&w->wheel.lock);
+    }
+}
+
+
+// Кладёт таймер в слот по сроку, но не раньше min_tick
+static void wheel_link(timer_wheel_t *wh, utimer_t *t, uint64_t min_tick) {
+    uint64_t tick = t->tick > min_tick ? t->tick : min_tick;
+    uint64_t delta = tick - wh->now_tick;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ull << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    if (delta >= (1ull << (WHEEL_BITS * WHEEL_LEVELS))) {
+        // Дальше одного оборота старшего уровня: переложим, когда дойдём
+        tick = wh->now_tick + (1ull << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+
+    utimer_t **slot = &wh->slots[level][(tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    t->slot = slot;
+    t->prev = NULL;
+    t->next = *slot;
+    if (*slot) {
+        (*slot)->prev = t;
+    }
+    *slot = t;
+}
+
+
+static void wheel_unlink(utimer_t *t) {
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        *t->slot = t->next;
+    }
+    if (t->next) {
+        t->next->prev = t->prev;
+    }
+}
+
+
+// Начало ближайшего непустого слота (для старших уровней - не позже
+// срока их таймеров). UINT64_MAX - колесо пусто
+static uint64_t wheel_next_tick(const timer_wheel_t *wh) {
+    uint64_t best = UINT64_MAX;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        uint64_t base = wh->now_tick >> shift;
+        for (uint64_t i = 1; i <= WHEEL_SLOTS; i++) {
+            if (wh->slots[level][(base + i) & (WHEEL_SLOTS - 1)]) {
+                uint64_t start = (base + i) << shift;
+                if (start < best) {
+                    best = start;
+                }
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+
+// Переносит таймеры текущего слота уровня level на уровни ниже
+static void wheel_cascade(timer_wheel_t *wh, int level) {
+    utimer_t **slot = &wh->slots[level][(wh->now_tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    utimer_t *t = *slot;
+    *slot = NULL;
+    while (t) {
+        utimer_t *next = t->next;
+        wheel_link(wh, t, wh->now_tick);
+        t = next;
+    }
+}
+
+
+// Доводит колесо до тика to. Возвращает сработавшие таймеры (через next),
+// они уже сняты с колеса и помечены TIMER_FIRING
+static utimer_t *wheel_advance(timer_wheel_t *wh, uint64_t to) {
+    utimer_t *expired = NULL;
+    while (wh->now_tick < to) {
+        if (!wh->count) {
+            wh->now_tick = to;
+            break;
+        }
+        // Долгий простой: пустые тики пропускаем сразу до ближайшего слота
+        if (to - wh->now_tick > WHEEL_SLOTS) {
+            uint64_t next = wheel_next_tick(wh);
+            if (next > to) {
+                wh->now_tick = to;
+                break;
+            }
+            wh->now_tick = next - 1;
+        }
+
+        uint64_t tick = ++wh->now_tick;
+        int top = 0;
+        while (top + 1 < WHEEL_LEVELS && !(tick & ((1ull << (WHEEL_BITS * (top + 1))) - 1))) {
+            top++;
+        }
+        // Сверху вниз: старший уровень может положить таймер в текущий слот младшего
+        for (int level = top; level > 0; level--) {
+            wheel_cascade(wh, level);
+        }
+
+        utimer_t **slot = &wh->slots[0][tick & (WHEEL_SLOTS - 1)];
+        while (*slot) {
+            utimer_t *t = *slot;
+            *slot = t->next;
+            t->state = TIMER_FIRING;
+            t->next = expired;
+            expired = t;
+            wh->count--;
+        }
+    }
+    return expired;
+}
+
+
+static void timer_add(worker_t *w, utimer_t *t) {
+    t->owner = w;
+    t->state = TIMER_PENDING;
+    wheel_lock(w);
+    if (!w->wheel.count) {
+        w->wheel.now_tick = uthread_now() >> TICK_SHIFT;  // Пустое колесо догоняет часы сразу
+    }
+    wheel_link(&w->wheel, t, w->wheel.now_tick + 1);
+    w->wheel.count++;
+    wheel_unlock(w);
+}
+
+
+// Снимает таймер, если он ещё не сработал. После возврата fire
+// гарантированно не выполняется - кадр с таймером можно покидать
+static void timer_cancel(utimer_t *t) {
+    worker_t *owner = t->owner;
+    if (!owner) {
         return;
     }
-    
-    current_thread = next;
-    swapcontext(&prev->thread.context, &current_thread->thread.context);
+    wheel_lock(owner);
+    if (t->state == TIMER_PENDING) {
+        wheel_unlink(t);
+        owner->wheel.count--;
+        t->state = TIMER_IDLE;
+    }
+    wheel_unlock(owner);
+    int spins = 0;
+    while (__atomic_load_n(&t->state, __ATOMIC_ACQUIRE) == TIMER_FIRING) {
+        if (++spins < SPIN_LIMIT) {
+            cpu_relax();
+        } else {
+            sched_yield();  // Воркер, выполняющий fire, мог потерять процессор
+            spins = 0;
+        }
+    }
 }
 
 
-void uthread_exit(void *retval) {
-    if (!current_thread) {
+static void timers_expire(worker_t *w) {
+    uint64_t tick = uthread_now() >> TICK_SHIFT;
+    if (tick <= w->wheel.now_tick) {
         return;
     }
 
-    current_thread->thread.state = UTHREAD_FINISHED;
-    current_thread->thread.retval = retval;
-    
-    uthread_yield();
+    wheel_lock(w);
+    utimer_t *t = wheel_advance(&w->wheel, tick);
+    wheel_unlock(w);
+
+    while (t) {
+        utimer_t *next = t->next;
+        t->fire(w, t->node, t->arg);
+        __atomic_store_n(&t->state, TIMER_IDLE, __ATOMIC_RELEASE);  // Дальше t не трогаем
+        t = next;
+    }
+}
+
+
+// Выполняет таймеры, срок которых наступил. Вызывается без спинлоков
+// объектов; пока таймеров нет - одна проверка счётчика
+static inline void timers_run(worker_t *w) {
+    if (__atomic_load_n(&w->wheel.count, __ATOMIC_RELAXED)) {
+        timers_expire(w);
+    }
+}
+
+
+// Есть потоки, ждущие fd или завершения файловой операции
+static inline int io_pending(void) {
+    return __atomic_load_n(&io_waiting, __ATOMIC_RELAXED) ||
+           __atomic_load_n(&uring_inflight, __ATOMIC_RELAXED);
+}
+
+
+// Будит потоки, чьи fd стали готовы или операции завершились, - так же,
+// пока никто не ждёт, одна проверка счётчиков
+static inline void io_run(worker_t *w) {
+    if (io_pending()) {
+        io_poll_periodic(w);
+    }
+}
+
+
+// Срок ближайшего таймера воркера в нс (UINT64_MAX - таймеров нет)
+static uint64_t timers_deadline(worker_t *w) {
+    if (!__atomic_load_n(&w->wheel.count, __ATOMIC_RELAXED)) {
+        return UINT64_MAX;
+    }
+    wheel_lock(w);
+    uint64_t tick = wheel_next_tick(&w->wheel);
+    wheel_unlock(w);
+    return tick == UINT64_MAX ? UINT64_MAX : tick << TICK_SHIFT;
+}
+
+
+// Засыпает до появления работы или ближайшего срока. Счётчик увеличивается
+// до проверки очередей: поток, поставленный после проверки, увидит спящего
+// и разбудит его
+static void worker_sleep(worker_t *w) {
+    uring_flush();  // Заявки потоков, ушедших с этого воркера, - в ядро до сна
+    uint64_t deadline = timers_deadline(w);
+    int seq = __atomic_load_n(&idle_seq, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+    if (!any_ready()) {
+        // Один из спящих ждёт в epoll: и готовности fd, и своих сроков.
+        // Очереди проверяются ещё раз уже после захвата роли: поток,
+        // поставленный раньше, wake_idle_worker могла не заметить
+        int free_role = 0;
+        if (io_pending() &&
+            __atomic_compare_exchange_n(&io_poller, &free_role, 1, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            if (!any_ready()) {
+                io_poll(w, deadline);
+            }
+            __atomic_store_n(&io_poller, 0, __ATOMIC_RELEASE);
+        } else {
+            futex_wait_until(&idle_seq, seq, deadline);
+        }
+    }
+    __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_RELAXED);
+}
+
+
+// --- Планировщик ---
+
+static void park(worker_t *w, uthread_node_t *joiner, uthread_node_t *target);
+static void exit_finish(worker_t *w, uthread_node_t *node);
+
+
+// Выполняет отложенное действие над потоком, ушедшим с этого воркера,
+// наступившие таймеры и готовые fd. Вызывается сразу после каждого переключения -
+// уже на новом стеке
+static void finish_switch(worker_t *w) {
+    after_t after = w->after;
+    if (after == AFTER_NONE) {
+        timers_run(w);
+        io_run(w);
+        return;
+    }
+    w->after = AFTER_NONE;
+
+    switch (after) {
+    case AFTER_READY:
+        ready_push(w, w->after_node);
+        break;
+    case AFTER_PARK:
+        park(w, w->after_node, w->after_target);
+        break;
+    case AFTER_EXIT:
+        exit_finish(w, w->after_node);
+        break;
+    case AFTER_UNLOCK:
+        // До разблокировки: разбудить поток может только тот, кто возьмёт спинлок
+        if (w->after_timer) {
+            timer_add(w, w->after_timer);
+        }
+        runnable_dec(w->after_node);
+        for (int i = 0; i < w->after_nlocks; i++) {
+            spin_unlock(w->after_locks[i]);
+        }
+        break;
+    case AFTER_NONE:
+        break;
+    }
+    timers_run(w);
+    io_run(w);
+}
+
+
+// Переключается с текущего потока воркера на next. Возвращается, когда
+// уходящий поток снова выберут - возможно, уже другим воркером
+static worker_t *switch_to(worker_t *w, uthread_node_t *next) {
+    uthread_node_t *self = w->current;
+    w->current = next;
+    w->preempt_pending = 0;
+    w->slice_ticks = 0;
+
+    // Глубина запрета у каждого потока своя: поток мог уступить
+    // процессор изнутри своей критической секции
+    int depth = w->preempt_depth;
+    context_switch(&self->context, &next->context);
+    w = this_worker();
+    w->preempt_depth = depth;
+    finish_switch(w);
+    return w;
+}
+
+
+// Цикл планировщика main_worker на отдельном стеке: сюда уходят, когда
+// готовых нет. Если main ждёт в uthread_yield - возвращаемся в неё
+static void main_idle_loop(void *a, void *b) {
+    (void)a;
+    (void)b;
+    worker_t *w = &main_worker;
+    finish_switch(w);
+
+    for (;;) {
+        uthread_node_t *next = next_ready(w);
+        if (!next && main_idle) {
+            main_idle = 0;
+            next = &main_node;
+        }
+        if (!next && io_pending()) {
+            // Все ждут ввода-вывода или сроков: одно ожидание в epoll до ближайшего срока
+            io_poll(w, timers_deadline(w));
+            timers_run(w);
+            continue;
+        }
+        if (!next && w->wheel.count) {
+            // Все ждут сроков: спим до ближайшего, процессор не занимаем
+            uint64_t deadline = timers_deadline(w);
+            struct timespec ts = { (time_t)(deadline / 1000000000), (long)(deadline % 1000000000) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            timers_run(w);
+            continue;
+        }
+        if (!next) {
+            // Все потоки (и main) ждут друг друга - продолжать нечего
+            fprintf(stderr, "uthread: deadlock - no runnable threads\n");
+            abort();
+        }
+        switch_to(w, next);
+    }
+}
+
+
+static uthread_node_t *worker_idle(worker_t *w) {
+    if (!w->idle) {
+        uthread_node_t *idle = node_alloc(w);
+        if (!idle) {
+            fprintf(stderr, "uthread: out of memory for the scheduler stack\n");
+            abort();
+        }
+        context_init(&idle->context, idle->stack, STACK_SIZE, main_idle_loop, NULL, NULL);
+        w->idle = idle;
+    }
+    return w->idle;
+}
+
+
+// Передаёт процессор первому готовому потоку: своему, чужому (кража)
+// или циклу планировщика. Что делать с текущим потоком, задаёт w->after
+static worker_t *schedule(worker_t *w) {
+    // Очередь main_worker никто больше не видит: ожидающего можно разбудить
+    // до переключения, не заходя в цикл планировщика. Отсоединённый узел
+    // вернуть в пул пока нельзя - мы ещё на его стеке
+    if (!worker_shared(w) && (w->after == AFTER_PARK ||
+                              (w->after == AFTER_EXIT && !w->after_node->detached))) {
+        finish_switch(w);
+    }
+
+    uthread_node_t *next = next_ready(w);
+    if (!next) {
+        next = steal(w);
+    }
+    if (!next) {
+        next = worker_idle(w);
+    }
+    return switch_to(w, next);
+}
+
+
+static inline void preempt_off(worker_t *w) {
+    w->preempt_depth++;
+}
+
+
+// Переключение по таймеру: текущий поток (и main тоже) встаёт в конец
+// очереди. Вызывается при preempt_depth == 0
+static void preempt_switch(worker_t *w) {
+    w->preempt_pending = 0;
+    if (!has_ready(w)) {
+        return;
+    }
+    w->preempt_depth = 1;
+    w->after = AFTER_READY;
+    w->after_node = w->current;
+    w = schedule(w);
+    w->preempt_depth = 0;
+}
+
+
+// Сигнал пришёл, когда переключаться было нельзя, - переключаемся на выходе
+static inline void preempt_on(worker_t *w) {
+    if (--w->preempt_depth == 0 && w->preempt_pending) {
+        preempt_switch(w);
+    }
+}
+
+
+static void thread_wrapper(void *start_routine, void *arg) {
+    worker_t *w = this_worker();
+    finish_switch(w);
+    // Переключились сюда из schedule() с запретом вытеснения
+    w->preempt_depth = 1;
+    preempt_on(w);
+
+    void *retval = ((void *(*)(void*))start_routine)(arg);
+    uthread_exit(retval);
+}
+
+
+// Ожидающий join уже ушёл с процессора: регистрируемся у цели или,
+// если она успела завершиться, сразу встаём в очередь
+static void park(worker_t *w, uthread_node_t *joiner, uthread_node_t *target) {
+    spin_lock(&target->lock);
+    if (target->state == UTHREAD_FINISHED) {
+        spin_unlock(&target->lock);
+        ready_push(w, joiner);
+        return;
+    }
+    target->joiner = joiner;
+    spin_unlock(&target->lock);
+    runnable_dec(joiner);
+}
+
+
+// Завершившийся поток ушёл со своего стека: теперь его можно присоединить,
+// а отсоединённый - вернуть в пул
+static void exit_finish(worker_t *w, uthread_node_t *node) {
+    spin_lock(&node->lock);
+    node->state = UTHREAD_FINISHED;
+    uthread_node_t *joiner = node->joiner;
+    int detached = node->detached;
+    spin_unlock(&node->lock);
+
+    // Ожидающий учитывается раньше, чем уходит завершившийся: счётчик
+    // не должен на миг обнулиться, пока готовый поток ещё не в очереди
+    if (joiner && joiner != JOINER_EXTERNAL) {
+        runnable_inc(joiner);
+    }
+    runnable_dec(node);
+    if (detached) {
+        node_release(w, node);
+    } else if (joiner == JOINER_EXTERNAL) {
+        __atomic_add_fetch(&join_seq, 1, __ATOMIC_RELEASE);
+        futex(&join_seq, FUTEX_WAKE_PRIVATE, INT_MAX);
+    } else if (joiner) {
+        ready_push(w, joiner);
+    }
+}
+
+
+static void *worker_main(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    uthread_node_t idle;
+
+    memset(&idle, 0, sizeof(idle));
+    tls_worker = w;
+    w->idle = &idle;
+    w->current = &idle;
+    w->preempt_depth = 1;  // Цикл планировщика не вытесняется
+    if (preempt_quantum_us) {
+        uthread_preempt(preempt_quantum_us);
+    }
+
+    for (;;) {
+        timers_run(w);
+        io_run(w);
+        uthread_node_t *next = next_ready(w);
+        if (!next) {
+            next = steal(w);
+        }
+        if (next) {
+            w = switch_to(w, next);
+        } else {
+            worker_sleep(w);
+        }
+    }
+    return NULL;
+}
+
+
+int uthread_workers(int n) {
+    if (n <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    // Потоки, уже стоящие в очереди main, воркерам не передать
+    if (workers_started || this_worker() != &main_worker ||
+        main_worker.current != &main_node || has_ready(&main_worker)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    workers = calloc(n, sizeof(worker_t));
+    if (!workers) {
+        return -1;
+    }
+    num_workers = n;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 0; i < n; i++) {
+        pthread_t tid;
+        int err = pthread_create(&tid, &attr, worker_main, &workers[i]);
+        if (err != 0) {
+            // Запущенные воркеры не остановить - работаем с ними
+            num_workers = i;
+            if (i == 0) {
+                pthread_attr_destroy(&attr);
+                free(workers);
+                workers = NULL;
+                errno = err;
+                return -1;
+            }
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    __atomic_store_n(&workers_started, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+// main при работающих воркерах сама потоки не выполняет
+static inline int external(const worker_t *w) {
+    return w == &main_worker && workers_started;
+}
+
+
+// Ставит поток в очередь: свою или, если main при воркерах, - следующего воркера
+static void make_ready(worker_t *w, uthread_node_t *node) {
+    if (external(w)) {
+        ready_push(&workers[next_worker++ % num_workers], node);
+    } else {
+        ready_push(w, node);
+    }
+}
+
+
+int uthread_create(uthread_t *thread, void *(*start_routine)(void*), void *arg) {
+    if (!thread || !start_routine) {
+        errno = EINVAL;
+        return -1;
+    }
+    
+    worker_t *w = this_worker();
+    preempt_off(w);
+    uthread_node_t *node = node_alloc(w);
+    if (!node) {
+        perror("malloc");
+        preempt_on(w);
+        return -1;
+    }
+    
+    node->lock = 0;
+    node->state = UTHREAD_RUNNING;
+    node->retval = NULL;
+    node->start_routine = start_routine;
+    node->profiled = stack_profile;
+    node->detached = 0;
+    node->joiner = NULL;
+    node->stack_used = &thread->stack_used;
+
+    // До context_init: он кладёт на верх стека начальный кадр
+    if (stack_profile) {
+        memset(node->stack, PROFILE_BYTE, STACK_SIZE);
+    }
+    context_init(&node->context, node->stack, STACK_SIZE,
+                 thread_wrapper, (void *)start_routine, arg);
+
+    thread->node = node;
+    thread->stack_used = 0;
+    
+    runnable_inc(node);
+    make_ready(w, node);
+    preempt_on(w);
+    return 0;
+}
+
+
+void uthread_yield(void) {
+    worker_t *w = this_worker();
+
+    // main при воркерах ждёт, пока не останется готовых потоков
+    if (external(w)) {
+        __atomic_store_n(&main_waiting, 1, __ATOMIC_SEQ_CST);
+        int count;
+        while ((count = __atomic_load_n(&runnable, __ATOMIC_SEQ_CST)) != 0) {
+            futex(&runnable, FUTEX_WAIT_PRIVATE, count);
+        }
+        return;
+    }
+
+    // Срок спящих мог наступить, а fd - стать готовыми: им тоже пора на процессор
+    if (w->wheel.count || io_pending()) {
+        preempt_off(w);
+        timers_run(w);
+        io_run(w);
+        preempt_on(w);
+        w = this_worker();
+    }
+    if (!has_ready(w)) {
+        return;  // Других готовых потоков нет - продолжаем без переключения
+    }
+
+    // main уступает, пока есть готовые потоки; поток - встаёт в конец очереди
+    preempt_off(w);
+    if (w->current == &main_node) {
+        main_idle = 1;
+    } else {
+        w->after = AFTER_READY;
+        w->after_node = w->current;
+    }
+    w = schedule(w);
+    preempt_on(w);
+}
+
+
+void uthread_exit(void *retval) {
+    worker_t *w = this_worker();
+    uthread_node_t *self = w->current;
+    if (self == &main_node) {
+        return;
+    }
+
+    preempt_off(w);  // Не снимается: поток сюда больше не вернётся
+    self->retval = retval;
+
+    if (self->profiled) {
+        size_t peak = stack_peak(self->stack);
+        if (self->stack_used) {
+            *self->stack_used = peak;
+        }
+        profile_record(self->start_routine, peak);
+    }
+
+    // Состояние FINISHED, пробуждение ожидающего и возврат отсоединённого
+    // узла в пул - в exit_finish, когда поток уйдёт со своего стека
+    w->after = AFTER_EXIT;
+    w->after_node = self;
+    schedule(w);
+}
+
+
+int uthread_join(uthread_t *thread, void **retval) {
+    if (!thread || !thread->node || thread->node->joiner) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    uthread_node_t *node = thread->node;
+    if (node == w->current) {
+        errno = EDEADLK;
+        return -1;
+    }
+
+    preempt_off(w);
+    if (external(w)) {
+        // main спит на futex, пока exit_finish не увеличит join_seq
+        spin_lock(&node->lock);
+        if (node->state != UTHREAD_FINISHED) {
+            node->joiner = JOINER_EXTERNAL;
+        }
+        spin_unlock(&node->lock);
+        for (;;) {
+            int seq = __atomic_load_n(&join_seq, __ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&node->state, __ATOMIC_ACQUIRE) == UTHREAD_FINISHED) {
+                break;
+            }
+            futex(&join_seq, FUTEX_WAIT_PRIVATE, seq);
+        }
+    } else if (__atomic_load_n(&node->state, __ATOMIC_ACQUIRE) != UTHREAD_FINISHED) {
+        // Ждём вне очереди готовых: exit_finish поставит нас обратно
+        if (w->current == &main_node) {
+            main_idle = 0;
+        }
+        w->after = AFTER_PARK;
+        w->after_node = w->current;
+        w->after_target = node;
+        w = schedule(w);
+    }
+
+    if (retval) {
+        *retval = node->retval;
+    }
+    thread->node = NULL;
+    node_release(w, node);
+    preempt_on(w);
+    return 0;
+}
+
+
+int uthread_detach(uthread_t *thread) {
+    if (!thread || !thread->node || thread->node->joiner) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    uthread_node_t *node = thread->node;
+    thread->node = NULL;
+    node->stack_used = NULL;  // Дескриптор может исчезнуть раньше потока
+
+    preempt_off(w);
+    spin_lock(&node->lock);
+    int finished = (node->state == UTHREAD_FINISHED);
+    if (!finished) {
+        node->detached = 1;
+    }
+    spin_unlock(&node->lock);
+    if (finished) {
+        node_release(w, node);
+    }
+    preempt_on(w);
+    return 0;
+}
+
+
+// --- Мьютекс, условная переменная, семафор ---
+//
+// Ожидающий поток встаёт в очередь объекта и уходит с процессора, ядерный
+// поток при этом не блокируется. Спинлок объекта держится до конца
+// переключения (его отпускает AFTER_UNLOCK): будящий, взявший спинлок,
+// гарантированно видит уже сохранённый контекст ожидающего.
+
+// Текущий поток уже в очередях ожидания, спинлоки объектов взяты.
+// timer (или NULL) заводится, когда поток уйдёт с процессора
+static worker_t *block_on_locks(worker_t *w, volatile int **locks, int nlocks, utimer_t *timer) {
+    if (external(w)) {
+        // main при воркерах не поток планировщика - спит на futex
+        __atomic_store_n(&main_wakeup, 0, __ATOMIC_RELAXED);
+        for (int i = 0; i < nlocks; i++) {
+            spin_unlock(locks[i]);
+        }
+        uint64_t deadline = timer ? timer->tick << TICK_SHIFT : UINT64_MAX;
+        while (!__atomic_load_n(&main_wakeup, __ATOMIC_ACQUIRE)) {
+            if (deadline != UINT64_MAX && uthread_now() >= deadline) {
+                // Колеса у main нет - срабатываем сами. Если нас уже
+                // разбудили, fire ничего не сделает: ждём без срока
+                timer->fire(w, w->current, timer->arg);
+                deadline = UINT64_MAX;
+                continue;
+            }
+            futex_wait_until(&main_wakeup, 0, deadline);
+        }
+        return w;
+    }
+    w->after = AFTER_UNLOCK;
+    w->after_node = w->current;
+    w->after_locks = locks;
+    w->after_nlocks = nlocks;
+    w->after_timer = timer;
+    return schedule(w);
+}
+
+
+static worker_t *block_on(worker_t *w, volatile int *lock) {
+    return block_on_locks(w, &lock, 1, NULL);
+}
+
+
+// Поток снят с очереди ожидания (спинлок объекта уже отпущен). direct -
+// выполнить его следующим на этом воркере, минуя очередь готовых
+static void wake_up(worker_t *w, uthread_node_t *node, int direct) {
+    if (node == &main_node && workers_started) {
+        __atomic_store_n(&main_wakeup, 1, __ATOMIC_RELEASE);
+        futex(&main_wakeup, FUTEX_WAKE_PRIVATE, 1);
+        return;
+    }
+    runnable_inc(node);
+    if (!direct || external(w)) {
+        make_ready(w, node);
+        return;
+    }
+    if (w->runnext) {
+        ready_push(w, w->runnext);
+    }
+    w->runnext = node;
+}
+
+
+// Ожидание в очереди объекта со сроком
+typedef struct {
+    volatile int *lock;
+    uthread_queue_t *waiters;
+    int timed_out;
+} timed_wait_t;
+
+
+// Срок вышел: снимаем поток с очереди объекта, если его ещё не разбудили
+static void timed_wait_fire(worker_t *w, uthread_node_t *node, void *arg) {
+    timed_wait_t *tw = (timed_wait_t *)arg;
+    spin_lock(tw->lock);
+    int removed = queue_remove(tw->waiters, node);
+    if (removed) {
+        tw->timed_out = 1;
+    }
+    spin_unlock(tw->lock);
+    if (removed) {
+        wake_up(w, node, 0);
+    }
+}
+
+
+// block_on со сроком deadline (UINT64_MAX - без срока). Текущий поток уже
+// в waiters, lock взят. 1 - проснулся по сроку
+static int block_until(worker_t **w, volatile int *lock, uthread_queue_t *waiters,
+                       uint64_t deadline) {
+    if (deadline == UINT64_MAX) {
+        *w = block_on(*w, lock);
+        return 0;
+    }
+    timed_wait_t tw = { lock, waiters, 0 };
+    utimer_t timer = { .tick = deadline_tick(deadline), .fire = timed_wait_fire,
+                       .node = (*w)->current, .arg = &tw };
+    *w = block_on_locks(*w, &lock, 1, &timer);
+    timer_cancel(&timer);
+    return tw.timed_out;
+}
+
+
+static void sleep_fire(worker_t *w, uthread_node_t *node, void *arg) {
+    (void)arg;
+    wake_up(w, node, 0);
+}
+
+
+int uthread_sleep_until(uint64_t deadline) {
+    worker_t *w = this_worker();
+    if (deadline <= uthread_now()) {
+        if (!external(w)) {
+            uthread_yield();  // main при воркерах в yield ждала бы их всех
+        }
+        return 0;
+    }
+
+    // Ждём только таймера: спинлоков нет, в очередях объектов нас тоже нет
+    preempt_off(w);
+    utimer_t timer = { .tick = deadline_tick(deadline), .fire = sleep_fire, .node = w->current };
+    w = block_on_locks(w, NULL, 0, &timer);
+    timer_cancel(&timer);
+    preempt_on(w);
+    return 0;
+}
+
+
+int uthread_sleep(uint64_t ns) {
+    return uthread_sleep_until(uthread_now() + ns);
+}
+
+
+int uthread_mutex_init(uthread_mutex_t *mutex) {
+    if (!mutex) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(mutex, 0, sizeof(*mutex));
+    return 0;
+}
+
+
+int uthread_mutex_destroy(uthread_mutex_t *mutex) {
+    if (!mutex) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (mutex->owner || mutex->waiters.head) {
+        errno = EBUSY;
+        return -1;
+    }
+    return 0;
+}
+
+
+int uthread_mutex_lock(uthread_mutex_t *mutex) {
+    if (!mutex) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    uthread_node_t *self = w->current;
+    if (mutex->owner == self) {
+        errno = EDEADLK;
+        return -1;
+    }
+
+    preempt_off(w);
+    spin_lock(&mutex->lock);
+    if (!mutex->owner) {
+        mutex->owner = self;
+        spin_unlock(&mutex->lock);
+    } else {
+        // unlock передаст мьютекс прямо нам: проснувшись, мы уже владельцы
+        queue_push(&mutex->waiters, self);
+        w = block_on(w, &mutex->lock);
+    }
+    preempt_on(w);
+    return 0;
+}
+
+
+int uthread_mutex_trylock(uthread_mutex_t *mutex) {
+    if (!mutex) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    int ret = 0;
+    preempt_off(w);
+    spin_lock(&mutex->lock);
+    if (!mutex->owner) {
+        mutex->owner = w->current;
+    } else {
+        errno = EBUSY;
+        ret = -1;
+    }
+    spin_unlock(&mutex->lock);
+    preempt_on(w);
+    return ret;
+}
+
+
+int uthread_mutex_unlock(uthread_mutex_t *mutex) {
+    worker_t *w = this_worker();
+    if (!mutex || mutex->owner != w->current) {
+        errno = EPERM;
+        return -1;
+    }
+
+    preempt_off(w);
+    spin_lock(&mutex->lock);
+    uthread_node_t *next = queue_pop(&mutex->waiters);
+    mutex->owner = next;  // Передача по очереди: без перехвата, без голодания
+    spin_unlock(&mutex->lock);
+    if (next) {
+        wake_up(w, next, 0);
+    }
+    preempt_on(w);
+    return 0;
+}
+
+
+int uthread_cond_init(uthread_cond_t *cond) {
+    if (!cond) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(cond, 0, sizeof(*cond));
+    return 0;
+}
+
+
+int uthread_cond_destroy(uthread_cond_t *cond) {
+    if (!cond) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (cond->waiters.head) {
+        errno = EBUSY;
+        return -1;
+    }
+    return 0;
+}
+
+
+static int cond_wait(uthread_cond_t *cond, uthread_mutex_t *mutex, uint64_t deadline) {
+    if (!cond || !mutex) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    if (mutex->owner != w->current) {
+        errno = EPERM;
+        return -1;
+    }
+
+    // В очередь условия - до того, как отпустить мьютекс: signal между
+    // unlock и засыпанием не потеряется, он ждёт спинлок условия
+    preempt_off(w);
+    spin_lock(&cond->lock);
+    queue_push(&cond->waiters, w->current);
+    uthread_mutex_unlock(mutex);
+    int timed_out = block_until(&w, &cond->lock, &cond->waiters, deadline);
+    preempt_on(w);
+
+    // Мьютекс возвращается и по сроку
+    if (uthread_mutex_lock(mutex) != 0) {
+        return -1;
+    }
+    if (timed_out) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+
+int uthread_cond_wait(uthread_cond_t *cond, uthread_mutex_t *mutex) {
+    return cond_wait(cond, mutex, UINT64_MAX);
+}
+
+
+int uthread_cond_timedwait(uthread_cond_t *cond, uthread_mutex_t *mutex, uint64_t deadline) {
+    return cond_wait(cond, mutex, deadline);
+}
+
+
+static int cond_wake(uthread_cond_t *cond, int all) {
+    if (!cond) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    preempt_off(w);
+    spin_lock(&cond->lock);
+    uthread_queue_t woken = cond->waiters;
+    if (all) {
+        cond->waiters.head = cond->waiters.tail = NULL;
+        woken.tail = NULL;
+    } else {
+        woken.head = queue_pop(&cond->waiters);
+    }
+    spin_unlock(&cond->lock);
+
+    while (woken.head) {
+        uthread_node_t *node = woken.head;
+        woken.head = node->next;
+        wake_up(w, node, 0);
+    }
+    preempt_on(w);
+    return 0;
+}
+
+
+int uthread_cond_signal(uthread_cond_t *cond) {
+    return cond_wake(cond, 0);
+}
+
+
+int uthread_cond_broadcast(uthread_cond_t *cond) {
+    return cond_wake(cond, 1);
+}
+
+
+int uthread_sem_init(uthread_sem_t *sem, unsigned value) {
+    if (!sem) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(sem, 0, sizeof(*sem));
+    sem->value = value;
+    return 0;
+}
+
+
+int uthread_sem_destroy(uthread_sem_t *sem) {
+    if (!sem) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (sem->waiters.head) {
+        errno = EBUSY;
+        return -1;
+    }
+    return 0;
+}
+
+
+static int sem_wait(uthread_sem_t *sem, uint64_t deadline) {
+    if (!sem) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    int timed_out = 0;
+    preempt_off(w);
+    spin_lock(&sem->lock);
+    if (sem->value > 0) {
+        sem->value--;
+        spin_unlock(&sem->lock);
+    } else {
+        // post отдаст единицу прямо нам, не увеличивая value
+        queue_push(&sem->waiters, w->current);
+        timed_out = block_until(&w, &sem->lock, &sem->waiters, deadline);
+    }
+    preempt_on(w);
+
+    if (timed_out) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+
+int uthread_sem_wait(uthread_sem_t *sem) {
+    return sem_wait(sem, UINT64_MAX);
+}
+
+
+int uthread_sem_timedwait(uthread_sem_t *sem, uint64_t deadline) {
+    return sem_wait(sem, deadline);
+}
+
+
+int uthread_sem_trywait(uthread_sem_t *sem) {
+    if (!sem) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    int ret = 0;
+    preempt_off(w);
+    spin_lock(&sem->lock);
+    if (sem->value > 0) {
+        sem->value--;
+    } else {
+        errno = EAGAIN;
+        ret = -1;
+    }
+    spin_unlock(&sem->lock);
+    preempt_on(w);
+    return ret;
+}
+
+
+int uthread_sem_post(uthread_sem_t *sem) {
+    if (!sem) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    preempt_off(w);
+    spin_lock(&sem->lock);
+    uthread_node_t *next = queue_pop(&sem->waiters);
+    if (!next) {
+        sem->value++;
+    }
+    spin_unlock(&sem->lock);
+    if (next) {
+        wake_up(w, next, 0);
+    }
+    preempt_on(w);
+    return 0;
+}
+
+
+// --- Каналы ---
+//
+// Кольцевой буфер на capacity элементов и две очереди заявок: ждущих
+// отправителей и получателей. Заявка лежит на стеке ждущего потока.
+// Если у канала есть ждущий получатель, отправитель копирует данные
+// прямо в его переменную и ставит его в runnext своего воркера - без
+// буфера и без очереди готовых. select ставит заявки во все свои каналы
+// сразу; сработавшую выбирает первый, кто обменяет флаг done.
+
+typedef struct {
+    volatile int done;
+    int index;      // Сработавший вариант
+    int ok;         // 1 - данные переданы, 0 - канал закрыт
+} select_state_t;
+
+struct chan_waitq;
+
+typedef struct chan_waiter {
+    uthread_node_t *node;
+    void *elem;                     // Откуда отправить / куда принять
+    struct chan_waiter *prev;
+    struct chan_waiter *next;
+    struct chan_waitq *queue;       // NULL - заявка уже снята
+    select_state_t *sel;
+    int index;
+} chan_waiter_t;
+
+typedef struct chan_waitq {
+    chan_waiter_t *head;
+    chan_waiter_t *tail;
+} chan_waitq_t;
+
+struct uthread_chan {
+    volatile int lock;
+    int closed;
+    size_t elem_size;
+    size_t capacity;
+    size_t count;
+    size_t head;                    // Первый элемент в кольце
+    char *buf;
+    chan_waitq_t recvq;
+    chan_waitq_t sendq;
+};
+
+
+static void waitq_push(chan_waitq_t *q, chan_waiter_t *waiter) {
+    waiter->queue = q;
+    waiter->next = NULL;
+    waiter->prev = q->tail;
+    if (q->tail) {
+        q->tail->next = waiter;
+    } else {
+        q->head = waiter;
+    }
+    q->tail = waiter;
+}
+
+
+static void waitq_remove(chan_waiter_t *waiter) {
+    chan_waitq_t *q = waiter->queue;
+    if (!q) {
+        return;
+    }
+    if (waiter->prev) {
+        waiter->prev->next = waiter->next;
+    } else {
+        q->head = waiter->next;
+    }
+    if (waiter->next) {
+        waiter->next->prev = waiter->prev;
+    } else {
+        q->tail = waiter->prev;
+    }
+    waiter->queue = NULL;
+}
+
+
+// Первая заявка, которую удалось забрать. Заявки select, уже сработавшего
+// на другом канале, просто снимаются
+static chan_waiter_t *waitq_claim(chan_waitq_t *q, int ok) {
+    chan_waiter_t *waiter;
+    while ((waiter = q->head) != NULL) {
+        waitq_remove(waiter);
+        if (__atomic_exchange_n(&waiter->sel->done, 1, __ATOMIC_ACQ_REL) == 0) {
+            waiter->sel->index = waiter->index;
+            waiter->sel->ok = ok;
+            return waiter;
+        }
+    }
+    return NULL;
+}
+
+
+static inline void chan_copy(const uthread_chan_t *ch, void *dst, const void *src) {
+    if (ch->elem_size && dst) {
+        memcpy(dst, src, ch->elem_size);
+    }
+}
+
+
+static inline void *chan_slot(const uthread_chan_t *ch, size_t i) {
+    return ch->buf + ((ch->head + i) % ch->capacity) * ch->elem_size;
+}
+
+
+// Операции под спинлоком канала. 1 - выполнена (в *ok - передано ли),
+// 0 - надо ждать. В *wake - кого разбудить после разблокировки
+static int chan_try_send(uthread_chan_t *ch, const void *elem, int *ok, uthread_node_t **wake) {
+    if (ch->closed) {
+        *ok = 0;
+        return 1;
+    }
+    chan_waiter_t *receiver = waitq_claim(&ch->recvq, 1);
+    if (receiver) {
+        chan_copy(ch, receiver->elem, elem);
+        *wake = receiver->node;
+    } else if (ch->count < ch->capacity) {
+        chan_copy(ch, chan_slot(ch, ch->count), elem);
+        ch->count++;
+    } else {
+        return 0;
+    }
+    *ok = 1;
+    return 1;
+}
+
+
+static int chan_try_recv(uthread_chan_t *ch, void *elem, int *ok, uthread_node_t **wake) {
+    if (ch->count > 0) {
+        chan_copy(ch, elem, chan_slot(ch, 0));
+        ch->head = (ch->head + 1) % ch->capacity;
+        ch->count--;
+        // Освободилось место - забираем данные первого ждущего отправителя
+        chan_waiter_t *sender = waitq_claim(&ch->sendq, 1);
+        if (sender) {
+            chan_copy(ch, chan_slot(ch, ch->count), sender->elem);
+            ch->count++;
+            *wake = sender->node;
+        }
+    } else {
+        chan_waiter_t *sender = waitq_claim(&ch->sendq, 1);
+        if (sender) {
+            chan_copy(ch, elem, sender->elem);
+            *wake = sender->node;
+        } else if (ch->closed) {
+            if (elem && ch->elem_size) {
+                memset(elem, 0, ch->elem_size);
+            }
+            *ok = 0;
+            return 1;
+        } else {
+            return 0;
+        }
+    }
+    *ok = 1;
+    return 1;
+}
+
+
+uthread_chan_t *uthread_chan_create(size_t elem_size, size_t capacity) {
+    uthread_chan_t *ch = calloc(1, sizeof(uthread_chan_t));
+    if (!ch) {
+        return NULL;
+    }
+    ch->elem_size = elem_size;
+    ch->capacity = capacity;
+    if (capacity && elem_size) {
+        ch->buf = malloc(capacity * elem_size);
+        if (!ch->buf) {
+            free(ch);
+            return NULL;
+        }
+    }
+    return ch;
+}
+
+
+int uthread_chan_destroy(uthread_chan_t *ch) {
+    if (!ch) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ch->recvq.head || ch->sendq.head) {
+        errno = EBUSY;
+        return -1;
+    }
+    free(ch->buf);
+    free(ch);
+    return 0;
+}
+
+
+// Одиночная операция: как select из одного варианта, но без сортировки
+// спинлоков и массива заявок
+static int chan_op(uthread_chan_t *ch, int send, void *elem) {
+    if (!ch) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    uthread_node_t *wake = NULL;
+    int ok;
+
+    preempt_off(w);
+    spin_lock(&ch->lock);
+    int done = send ? chan_try_send(ch, elem, &ok, &wake) : chan_try_recv(ch, elem, &ok, &wake);
+    if (done) {
+        spin_unlock(&ch->lock);
+        if (wake) {
+            wake_up(w, wake, 1);
+        }
+    } else {
+        select_state_t sel = { 0, 0, 0 };
+        chan_waiter_t waiter = { .node = w->current, .elem = elem, .sel = &sel };
+        waitq_push(send ? &ch->sendq : &ch->recvq, &waiter);
+        w = block_on(w, &ch->lock);
+        ok = sel.ok;
+    }
+    preempt_on(w);
+
+    if (!ok) {
+        errno = EPIPE;
+        return -1;
+    }
+    return 0;
+}
+
+
+int uthread_chan_send(uthread_chan_t *ch, const void *elem) {
+    return chan_op(ch, 1, (void *)elem);
+}
+
+
+int uthread_chan_recv(uthread_chan_t *ch, void *elem) {
+    return chan_op(ch, 0, elem);
+}
+
+
+int uthread_chan_close(uthread_chan_t *ch) {
+    if (!ch) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    preempt_off(w);
+    spin_lock(&ch->lock);
+    if (ch->closed) {
+        spin_unlock(&ch->lock);
+        preempt_on(w);
+        errno = EPIPE;
+        return -1;
+    }
+    ch->closed = 1;
+
+    // Все ждущие просыпаются с ok = 0: получатели - с нулевым значением
+    uthread_queue_t woken = { NULL, NULL };
+    chan_waiter_t *waiter;
+    while ((waiter = waitq_claim(&ch->recvq, 0)) != NULL) {
+        if (waiter->elem && ch->elem_size) {
+            memset(waiter->elem, 0, ch->elem_size);
+        }
+        queue_push(&woken, waiter->node);
+    }
+    while ((waiter = waitq_claim(&ch->sendq, 0)) != NULL) {
+        queue_push(&woken, waiter->node);
+    }
+    spin_unlock(&ch->lock);
+
+    uthread_node_t *node;
+    while ((node = queue_pop(&woken)) != NULL) {
+        wake_up(w, node, 0);
+    }
+    preempt_on(w);
+    return 0;
+}
+
+
+int uthread_chan_select(uthread_chan_case_t *cases, int n, int block) {
+    if (!cases || n <= 0 || n > SELECT_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Спинлоки каналов берутся по возрастанию адресов и без повторов:
+    // два select с общими каналами не сцепятся
+    volatile int *locks[SELECT_MAX];
+    int nlocks = 0;
+    for (int i = 0; i < n; i++) {
+        if (!cases[i].chan) {
+            continue;  // Вариант без канала никогда не срабатывает
+        }
+        volatile int *lock = &cases[i].chan->lock;
+        int pos = 0;
+        while (pos < nlocks && locks[pos] < lock) {
+            pos++;
+        }
+        if (pos < nlocks && locks[pos] == lock) {
+            continue;
+        }
+        memmove(&locks[pos + 1], &locks[pos], (nlocks - pos) * sizeof(locks[0]));
+        locks[pos] = lock;
+        nlocks++;
+    }
+    if (nlocks == 0 && block) {
+        errno = EDEADLK;  // Ждать нечего
+        return -1;
+    }
+
+    worker_t *w = this_worker();
+    preempt_off(w);
+    for (int i = 0; i < nlocks; i++) {
+        spin_lock(locks[i]);
+    }
+
+    // Проверку начинаем с разных вариантов, чтобы ни один не голодал
+    unsigned start = w->select_seq++ % (unsigned)n;
+    for (int k = 0; k < n; k++) {
+        int i = (int)((start + k) % (unsigned)n);
+        uthread_chan_case_t *c = &cases[i];
+        if (!c->chan) {
+            continue;
+        }
+
+        uthread_node_t *wake = NULL;
+        int done = (c->op == UTHREAD_CHAN_SEND) ? chan_try_send(c->chan, c->elem, &c->ok, &wake)
+                                                : chan_try_recv(c->chan, c->elem, &c->ok, &wake);
+        if (done) {
+            for (int j = 0; j < nlocks; j++) {
+                spin_unlock(locks[j]);
+            }
+            if (wake) {
+                wake_up(w, wake, 1);
+            }
+            preempt_on(w);
+            return i;
+        }
+    }
+
+    if (!block) {
+        for (int j = 0; j < nlocks; j++) {
+            spin_unlock(locks[j]);
+        }
+        preempt_on(w);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    select_state_t sel = { 0, 0, 0 };
+    chan_waiter_t waiters[SELECT_MAX];
+    for (int i = 0; i < n; i++) {
+        uthread_chan_case_t *c = &cases[i];
+        if (!c->chan) {
+            continue;
+        }
+        waiters[i] = (chan_waiter_t){ .node = w->current, .elem = c->elem, .sel = &sel, .index = i };
+        waitq_push(c->op == UTHREAD_CHAN_SEND ? &c->chan->sendq : &c->chan->recvq, &waiters[i]);
+    }
+    w = block_on_locks(w, locks, nlocks, NULL);
+
+    // Сработал один вариант - снимаем заявки из остальных каналов
+    for (int i = 0; i < nlocks; i++) {
+        spin_lock(locks[i]);
+    }
+    for (int i = 0; i < n; i++) {
+        if (cases[i].chan) {
+            waitq_remove(&waiters[i]);
+        }
+    }
+    for (int i = 0; i < nlocks; i++) {
+        spin_unlock(locks[i]);
+    }
+    preempt_on(w);
+
+    cases[sel.index].ok = sel.ok;
+    return sel.index;
+}
+
+
+// --- Ввод-вывод ---
+//
+// Один epoll на процесс. fd при первом использовании переводится в
+// O_NONBLOCK и регистрируется один раз, по фронту (EPOLLET), на чтение и
+// запись сразу. Поток, получивший EAGAIN, встаёт в описатель fd читателем
+// или писателем и уходит с процессора; реактор по событию увеличивает
+// счётчик готовности и будит его. Счётчик, снятый до попытки, закрывает
+// гонку: событие между EAGAIN и постановкой в описатель не теряется.
+// Опрашивает epoll планировщик: без ожидания - после переключений, не чаще
+// раза в тик, и с ожиданием до ближайшего срока - когда готовых нет.
+
+typedef struct {
+    volatile int lock;
+    int registered;
+    volatile unsigned rseq;         // Событий готовности на чтение
+    volatile unsigned wseq;         // ... и на запись
+    uthread_node_t *reader;
+    uthread_node_t *writer;
+} io_fd_t;
+
+static io_fd_t *io_table[IO_CHUNKS];
+static int io_epfd = -1;
+static int io_breakfd = -1;         // eventfd: будит воркер из epoll_wait
+static int io_init_error = 0;
+static pthread_once_t io_once = PTHREAD_ONCE_INIT;
+static volatile uint64_t io_last_poll = 0;
+static char io_uring_tag;           // data.ptr кольца io_uring: оно тоже в epoll
+
+
+static void io_init(void) {
+    io_epfd = epoll_create1(EPOLL_CLOEXEC);
+    io_breakfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (io_epfd == -1 || io_breakfd == -1) {
+        io_init_error = errno;
+        return;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(io_epfd, EPOLL_CTL_ADD, io_breakfd, &ev) != 0) {
+        io_init_error = errno;
+    }
+}
+
+
+static void io_break(void) {
+    uint64_t one = 1;
+    ssize_t ret = write(io_breakfd, &one, sizeof(one));
+    (void)ret;  // Ошибка - только переполнение счётчика: воркер и так разбужен
+}
+
+
+// Описатель fd; блоки таблицы создаются при первом обращении и не освобождаются
+static io_fd_t *io_desc(int fd) {
+    if (fd < 0 || fd >= IO_CHUNK * IO_CHUNKS) {
+        errno = EBADF;
+        return NULL;
+    }
+    io_fd_t **chunk = &io_table[fd / IO_CHUNK];
+    io_fd_t *descs = __atomic_load_n(chunk, __ATOMIC_ACQUIRE);
+    if (!descs) {
+        io_fd_t *fresh = calloc(IO_CHUNK, sizeof(io_fd_t));
+        if (!fresh) {
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(chunk, &descs, fresh, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            descs = fresh;
+        } else {
+            free(fresh);  // Блок успел создать другой воркер
+        }
+    }
+    return &descs[fd % IO_CHUNK];
+}
+
+
+// Описатель зарегистрированного в epoll fd или NULL с errno
+static io_fd_t *io_register(int fd) {
+    pthread_once(&io_once, io_init);
+    if (io_init_error) {
+        errno = io_init_error;
+        return NULL;
+    }
+    io_fd_t *d = io_desc(fd);
+    if (!d || __atomic_load_n(&d->registered, __ATOMIC_ACQUIRE)) {
+        return d;
+    }
+
+    worker_t *w = this_worker();
+    int err = 0;
+    preempt_off(w);
+    spin_lock(&d->lock);
+    if (!d->registered) {
+        int flags = fcntl(fd, F_GETFL);
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = d };
+        if (flags == -1 || (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)) {
+            err = errno;
+        } else if (epoll_ctl(io_epfd, EPOLL_CTL_ADD, fd, &ev) != 0 && errno != EEXIST && errno != EPERM) {
+            // EPERM - обычный файл: epoll его не поддерживает, но он и не отвечает EAGAIN
+            err = errno;
+        } else {
+            __atomic_store_n(&d->registered, 1, __ATOMIC_RELEASE);
+        }
+    }
+    spin_unlock(&d->lock);
+    preempt_on(w);
+
+    if (err) {
+        errno = err;
+        return NULL;
+    }
+    return d;
+}
+
+
+static void io_wake(worker_t *w, uthread_node_t *node) {
+    __atomic_sub_fetch(&io_waiting, 1, __ATOMIC_RELAXED);
+    wake_up(w, node, 0);
+}
+
+
+// Ждёт событий до момента deadline (0 - не ждать, UINT64_MAX - без срока)
+// и будит потоки, чьи fd стали готовы или операции в io_uring завершились
+static void io_poll(worker_t *w, uint64_t deadline) {
+    struct epoll_event events[IO_EVENTS];
+    int n;
+    uring_flush();  // Накопленные заявки - в ядро до ожидания их завершения
+    if (deadline == UINT64_MAX) {
+        n = epoll_wait(io_epfd, events, IO_EVENTS, -1);
+    } else {
+        uint64_t now = deadline ? uthread_now() : 0;
+        uint64_t left = deadline > now ? deadline - now : 0;
+        struct timespec ts = { (time_t)(left / 1000000000), (long)(left % 1000000000) };
+        n = epoll_pwait2(io_epfd, events, IO_EVENTS, &ts, NULL);
+        if (n == -1 && errno == ENOSYS) {
+            // Ядро до 5.11: миллисекунды с округлением вверх - не раньше срока
+            n = epoll_wait(io_epfd, events, IO_EVENTS, (int)((left + 999999) / 1000000));
+        }
+    }
+    __atomic_store_n(&io_last_poll, uthread_now(), __ATOMIC_RELAXED);
+
+    for (int i = 0; i < n; i++) {
+        io_fd_t *d = (io_fd_t *)events[i].data.ptr;
+        if (!d) {
+            uint64_t count;
+            ssize_t ret = read(io_breakfd, &count, sizeof(count));
+            (void)ret;  // EAGAIN - уже вычитан
+            continue;
+        }
+        if ((void *)d == &io_uring_tag) {
+            uring_reap(w);
+            continue;
+        }
+
+        uint32_t e = events[i].events;
+        uthread_node_t *reader = NULL;
+        uthread_node_t *writer = NULL;
+        spin_lock(&d->lock);
+        if (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            d->rseq++;
+            reader = d->reader;
+            d->reader = NULL;
+        }
+        if (e & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            d->wseq++;
+            writer = d->writer;
+            d->writer = NULL;
+        }
+        spin_unlock(&d->lock);
+
+        if (reader) {
+            io_wake(w, reader);
+        }
+        if (writer) {
+            io_wake(w, writer);
+        }
+    }
+}
+
+
+// Опрос без ожидания между переключениями. Очередь завершений io_uring
+// читается из памяти - на каждом переключении; отправка заявок и epoll -
+// системные вызовы, их делает один воркер на тик
+static void io_poll_periodic(worker_t *w) {
+    if (__atomic_load_n(&uring_inflight, __ATOMIC_RELAXED)) {
+        uring_reap(w);
+    }
+    uint64_t now = uthread_now();
+    uint64_t last = __atomic_load_n(&io_last_poll, __ATOMIC_RELAXED);
+    if (now - last < IO_POLL_INTERVAL ||
+        !__atomic_compare_exchange_n(&io_last_poll, &last, now, 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    if (__atomic_load_n(&io_waiting, __ATOMIC_RELAXED)) {
+        io_poll(w, 0);  // Заодно отправит заявки
+    } else {
+        uring_flush();
+    }
+}
+
+
+// Ждёт готовности fd после EAGAIN. seq - счётчик готовности, снятый до
+// попытки: если он изменился, событие уже было - пробуем сразу
+static int io_wait(io_fd_t *d, int fd, int write, unsigned seq) {
+    worker_t *w = this_worker();
+    if (external(w)) {
+        // main при воркерах не поток планировщика - может просто ждать в ядре
+        struct pollfd p = { fd, write ? POLLOUT : POLLIN, 0 };
+        poll(&p, 1, -1);
+        return 0;
+    }
+
+    preempt_off(w);
+    spin_lock(&d->lock);
+    uthread_node_t **slot = write ? &d->writer : &d->reader;
+    if ((write ? d->wseq : d->rseq) != seq) {
+        spin_unlock(&d->lock);
+        preempt_on(w);
+        return 0;
+    }
+    if (*slot) {
+        // Ждать одного направления fd может только один поток
+        spin_unlock(&d->lock);
+        preempt_on(w);
+        errno = EBUSY;
+        return -1;
+    }
+    *slot = w->current;
+    __atomic_add_fetch(&io_waiting, 1, __ATOMIC_SEQ_CST);
+    w = block_on(w, &d->lock);
+    preempt_on(w);
+    return 0;
+}
+
+
+ssize_t uthread_read(int fd, void *buf, size_t count) {
+    io_fd_t *d = io_register(fd);
+    if (!d) {
+        return -1;
+    }
+    for (;;) {
+        unsigned seq = __atomic_load_n(&d->rseq, __ATOMIC_ACQUIRE);
+        ssize_t n = read(fd, buf, count);
+        if (n >= 0 || errno != EAGAIN) {
+            return n;
+        }
+        if (io_wait(d, fd, 0, seq) != 0) {
+            return -1;
+        }
+    }
+}
+
+
+ssize_t uthread_write(int fd, const void *buf, size_t count) {
+    io_fd_t *d = io_register(fd);
+    if (!d) {
+        return -1;
+    }
+    for (;;) {
+        unsigned seq = __atomic_load_n(&d->wseq, __ATOMIC_ACQUIRE);
+        ssize_t n = write(fd, buf, count);
+        if (n >= 0 || errno != EAGAIN) {
+            return n;
+        }
+        if (io_wait(d, fd, 1, seq) != 0) {
+            return -1;
+        }
+    }
+}
+
+
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+    io_fd_t *d = io_register(fd);
+    if (!d) {
+        return -1;
+    }
+    for (;;) {
+        unsigned seq = __atomic_load_n(&d->rseq, __ATOMIC_ACQUIRE);
+        int conn = accept4(fd, addr, addrlen, SOCK_NONBLOCK);
+        if (conn >= 0 || errno != EAGAIN) {
+            return conn;
+        }
+        if (io_wait(d, fd, 0, seq) != 0) {
+            return -1;
+        }
+    }
+}
+
+
+int uthread_close(int fd) {
+    io_fd_t *d = io_desc(fd);
+    if (d && __atomic_load_n(&d->registered, __ATOMIC_ACQUIRE)) {
+        // Номер fd достанется новому файлу - его придётся зарегистрировать
+        // заново. Ждущие просыпаются и получают EBADF
+        worker_t *w = this_worker();
+        preempt_off(w);
+        spin_lock(&d->lock);
+        uthread_node_t *reader = d->reader;
+        uthread_node_t *writer = d->writer;
+        d->reader = d->writer = NULL;
+        d->rseq++;
+        d->wseq++;
+        // Регистрация живёт, пока жив открытый файл, а не номер: после dup,
+        // fork или SCM_RIGHTS она пережила бы close и будила новый файл с
+        // тем же номером. ENOENT/EBADF - регистрации нет или fd уже закрыт,
+        // EPERM - обычный файл, epoll его не принимал
+        struct epoll_event ev = { 0 };
+        int del_err = 0;
+        if (epoll_ctl(io_epfd, EPOLL_CTL_DEL, fd, &ev) != 0 &&
+            errno != ENOENT && errno != EBADF && errno != EPERM) {
+            del_err = errno;
+        }
+        int ret = close(fd);
+        int err = errno;
+        if (ret == 0 && del_err) {
+            ret = -1;  // fd закрыт, но регистрация могла остаться - сообщаем
+            err = del_err;
+        }
+        __atomic_store_n(&d->registered, 0, __ATOMIC_RELEASE);
+        spin_unlock(&d->lock);
+        if (reader) {
+            io_wake(w, reader);
+        }
+        if (writer) {
+            io_wake(w, writer);
+        }
+        preempt_on(w);
+        errno = err;
+        return ret;
+    }
+    return close(fd);
+}
+
+
+// --- Файловый ввод-вывод через io_uring ---
+//
+// Обычный файл всегда "готов", и epoll ему не помогает: pread с диска
+// блокирует весь воркер. Поэтому чтение, запись и fsync файлов уходят в
+// одно на процесс кольцо io_uring. Поток кладёт заявку в очередь отправки
+// под спинлоком кольца и уходит с процессора, отпуская спинлок уже после
+// переключения; планировщик отправляет накопленные заявки всех потоков
+// одним io_uring_enter - когда готовых нет, и не чаще раза в тик, пока
+// они есть. Очередь завершений читается прямо из общей с ядром памяти на
+// каждом переключении, без системного вызова, а fd кольца зарегистрирован
+// в epoll: простаивающий воркер ждёт завершений вместе с fd и сроками.
+// Без io_uring (ядро до 5.6, запрет в sysctl), для операций, которых ядро
+// в кольце не умеет, и в main при воркерах - обычные блокирующие вызовы.
+
+typedef struct uring_req {
+    uthread_node_t *node;
+    int res;                        // Результат операции или -errno
+    struct uring_req *next;         // Список разбуженных при разборе завершений
+} uring_req_t;
+
+static struct {
+    int fd;
+    volatile int lock;
+    unsigned pending;               // Заявок в очереди, ещё не отправленных в ядро
+    unsigned entries;
+    unsigned cq_entries;            // Больше заявок в полёте не пускаем: завершения не переполнятся
+    unsigned sq_tail;               // Локальная копия хвоста очереди отправки
+    unsigned *sq_head, *sq_ktail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    uint64_t ops;                   // Операции, которые ядро умеет выполнять в кольце (бит на код)
+} uring = { .fd = -1 };
+
+static pthread_once_t uring_once = PTHREAD_ONCE_INIT;
+
+
+static void uring_init(void) {
+    pthread_once(&io_once, io_init);
+    if (io_init_error) {
+        return;
+    }
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(SYS_io_uring_setup, URING_ENTRIES, &p);
+    if (fd == -1) {
+        return;
+    }
+    // IORING_FEAT_RW_CUR_POS появился в 5.6 вместе с IORING_OP_READ/WRITE
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_RW_CUR_POS)) {
+        close(fd);
+        return;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+    size_t sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    char *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQ_RING);
+    void *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &io_uring_tag };
+    if (ring == MAP_FAILED || sqes == MAP_FAILED ||
+        epoll_ctl(io_epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        if (ring != MAP_FAILED) {
+            munmap(ring, ring_size);
+        }
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqes_size);
+        }
+        close(fd);
+        return;
+    }
+
+    // Неподдерживаемые операции сразу выполняются обычными вызовами, без
+    // круга через кольцо. IORING_REGISTER_PROBE есть с 5.6, как и
+    // IORING_FEAT_RW_CUR_POS, - без него кольцом не пользуемся
+    size_t probe_size = sizeof(struct io_uring_probe) + 64 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    if (!probe || syscall(SYS_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 64) != 0) {
+        free(probe);
+        munmap(ring, ring_size);
+        munmap(sqes, sqes_size);
+        close(fd);  // Закрытие снимает и регистрацию в epoll
+        return;
+    }
+    for (unsigned op = 0; op < probe->ops_len && op < 64; op++) {
+        if (probe->ops[op].flags & IO_URING_OP_SUPPORTED) {
+            uring.ops |= 1ull << op;
+        }
+    }
+    free(probe);
+
+    uring.entries = p.sq_entries;
+    uring.cq_entries = p.cq_entries;
+    uring.sq_head = (unsigned *)(ring + p.sq_off.head);
+    uring.sq_ktail = (unsigned *)(ring + p.sq_off.tail);
+    uring.sq_mask = (unsigned *)(ring + p.sq_off.ring_mask);
+    uring.sq_array = (unsigned *)(ring + p.sq_off.array);
+    uring.sq_tail = *uring.sq_ktail;
+    uring.cq_head = (unsigned *)(ring + p.cq_off.head);
+    uring.cq_tail = (unsigned *)(ring + p.cq_off.tail);
+    uring.cq_mask = (unsigned *)(ring + p.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+    uring.sqes = sqes;
+    uring.fd = fd;
+}
+
+
+// Отправляет в ядро заявки потоков, уже ушедших с процессора: поток
+// добавляет заявку и отпускает спинлок только после переключения, так что
+// счётчик pending под спинлоком видит лишь заявки спящих потоков. Ядро
+// берёт заявки с головы очереди - по порядку добавления
+static void uring_flush(void) {
+    if (!__atomic_load_n(&uring.pending, __ATOMIC_RELAXED)) {
+        return;
+    }
+    spin_lock(&uring.lock);
+    unsigned n = uring.pending;
+    uring.pending = 0;
+    spin_unlock(&uring.lock);
+
+    int ret;
+    do {
+        ret = (int)syscall(SYS_io_uring_enter, uring.fd, n, 0, 0, NULL, 0);
+    } while (ret == -1 && errno == EINTR);
+    if (ret < (int)n) {
+        // EAGAIN/EBUSY - ядру не хватило памяти или места под завершения:
+        // неотправленное уйдёт со следующей попыткой
+        spin_lock(&uring.lock);
+        uring.pending += n - (ret > 0 ? (unsigned)ret : 0);
+        spin_unlock(&uring.lock);
+    }
+}
+
+
+// Забирает завершения и будит их потоки
+static void uring_reap(worker_t *w) {
+    if (__atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE) ==
+        __atomic_load_n(uring.cq_head, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    uring_req_t *first = NULL;
+    uring_req_t **last = &first;
+    spin_lock(&uring.lock);
+    unsigned head = *uring.cq_head;
+    unsigned tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &uring.cqes[head & *uring.cq_mask];
+        uring_req_t *req = (uring_req_t *)(uintptr_t)cqe->user_data;
+        req->res = cqe->res;
+        *last = req;
+        last = &req->next;
+    }
+    *last = NULL;
+    __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+    spin_unlock(&uring.lock);
+
+    while (first) {
+        // Проснувшийся поток сразу освобождает заявку на своём стеке
+        uring_req_t *next = first->next;
+        uthread_node_t *node = first->node;
+        __atomic_sub_fetch(&uring_inflight, 1, __ATOMIC_RELAXED);
+        wake_up(w, node, 0);
+        first = next;
+    }
+}
+
+
+// Кладёт заявку в кольцо и ждёт её завершения. 0 - результат операции
+// (-errno при ошибке) в *res; -1 - кольцо для этой операции недоступно,
+// вызывающий выполняет её сам
+static int uring_submit(uint8_t opcode, int fd, const void *buf, size_t count, off_t offset, int *res) {
+    worker_t *w = this_worker();
+    if (external(w)) {
+        return -1;
+    }
+    pthread_once(&uring_once, uring_init);
+    if (uring.fd == -1 || !(uring.ops & (1ull << opcode))) {
+        return -1;
+    }
+    if (count > UINT_MAX) {
+        count = UINT_MAX;  // Одна заявка - не больше 4 ГБ; как и у pread, вернётся меньше
+    }
+
+    uring_req_t req = { .node = NULL, .res = 0, .next = NULL };
+    preempt_off(w);
+    for (;;) {
+        spin_lock(&uring.lock);
+        if (uring.sq_tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) < uring.entries &&
+            (unsigned)uring_inflight < uring.cq_entries) {
+            break;
+        }
+        // Кольцо заполнено: отправляем очередь сами и уступаем процессор,
+        // пока завершения не освободят место
+        spin_unlock(&uring.lock);
+        preempt_on(w);
+        uring_flush();
+        uthread_yield();
+        w = this_worker();
+        preempt_off(w);
+    }
+    unsigned idx = uring.sq_tail & *uring.sq_mask;
+    struct io_uring_sqe *sqe = &uring.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (unsigned)count;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = (uint64_t)(uintptr_t)&req;
+    uring.sq_array[idx] = idx;
+    __atomic_store_n(uring.sq_ktail, ++uring.sq_tail, __ATOMIC_RELEASE);
+    uring.pending++;
+
+    req.node = w->current;
+    __atomic_add_fetch(&uring_inflight, 1, __ATOMIC_SEQ_CST);
+    w = block_on(w, &uring.lock);
+    preempt_on(w);
+    *res = req.res;
+    return 0;
+}
+
+
+static ssize_t uring_result(int res) {
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return res;
+}
+
+
+ssize_t uthread_pread(int fd, void *buf, size_t count, off_t offset) {
+    int res;
+    if (uring_submit(IORING_OP_READ, fd, buf, count, offset, &res) != 0) {
+        return pread(fd, buf, count, offset);
+    }
+    return uring_result(res);
+}
+
+
+ssize_t uthread_pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    int res;
+    if (uring_submit(IORING_OP_WRITE, fd, buf, count, offset, &res) != 0) {
+        return pwrite(fd, buf, count, offset);
+    }
+    return uring_result(res);
+}
+
+
+int uthread_fsync(int fd) {
+    int res;
+    if (uring_submit(IORING_OP_FSYNC, fd, NULL, 0, 0, &res) != 0) {
+        return fsync(fd);
+    }
+    return (int)uring_result(res);
+}
+
+
+// --- Вытеснение по таймеру ---
+//
+// Таймер timer_create шлёт SIGALRM именно тому ядерному потоку, который
+// включил вытеснение, раз в полкванта; у каждого воркера пула свой таймер.
+// Поток, отработавший два тика, снимается с процессора прямо из
+// обработчика сигнала: кадр обработчика остаётся на его стеке, и когда
+// поток снова выберут, обработчик вернётся и sigreturn восстановит все
+// регистры.
+//
+// Переключаться можно не в любой точке. Внутри библиотеки и критических
+// секций (uthread_preempt_disable) переключение откладывается до выхода.
+// Внутри разделяемых библиотек (libc: malloc, stdio держат свои
+// блокировки) - тоже: поток, прерванный там, переключится на следующем
+// тике, когда окажется в коде программы.
+//
+// Код самой uthread - в этом же списке, и это обязательно при воркерах:
+// функция API читает this_worker() до preempt_off, и поток, снятый между
+// ними, продолжил бы на другом воркере со старым w - чужим пулом узлов и
+// чужим current. Если uthread собрана внутрь программы, её код от кода
+// программы не отличить - тогда вытеснение разрешено только без воркеров.
+
+#if defined(__x86_64__)
+
+static struct {
+    uintptr_t start;
+    uintptr_t end;
+} unsafe_code[PREEMPT_MAX_CODE];
+static int unsafe_code_count = 0;
+
+static int preempt_installed = 0;
+static int preempt_self_in_program = 0;  // Код uthread не в своей разделяемой библиотеке
+static struct sigaction preempt_old_action;
+
+
+static void preempt_handler(int sig, siginfo_t *info, void *ucontext);
+
+
+// Запоминает исполняемые сегменты всех разделяемых объектов (и libuthread
+// среди них), кроме самой программы и vDSO (clock_gettime там не берёт
+// блокировок)
+static int collect_unsafe_code(struct dl_phdr_info *info, size_t size, void *data) {
+    (void)size;
+    (void)data;
+    int program = info->dlpi_name[0] == '\0';
+    if (!program && strncmp(info->dlpi_name, "linux-vdso", 10) == 0) {
+        return 0;
+    }
+    uintptr_t self = (uintptr_t)preempt_handler;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X)) {
+            continue;
+        }
+        uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+        uintptr_t end = start + ph->p_memsz;
+        if (program) {
+            if (self >= start && self < end) {
+                preempt_self_in_program = 1;
+            }
+            continue;
+        }
+        if (unsafe_code_count == PREEMPT_MAX_CODE) {
+            return 1;
+        }
+        unsafe_code[unsafe_code_count].start = start;
+        unsafe_code[unsafe_code_count].end = end;
+        unsafe_code_count++;
+    }
+    return 0;
+}
+
+
+static int preempt_safe_point(const ucontext_t *uc) {
+    uintptr_t pc = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+    for (int i = 0; i < unsafe_code_count; i++) {
+        if (pc >= unsafe_code[i].start && pc < unsafe_code[i].end) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static void preempt_handler(int sig, siginfo_t *info, void *ucontext) {
+    (void)sig;
+    (void)info;
+    worker_t *w = this_worker();
+
+    if (++w->slice_ticks < 2) {
+        return;  // Поток получил процессор меньше кванта назад
+    }
+    if (w->preempt_depth > 0 || !preempt_safe_point((const ucontext_t *)ucontext)) {
+        w->preempt_pending = 1;
+        return;
+    }
+
+    int saved_errno = errno;
+
+    // Следующий поток продолжит не из обработчика, а в обработчике
+    // сигнал заблокирован - снимаем блокировку (после запрета вытеснения)
+    w->preempt_depth = 1;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, PREEMPT_SIGNAL);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+    w->preempt_depth = 0;
+    preempt_switch(w);
+    errno = saved_errno;
+}
+
+
+static void preempt_stop(worker_t *w) {
+    timer_delete(w->preempt_timer);
+    w->preempt_active = 0;
+    w->preempt_pending = 0;
+    // Обработчик остаётся, пока таймеры могут быть у воркеров пула
+    if (!workers_started) {
+        sigaction(PREEMPT_SIGNAL, &preempt_old_action, NULL);
+        preempt_installed = 0;
+    }
+}
+
+
+int uthread_preempt(unsigned quantum_us) {
+    worker_t *w = this_worker();
+    if (w->preempt_active) {
+        preempt_stop(w);
+    }
+    if (w == &main_worker) {
+        preempt_quantum_us = quantum_us;
+    }
+    if (quantum_us == 0) {
+        return 0;
+    }
+
+    if (!preempt_installed) {
+        unsafe_code_count = 0;
+        preempt_self_in_program = 0;
+        dl_iterate_phdr(collect_unsafe_code, NULL);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = preempt_handler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(PREEMPT_SIGNAL, &sa, &preempt_old_action) == -1) {
+            return -1;
+        }
+        preempt_installed = 1;
+    }
+
+    if (preempt_self_in_program && (workers_started || w != &main_worker)) {
+        // Переключение посреди API не отложить - см. начало раздела
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = PREEMPT_SIGNAL;
+    sev._sigev_un._tid = gettid();
+    if (timer_create(CLOCK_MONOTONIC, &sev, &w->preempt_timer) == -1) {
+        return -1;
+    }
+
+    // Тик - полкванта: поток работает от половины до целого кванта
+    unsigned long tick_ns = (unsigned long)quantum_us * 1000 / 2;
+    struct itimerspec its;
+    its.it_interval.tv_sec = tick_ns / 1000000000;
+    its.it_interval.tv_nsec = tick_ns % 1000000000;
+    its.it_value = its.it_interval;
+    if (timer_settime(w->preempt_timer, 0, &its, NULL) == -1) {
+        int err = errno;
+        preempt_stop(w);
+        errno = err;
+        return -1;
+    }
+
+    w->preempt_active = 1;
+    return 0;
+}
+
+#else
+
+int uthread_preempt(unsigned quantum_us) {
+    if (quantum_us == 0) {
+        return 0;
+    }
+    errno = ENOTSUP;  // Точка прерывания берётся из регистров x86-64
+    return -1;
+}
+
+#endif
+
+
+void uthread_preempt_disable(void) {
+    preempt_off(this_worker());
+}
+
+
+void uthread_preempt_enable(void) {
+    preempt_on(this_worker());
 }
\ No newline at end of file
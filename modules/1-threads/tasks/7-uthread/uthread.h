@@ -1,27 +1,227 @@
 #ifndef UTHREAD_H
 #define UTHREAD_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 #include <ucontext.h>
 
+// Сохранённый контекст потока. На x86-64 - только указатель стека:
+// остальные регистры, которые нужно сохранить, лежат на самом стеке
+#if defined(__x86_64__)
+typedef struct {
+    void *sp;
+} uthread_context_t;
+#else
+typedef struct {
+    ucontext_t uc;
+} uthread_context_t;
+#endif
+
 typedef enum {
     UTHREAD_RUNNING,
     UTHREAD_FINISHED
 } uthread_state_t;
 
-typedef struct {
-    ucontext_t context;
+// Поток планировщика. Принадлежит библиотеке: после join (или выхода
+// отсоединённого потока) узел со стеком уходит в пул и переиспользуется
+typedef struct uthread_node {
+    uthread_context_t context;
     void *stack;
     void *retval;
     uthread_state_t state;
+    void *(*start_routine)(void*);
+    int profiled;               // Стек заполнен шаблоном при создании
+    int detached;               // Узел освобождается сам при выходе
+    volatile int lock;          // state, joiner, detached при нескольких воркерах
+    struct uthread_node *joiner;    // Поток, ждущий в uthread_join
+    struct uthread_node *next;  // Связь в очереди (готовых или ожидающих)
+    size_t *stack_used;         // Куда записать глубину стека (в uthread_t)
+} uthread_node_t;
+
+// Дескриптор потока у пользователя
+typedef struct {
+    uthread_node_t *node;       // NULL после join или detach
+    size_t stack_used;          // Максимальная глубина стека (при включённом профиле)
 } uthread_t;
 
-typedef struct uthread_node {
-    uthread_t thread;
-    struct uthread_node *next;
-} uthread_node_t;
+// Очередь потоков (FIFO с указателем на хвост) - вставка и выборка за O(1)
+typedef struct {
+    uthread_node_t *head;
+    uthread_node_t *tail;
+} uthread_queue_t;
 
+// Создаёт поток и ставит его в конец очереди готовых. 0 или -1
 int uthread_create(uthread_t *thread, void *(*start_routine)(void*), void *arg);
+
+// Отдаёт процессор следующему готовому потоку. Из main - выполняет потоки,
+// пока готовых не останется (при воркерах - ждёт, пока они их не выполнят)
 void uthread_yield(void);
+
+// Завершает текущий поток с результатом retval
 void uthread_exit(void *retval);
 
+// Ждёт завершения потока (из потока или из main), забирает результат и
+// возвращает стек в пул. 0 или -1 (EINVAL - уже присоединён или
+// отсоединён, EDEADLK - ожидание самого себя)
+int uthread_join(uthread_t *thread, void **retval);
+
+// Поток освободит стек сам при выходе, join больше не нужен
+int uthread_detach(uthread_t *thread);
+
+// Время по CLOCK_MONOTONIC в наносекундах - в нём задаются сроки (deadline)
+uint64_t uthread_now(void);
+
+// Спит ns наносекунд / до момента deadline, отдав процессор другим потокам.
+// Сроки хранятся в колесе таймеров воркера (точность - 65 мкс, не раньше
+// срока) и проверяются на каждом переключении; когда готовых потоков нет,
+// воркер спит в ядре до ближайшего срока. main при воркерах спит сама.
+// Возвращают 0
+int uthread_sleep(uint64_t ns);
+int uthread_sleep_until(uint64_t deadline);
+
+// Мьютекс, условная переменная и семафор для потоков uthread. Ожидающий
+// поток встаёт в очередь объекта и отдаёт процессор следующему готовому -
+// ядерный поток не блокируется. Работают и между воркерами режима M:N.
+// Статическая инициализация - нулями (UTHREAD_*_INITIALIZER).
+// Функции возвращают 0 или -1 с errno. *_timedwait ждут не дольше момента
+// deadline (uthread_now) - иначе ETIMEDOUT; timedwait условия и по сроку
+// возвращается с захваченным мьютексом.
+
+// Мьютекс передаётся при unlock первому ожидающему (FIFO, без перехвата).
+// lock своего мьютекса - EDEADLK, unlock чужого - EPERM, trylock
+// занятого - EBUSY
+typedef struct {
+    volatile int lock;
+    uthread_node_t *owner;
+    uthread_queue_t waiters;
+} uthread_mutex_t;
+
+typedef struct {
+    volatile int lock;
+    uthread_queue_t waiters;
+} uthread_cond_t;
+
+// post будит первого ожидающего, не увеличивая value. trywait при
+// нулевом значении - EAGAIN
+typedef struct {
+    volatile int lock;
+    unsigned value;
+    uthread_queue_t waiters;
+} uthread_sem_t;
+
+#define UTHREAD_MUTEX_INITIALIZER { 0, NULL, { NULL, NULL } }
+#define UTHREAD_COND_INITIALIZER  { 0, { NULL, NULL } }
+
+int uthread_mutex_init(uthread_mutex_t *mutex);
+int uthread_mutex_destroy(uthread_mutex_t *mutex);   // EBUSY - занят или есть ожидающие
+int uthread_mutex_lock(uthread_mutex_t *mutex);
+int uthread_mutex_trylock(uthread_mutex_t *mutex);
+int uthread_mutex_unlock(uthread_mutex_t *mutex);
+
+int uthread_cond_init(uthread_cond_t *cond);
+int uthread_cond_destroy(uthread_cond_t *cond);      // EBUSY - есть ожидающие
+int uthread_cond_wait(uthread_cond_t *cond, uthread_mutex_t *mutex);
+int uthread_cond_timedwait(uthread_cond_t *cond, uthread_mutex_t *mutex, uint64_t deadline);
+int uthread_cond_signal(uthread_cond_t *cond);
+int uthread_cond_broadcast(uthread_cond_t *cond);
+
+int uthread_sem_init(uthread_sem_t *sem, unsigned value);
+int uthread_sem_destroy(uthread_sem_t *sem);         // EBUSY - есть ожидающие
+int uthread_sem_wait(uthread_sem_t *sem);
+int uthread_sem_timedwait(uthread_sem_t *sem, uint64_t deadline);
+int uthread_sem_trywait(uthread_sem_t *sem);
+int uthread_sem_post(uthread_sem_t *sem);
+
+// Каналы между потоками uthread, как в Go. Элемент - elem_size байт
+// (копируется memcpy), capacity - размер буфера (0 - без буфера: send
+// ждёт получателя). Ждущий получатель получает данные прямо от
+// отправителя и выполняется следующим, минуя очередь готовых.
+typedef struct uthread_chan uthread_chan_t;
+
+// Канал для значений типа type: uthread_chan_of(int, 16)
+#define uthread_chan_of(type, capacity) uthread_chan_create(sizeof(type), (capacity))
+
+uthread_chan_t *uthread_chan_create(size_t elem_size, size_t capacity);
+int uthread_chan_destroy(uthread_chan_t *ch);        // EBUSY - есть ждущие
+
+// 0 или -1 с EPIPE: канал закрыт (для recv - закрыт и пуст, в *elem нули).
+// recv с elem == NULL отбрасывает значение
+int uthread_chan_send(uthread_chan_t *ch, const void *elem);
+int uthread_chan_recv(uthread_chan_t *ch, void *elem);
+
+// Будит всех ждущих с EPIPE; данные из буфера ещё можно получить.
+// Повторное закрытие - EPIPE
+int uthread_chan_close(uthread_chan_t *ch);
+
+typedef enum {
+    UTHREAD_CHAN_SEND,
+    UTHREAD_CHAN_RECV
+} uthread_chan_op_t;
+
+typedef struct {
+    uthread_chan_t *chan;       // NULL - вариант никогда не срабатывает
+    uthread_chan_op_t op;
+    void *elem;                 // Что отправить / куда принять
+    int ok;                     // После select: 1 - передано, 0 - канал закрыт
+} uthread_chan_case_t;
+
+// Выполняет один готовый вариант из n (не больше 16) и возвращает его
+// номер. Если готовых нет: block != 0 - ждёт, иначе -1 с EAGAIN
+int uthread_chan_select(uthread_chan_case_t *cases, int n, int block);
+
+// Ввод-вывод без блокировки ядерного потока: fd переводится в O_NONBLOCK,
+// а поток, получивший EAGAIN, ждёт готовности fd в epoll планировщика,
+// отдав процессор другим. Возвращают то же, что read/write/accept
+// (accept - новый fd уже в O_NONBLOCK). Ждать одного направления fd может
+// только один поток (второй получит EBUSY). fd, использованные здесь,
+// закрываются через uthread_close - она будит ждущих (они получат EBADF)
+// и забывает регистрацию: номер fd может достаться новому файлу.
+// main при воркерах ждёт в poll.
+ssize_t uthread_read(int fd, void *buf, size_t count);
+ssize_t uthread_write(int fd, const void *buf, size_t count);
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+int uthread_close(int fd);
+
+// Файловый ввод-вывод через io_uring: поток отдаёт процессор, пока операция
+// выполняется в ядре, а заявки всех потоков отправляются одним системным
+// вызовом за круг планировщика. Возвращают то же, что pread/pwrite/fsync.
+// Без io_uring (ядро до 5.6) и в main при воркерах - обычные блокирующие вызовы.
+ssize_t uthread_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t uthread_pwrite(int fd, const void *buf, size_t count, off_t offset);
+int uthread_fsync(int fd);
+
+// Режим M:N: запускает n ядерных потоков-воркеров (pthread) со своими
+// очередями готовых. Воркер без работы крадёт потоки из чужих очередей,
+// поэтому поток может продолжить после yield или join на другом ядерном
+// потоке: адреса __thread-переменных (и errno) между такими вызовами
+// запоминать нельзя. Вызывается из main один раз, пока её очередь пуста;
+// дальше main только создаёт потоки (они раздаются воркерам по кругу) и
+// ждёт их в uthread_join. 0 или -1 (EBUSY - воркеры уже запущены или
+// есть потоки в очереди main)
+int uthread_workers(int n);
+
+// Вытеснение по таймеру: поток, не уступивший процессор за квант
+// (в микросекундах), переключается принудительно. 0 - выключить.
+// Таймер привязан к ядерному потоку, который вызвал функцию, и шлёт ему
+// SIGALRM - этот сигнал программе использовать нельзя. Воркеры, запущенные
+// после вызова из main, заводят себе таймеры с тем же квантом. Поток, прерванный
+// внутри разделяемой библиотеки (libc и т.п.) или самой uthread, переключится
+// на следующем тике. 0 или -1 (ENOTSUP - не x86-64 или, при воркерах, uthread
+// собрана внутрь программы, а не разделяемой библиотекой)
+int uthread_preempt(unsigned quantum_us);
+
+// Критическая секция: пока она не закрыта, текущий поток не вытесняется.
+// Вложенные пары разрешены
+void uthread_preempt_disable(void);
+void uthread_preempt_enable(void);
+
+// Профиль стека: стеки новых потоков заполняются шаблоном, при выходе
+// потока его глубина попадает в stack_used и в сводку по start_routine.
+// UTHREAD_STACK_PROFILE=1 в окружении включает профиль и печатает сводку
+// в stderr при выходе из программы.
+void uthread_stack_profile(int enable);
+void uthread_stack_report(int fd);
+
 #endif // UTHREAD_H